@@ -107,17 +107,313 @@
  
 // Subscriptions
 #define NUMBER_SUBSCRIPTIONS 4
+#define SUBSCRIPTION_SIZE 50
 
-// Debug mode
+// MQTT reconnection: the delay between attempts doubles after each failure,
+// from min. to max. (ms), and a random part of up to half of it is removed
+#ifndef AREST_MQTT_BACKOFF_MIN
+#define AREST_MQTT_BACKOFF_MIN 1000
+#endif
+#ifndef AREST_MQTT_BACKOFF_MAX
+#define AREST_MQTT_BACKOFF_MAX 60000
+#endif
+
+// Variables published over MQTT when they change, and default min. time
+// between two publications of a variable (ms)
+#ifndef NUMBER_WATCHES
+#define NUMBER_WATCHES 8
+#endif
+#define AREST_TELEMETRY_MIN_INTERVAL 1000
+
+// Size of the hashed route index for variables & functions (two slots per route)
+#ifndef ROUTE_INDEX_SIZE
+#define ROUTE_INDEX_SIZE (2 * (3 * NUMBER_VARIABLES + NUMBER_FUNCTIONS))
+#endif
+
+// Route kinds in the route index, by lookup priority
+#define AREST_ROUTE_FUNCTION 0
+#define AREST_ROUTE_INT 1
+#define AREST_ROUTE_FLOAT 2
+#define AREST_ROUTE_STRING 3
+#define AREST_NO_ROUTE 0
+
+// Size of the buffer holding the URL segment being parsed
+#ifndef REQUEST_BUFFER_SIZE
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(CORE_WILDFIRE) || defined(ESP8266)
+  #define REQUEST_BUFFER_SIZE 128
+  #else
+  #define REQUEST_BUFFER_SIZE 64
+  #endif
+#endif
+
+// Digital pins are sampled a whole port register at a time on AVR cores,
+// unless AREST_PORTABLE_PIN_READS is defined
+#if defined(__AVR__) && !defined(AREST_PORTABLE_PIN_READS)
+#define AREST_PORT_REGISTERS
+#endif
+#define AREST_MAX_PORTS 16
+
+// Size of a sample of all digital pins, one bit per pin
+#define AREST_DIGITAL_SAMPLE_SIZE ((NUMBER_DIGITAL_PINS + 7) / 8)
+
+// Cache of the serialized root & id answers, enabled by defining
+// AREST_RESPONSE_CACHE: rebuilt when a variable changes, found by comparing
+// their values to a snapshot, or only when touch() is called
+#define AREST_CACHE_OFF 0
+#define AREST_CACHE_SNAPSHOT 1
+#define AREST_CACHE_TOUCH 2
+#define AREST_CACHE_ROOT 0
+#define AREST_CACHE_ID 1
+#define AREST_CACHE_NOT_RECORDING 0xFFFF
+#ifndef AREST_CACHE_SIZE
+#define AREST_CACHE_SIZE OUTPUT_BUFFER_SIZE
+#endif
+#define AREST_CACHE_ID_SIZE (ID_SIZE + NAME_SIZE + 80)
+
+// Metrics, enabled by defining AREST_METRICS: request counts & latency
+// histograms of each route (fixed routes first, then functions, int, float &
+// string variables), with the upper bounds of the histogram buckets (µs)
+#define AREST_METRIC_ROOT 0
+#define AREST_METRIC_ID 1
+#define AREST_METRIC_DIGITAL 2
+#define AREST_METRIC_ANALOG 3
+#define AREST_METRIC_MODE 4
+#define AREST_METRIC_BATCH 5
+#define AREST_METRIC_METRICS 6
+#define AREST_METRIC_TRACE 7
+#define AREST_METRIC_WAIT 8
+#define AREST_METRIC_ROUTES 9
+#define AREST_METRIC_SLOTS (AREST_METRIC_ROUTES + NUMBER_FUNCTIONS + 3 * NUMBER_VARIABLES)
+#define AREST_METRIC_NONE 0xFFFF
+#define AREST_METRIC_BUCKETS 6
+
+// Max. number of variables & pins in a batch query
+#ifndef AREST_BATCH_SIZE
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(CORE_WILDFIRE) || defined(ESP8266)
+  #define AREST_BATCH_SIZE 16
+  #else
+  #define AREST_BATCH_SIZE 8
+  #endif
+#endif
+
+// Pacing of answers: fixed chunks & pauses (former behaviour), flow control
+// on the client's availableForWrite() & write() results, or flow control with
+// a chunk size learned from short writes
+#define AREST_PACING_FIXED 0
+#define AREST_PACING_FLOW 1
+#define AREST_PACING_ADAPTIVE 2
+#ifndef AREST_PACING
+#define AREST_PACING AREST_PACING_FLOW
+#endif
+
+// Smallest chunk of the adaptive pacing, and how long a client may stall (ms)
+#define AREST_MIN_CHUNK_SIZE 8
+#ifndef AREST_SEND_TIMEOUT
+#define AREST_SEND_TIMEOUT 2000
+#endif
+
+// HTTP answers: common headers, the room kept for all the headers before the
+// answer until its length is known, and the room kept before each chunk of
+// answers that outgrow the buffer on kept-alive connections
+#define AREST_HTTP_HEADERS "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nAccess-Control-Allow-Methods: POST, GET, PUT, OPTIONS\r\nContent-Type: application/json\r\n"
+#define AREST_HTTP_CBOR_HEADERS "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nAccess-Control-Allow-Methods: POST, GET, PUT, OPTIONS\r\nContent-Type: application/cbor\r\n"
+#define AREST_TRAILER_SIZE (sizeof("\"id\": \"\", \"name\": \"\", \"hardware\": \"\", \"connected\": true}\r\n") + ID_SIZE + NAME_SIZE + sizeof(HARDWARE))
+#if defined(AREST_METRICS)
+#define AREST_HTTP_TEXT_HEADERS "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nAccess-Control-Allow-Methods: POST, GET, PUT, OPTIONS\r\nContent-Type: text/plain; version=0.0.4\r\n"
+#define AREST_HTTP_HEADERS_SIZE (sizeof(AREST_HTTP_TEXT_HEADERS) + sizeof("Transfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\nFFF\r\n"))
+#else
+#define AREST_HTTP_HEADERS_SIZE (sizeof(AREST_HTTP_HEADERS) + sizeof("Transfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\nFFF\r\n"))
+#endif
+#define AREST_HTTP_CHUNK_ROOM 7
+
+// HTTP keep-alive: how long a connection may stay idle between requests (ms),
+// and how many requests it may serve before it is closed
+#ifndef AREST_HTTP_KEEP_ALIVE_TIMEOUT
+#define AREST_HTTP_KEEP_ALIVE_TIMEOUT 250
+#endif
+#ifndef AREST_HTTP_KEEP_ALIVE_MAX
+#define AREST_HTTP_KEEP_ALIVE_MAX 10
+#endif
+
+// Connection tables: default number of connections, and max. bytes read
+// from a connection each time it is advanced
+#ifndef AREST_MAX_CONNECTIONS
+#define AREST_MAX_CONNECTIONS 4
+#endif
+#ifndef AREST_CONNECTION_BUDGET
+#define AREST_CONNECTION_BUDGET 256
+#endif
+
+// HTTP requests are read a block at a time: size of a block
+#ifndef AREST_HTTP_READ_BLOCK
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(CORE_WILDFIRE) || defined(ESP8266)
+  #define AREST_HTTP_READ_BLOCK 128
+  #else
+  #define AREST_HTTP_READ_BLOCK 32
+  #endif
+#endif
+
+// Events published to a server are queued, and sent together in one request
+// once the queue is filled up to the flush size (bytes) or its oldest event
+// waited for the flush interval (ms). Without a queue (size 0, the default on
+// AVR), each event is sent at once from the output buffer.
+#ifndef AREST_EVENT_QUEUE_SIZE
+  #if defined(ESP8266)
+  #define AREST_EVENT_QUEUE_SIZE 512
+  #elif defined(__AVR__)
+  #define AREST_EVENT_QUEUE_SIZE 0
+  #else
+  #define AREST_EVENT_QUEUE_SIZE 64
+  #endif
+#endif
+#if AREST_EVENT_QUEUE_SIZE > 0
+#define AREST_EVENT_ROOM AREST_EVENT_QUEUE_SIZE
+#else
+#define AREST_EVENT_ROOM (OUTPUT_BUFFER_SIZE - 1)
+#endif
+#ifndef AREST_EVENT_FLUSH_SIZE
+#define AREST_EVENT_FLUSH_SIZE (AREST_EVENT_QUEUE_SIZE / 2)
+#endif
+#ifndef AREST_EVENT_FLUSH_INTERVAL
+#define AREST_EVENT_FLUSH_INTERVAL 1000
+#endif
+#define AREST_EVENT_HEADER_SIZE 160
+
+// Max. time waited for the next byte of a serial command that isn't over (ms)
+#ifndef AREST_SERIAL_TIMEOUT
+#define AREST_SERIAL_TIMEOUT 10
+#endif
+
+// Binary protocol of the serial transports, enabled by defining AREST_BINARY:
+// a request starting with a zero byte is a frame, COBS-encoded between zero
+// bytes, holding an opcode, its arguments and their CRC16 (CCITT, low byte
+// first). The answer frame holds the opcode, a status & the values asked for,
+// each given by its type. Routes are the bytes of the route index.
+#define AREST_OP_DIGITAL_READ 1   // pin
+#define AREST_OP_DIGITAL_WRITE 2  // pin, value
+#define AREST_OP_ANALOG_READ 3    // pin
+#define AREST_OP_ANALOG_WRITE 4   // pin, value (2 bytes)
+#define AREST_OP_MODE 5           // pin, mode (0: input, 1: output)
+#define AREST_OP_GET 6            // route of a variable
+#define AREST_OP_CALL 7           // route of a function, its arguments
+#define AREST_OP_ROUTES 8         // none: answers route, name length & name of each route
+#define AREST_STATUS_OK 0
+#define AREST_STATUS_BAD_FRAME 1
+#define AREST_STATUS_BAD_REQUEST 2
+#define AREST_STATUS_DISABLED 3
+#define AREST_VALUE_INT 'i'       // 4 bytes, low byte first
+#define AREST_VALUE_FLOAT 'f'     // IEEE 754 single, low byte first
+#define AREST_VALUE_STRING 's'    // length, characters
+
+// Connections served in time slices: step a connection is at, and what a
+// step did
+#define AREST_STEP_READ 0
+#define AREST_STEP_ANSWER 1
+#define AREST_STEP_SEND 2
+#define AREST_STEP_WAIT 3
+#define AREST_STEP_STREAM 4
+#define AREST_SLICE_IDLE 0
+#define AREST_SLICE_BUSY 1
+#define AREST_SLICE_ANSWERED 2
+
+// Waits, enabled by defining AREST_WAIT: comparison of the value waited on
+// to the one given (a change of the value when none is given), and how long
+// to wait by default (ms)
+#define AREST_WAIT_CHANGE 0
+#define AREST_WAIT_EQ 1
+#define AREST_WAIT_NE 2
+#define AREST_WAIT_GT 3
+#define AREST_WAIT_GE 4
+#define AREST_WAIT_LT 5
+#define AREST_WAIT_LE 6
+#ifndef AREST_WAIT_TIMEOUT
+#define AREST_WAIT_TIMEOUT 10000
+#endif
+
+// Streams of Server-Sent Events, enabled by defining AREST_STREAM: how many
+// connections stream at once, and time between events by default (ms)
+#ifndef AREST_MAX_STREAMS
+#define AREST_MAX_STREAMS 2
+#endif
+#ifndef AREST_STREAM_INTERVAL
+#define AREST_STREAM_INTERVAL 1000
+#endif
+
+// States of the HTTP request reader
+#define AREST_HTTP_REQUEST_LINE 0
+#define AREST_HTTP_HEADER_LINES 1
+#define AREST_HTTP_BODY 2
+#define AREST_HTTP_NO_MATCH 255
+
+// Float formatting: max. decimals & size of a formatted float
+#define AREST_FLOAT_MAX_PRECISION 7
+#define AREST_FLOAT_SIZE 24
+
+// Debug mode: no longer prints anything, see AREST_TRACE_LEVEL
 #ifndef DEBUG_MODE
 #define DEBUG_MODE 0
 #endif
 
+// Trace of the library's events, recorded in a RAM ring & returned by
+// /trace: 0 (none, and no code), 1 (errors), 2 (requests & connections) or
+// 3 (everything, such as each URL segment parsed). Records kept:
+#ifndef AREST_TRACE_LEVEL
+#define AREST_TRACE_LEVEL 0
+#endif
+#ifndef AREST_TRACE_SIZE
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(CORE_WILDFIRE) || defined(ESP8266)
+  #define AREST_TRACE_SIZE 32
+  #else
+  #define AREST_TRACE_SIZE 8
+  #endif
+#endif
+
+// Trace levels, and events traced with their two arguments
+#define AREST_TRACE_ERROR 1
+#define AREST_TRACE_INFO 2
+#define AREST_TRACE_DEBUG 3
+#define AREST_TRACE_NOT_UNDERSTOOD 1    // 0, 0
+#define AREST_TRACE_SEGMENT_TOO_LONG 2  // command, segment length kept
+#define AREST_TRACE_SEND_TIMEOUT 3      // 0, bytes left
+#define AREST_TRACE_ANSWER_TOO_LONG 4   // 0, answer length
+#define AREST_TRACE_MQTT_FAILED 5       // client state, backoff delay (s)
+#define AREST_TRACE_EVENTS_FAILED 6     // 0, bytes queued
+#define AREST_TRACE_BAD_FRAME 7         // 0, frame length
+#define AREST_TRACE_REQUEST 16          // command, pin or route
+#define AREST_TRACE_SENT 17             // stalls, bytes
+#define AREST_TRACE_MQTT_CONNECTED 18   // 0, connections made
+#define AREST_TRACE_MQTT_LOST 19        // 0, connections lost
+#define AREST_TRACE_EVENTS_SENT 20      // 0, bytes
+#define AREST_TRACE_SEGMENT 32          // first character, length
+#define AREST_TRACE_BLOCK 33            // 0, bytes read
+#define AREST_TRACE_FREE_MEMORY 34      // 0, free memory (bytes)
+
+// Record an event, or nothing at all when its level isn't traced
+#if AREST_TRACE_LEVEL > 0
+#define AREST_TRACE(level, event, a, b) do { if ((level) <= AREST_TRACE_LEVEL) {trace(event, a, b);} } while (0)
+#else
+#define AREST_TRACE(level, event, a, b) do {} while (0)
+#endif
+
 // Use light answer mode
 #ifndef LIGHTWEIGHT
 #define LIGHTWEIGHT 0
 #endif
 
+// Answer formats: JSON, lightweight (the values alone) or CBOR (when AREST_CBOR
+// is defined). Each request may ask for one with ?fmt=json, ?fmt=light or
+// ?fmt=cbor, else gets the default one: lightweight if LIGHTWEIGHT is set.
+#define AREST_FORMAT_JSON 0
+#define AREST_FORMAT_LIGHT 1
+#define AREST_FORMAT_CBOR 2
+#ifndef AREST_FORMAT
+#if LIGHTWEIGHT
+#define AREST_FORMAT AREST_FORMAT_LIGHT
+#else
+#define AREST_FORMAT AREST_FORMAT_JSON
+#endif
+#endif
+
 // Default number of max. exposed variables
 #ifndef NUMBER_VARIABLES
   #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(CORE_WILDFIRE) || defined(ESP8266) || !defined(ADAFRUIT_CC3000_H)
@@ -136,7 +432,181 @@
   #endif
 #endif
 
-class aREST {
+// Positions in the route index are stored on 6 bits
+#if NUMBER_VARIABLES > 63 || NUMBER_FUNCTIONS > 63
+#error "NUMBER_VARIABLES and NUMBER_FUNCTIONS must be at most 63"
+#endif
+
+// Two-digit lookup table for number formatting
+static const char aREST_digit_pairs[] PROGMEM =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+// Request headers read by the HTTP request reader, in lower case
+static const char aREST_header_connection[] PROGMEM = "connection:";
+static const char aREST_header_content_length[] PROGMEM = "content-length:";
+
+// Answer headers, as whole fragments: the common headers end with the
+// Content-Length name, which is left out of answers streamed before their
+// length is known
+static const char aREST_http_headers[] PROGMEM = AREST_HTTP_HEADERS "Content-Length: ";
+static const char aREST_http_keep_alive[] PROGMEM = "\r\nConnection: keep-alive\r\n\r\n";
+static const char aREST_http_close[] PROGMEM = "\r\nConnection: close\r\n\r\n";
+static const char aREST_http_chunked[] PROGMEM = "Transfer-Encoding: chunked\r\nConnection: keep-alive\r\n\r\n";
+#if defined(AREST_CBOR)
+static const char aREST_http_cbor_headers[] PROGMEM = AREST_HTTP_CBOR_HEADERS "Content-Length: ";
+#endif
+#if defined(AREST_STREAM)
+static const char aREST_stream_headers[] PROGMEM = "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n";
+#endif
+#if defined(AREST_METRICS)
+static const char aREST_http_text_headers[] PROGMEM = AREST_HTTP_TEXT_HEADERS "Content-Length: ";
+
+// Upper bounds of the latency histogram buckets but the last (µs), and names
+// of the fixed routes
+static const uint32_t aREST_metric_bounds[AREST_METRIC_BUCKETS - 1] PROGMEM = {100, 1000, 10000, 100000, 1000000};
+static const char aREST_metric_names[] PROGMEM = "root\0id\0digital\0analog\0mode\0batch\0metrics\0trace\0wait";
+#endif
+
+// Request headers of the events sent to a server
+static const char aREST_event_request[] PROGMEM = "POST /";
+static const char aREST_event_host[] PROGMEM = "/events HTTP/1.1\r\nHost: ";
+static const char aREST_event_headers[] PROGMEM = "\r\nConnection: keep-alive\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: ";
+
+// State of a request being parsed: aREST parses one at a time, connection
+// tables keep one per connection and swap it in while serving it
+struct aRESTRequest {
+  char answer[REQUEST_BUFFER_SIZE];
+  uint8_t answer_length;
+  char command;
+  uint8_t pin;
+  char state;
+  uint16_t value;
+  boolean pin_selected;
+  uint8_t arguments_offset;
+  uint8_t arguments_length;
+  uint8_t format;
+
+  // Batch query: key of the list being read, and items read so far
+  // ('v' with the route of a variable, 'd' or 'a' with a pin)
+  char batch_key;
+  uint8_t batch_count;
+  char batch_types[AREST_BATCH_SIZE];
+  uint8_t batch_items[AREST_BATCH_SIZE];
+
+  // HTTP request reader
+  uint8_t http_state;
+  uint8_t http_line_length;
+  uint8_t http_match_connection;
+  uint8_t http_match_length;
+  uint16_t http_body_length;
+  uint32_t http_version;
+  bool http_keep_alive;
+
+  // Last block read from the client, and how far it was read: the rest
+  // belongs to the next pipelined request
+  uint8_t http_block[AREST_HTTP_READ_BLOCK];
+  uint8_t http_block_length;
+  uint8_t http_block_offset;
+
+  #if defined(AREST_METRICS)
+  // Time the first byte of the request was parsed
+  bool request_started;
+  uint32_t request_start;
+  #endif
+
+  #if defined(AREST_DELTA)
+  // Delta answer: only the variables changed after this sequence number
+  bool delta;
+  uint32_t since;
+  #endif
+
+  #if defined(AREST_WAIT)
+  // Wait: what is waited on ('v' with the route of a variable, 'd' or 'a'
+  // with a pin), comparison & value compared to, how long to wait (ms) &
+  // since when, and whether the condition was met
+  char wait_type;
+  uint8_t wait_target;
+  uint8_t wait_op;
+  long wait_int;
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  float wait_float;
+  #endif
+  uint32_t wait_timeout;
+  uint32_t wait_start;
+  bool wait_met;
+  #endif
+
+  #if defined(AREST_STREAM)
+  // Stream: time between events (ms), whether events are only sent when
+  // their data changed, whether the connection streams (until it's closed)
+  // & has sent an event, and when the last event was built & the hash of its
+  // data
+  uint32_t stream_interval;
+  bool stream_changes;
+  bool streaming;
+  bool stream_sent;
+  uint32_t stream_last;
+  uint32_t stream_hash;
+  #endif
+};
+
+#if AREST_TRACE_LEVEL > 0
+// Event of the trace: time (µs), event & its arguments
+struct aRESTTraceRecord {
+  uint32_t time;
+  uint8_t event;
+  uint8_t a;
+  uint16_t b;
+};
+#endif
+
+// Connection of a connection table
+struct aRESTConnection {
+  aRESTRequest request;
+  uint32_t last_activity;
+  uint8_t served;
+  bool open;
+
+  // Served in time slices: step, bytes of the answer sent, since when the
+  // client takes none, and whether it reported the room in its write buffer
+  uint8_t step;
+  uint16_t sent;
+  bool stalled;
+  uint32_t stall_start;
+  bool room_reported;
+};
+
+#if defined(PubSubClient_h)
+
+// Variable published over MQTT when it changes: its route, how it is
+// published, and the value last published
+struct aRESTWatch {
+  uint8_t route;
+  bool published;
+  bool due;
+  float deadband;
+  uint32_t min_interval;
+  uint32_t max_interval;
+  uint32_t last_publish;
+  union {
+    long int_value;
+    float float_value;
+    uint32_t string_hash;
+  } last;
+};
+
+#endif
+
+class aREST : private aRESTRequest {
 
 public:
 
@@ -144,6 +614,7 @@ aREST() {
 
   command = 'u';
   pin_selected = false;
+  format = default_format;
 
   status_led_pin = 255;
   state = 'u';
@@ -154,6 +625,7 @@ aREST(char* rest_remote_server, int rest_port) {
 
   command = 'u';
   pin_selected = false;
+  format = default_format;
 
   status_led_pin = 255;
   state = 'u';
@@ -176,6 +648,7 @@ aREST(PubSubClient& client) {
 
   command = 'u';
   pin_selected = false;
+  format = default_format;
 
   status_led_pin = 255;
   state = 'u';
@@ -189,6 +662,7 @@ aREST(PubSubClient& client, char* new_mqtt_server) {
 
   command = 'u';
   pin_selected = false;
+  format = default_format;
 
   status_led_pin = 255;
   state = 'u';
@@ -210,11 +684,10 @@ void subscribe(String device, String eventName) {
   String topic = device + "_" + eventName + "_in";
 
   // Subscribe
-  char charBuf[50];
-  topic.toCharArray(charBuf, 50);
-
-  subscriptions_names[subscriptions_index] = charBuf;
-  subscriptions_index++;
+  if (subscriptions_index < NUMBER_SUBSCRIPTIONS) {
+    topic.toCharArray(subscriptions_names[subscriptions_index], SUBSCRIPTION_SIZE);
+    subscriptions_index++;
+  }
 
 }
 
@@ -222,20 +695,9 @@ void subscribe(String device, String eventName) {
 template <typename T>
 void publish(PubSubClient& client, String eventName, T data) {
 
-  // Get event data
-  if (DEBUG_MODE) {
-    Serial.print("Publishing event " + eventName + " with data: ");
-    Serial.println(data);
-  }
-
   // Build message
   String message = "{\"client_id\": \"" + String(id) + "\", \"event_name\": \"" + eventName + "\", \"data\": \"" + String(data) + "\"}";
 
-  if (DEBUG_MODE) {
-    Serial.print("Sending message via MQTT: ");
-    Serial.println(message);
-  }
-
   // Convert
   char charBuf[100];
   message.toCharArray(charBuf, 100);
@@ -268,65 +730,186 @@ void glow_led() {
     }
 }
 
-// Send HTTP headers for Ethernet & WiFi
+// Send HTTP headers for Ethernet & WiFi: room is kept for them before the
+// answer, and they are written once its length is known
 void send_http_headers(){
 
-  addToBuffer(F("HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nAccess-Control-Allow-Methods: POST, GET, PUT, OPTIONS\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n"));
+  http_header_room = AREST_HTTP_HEADERS_SIZE;
+  index = http_header_room;
+  buffer[index] = '\0';
+
+}
+
+// Write the headers in the room kept before the answer: with its length if it
+// is complete, else the answer is streamed, in chunks if the connection is
+// kept open or up to the end of the connection
+void writeHttpHeaders(bool complete) {
+
+  uint16_t start = http_header_room;
+  uint16_t length = index - start;
+  http_header_room = 0;
+
+  // Metrics in the Prometheus format are text, CBOR answers are binary
+  PGM_P headers = aREST_http_headers;
+  uint16_t headers_length = sizeof(aREST_http_headers) - 1;
+  #if defined(AREST_METRICS)
+  if (command == 'M' && state == 'P') {
+    headers = aREST_http_text_headers;
+    headers_length = sizeof(aREST_http_text_headers) - 1;
+  }
+  #endif
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {
+    headers = aREST_http_cbor_headers;
+    headers_length = sizeof(aREST_http_cbor_headers) - 1;
+  }
+  #endif
+
+  index = 0;
+  if (complete) {
+    appendToBuffer(headers, headers_length, true);
+    addToBuffer(length);
+    if (http_keep_alive) {appendToBuffer(aREST_http_keep_alive, sizeof(aREST_http_keep_alive) - 1, true);}
+    else {appendToBuffer(aREST_http_close, sizeof(aREST_http_close) - 1, true);}
+  }
+  else {
+    appendToBuffer(headers, headers_length - (sizeof("Content-Length: ") - 1), true);
+    if (http_keep_alive) {
+      appendToBuffer(aREST_http_chunked, sizeof(aREST_http_chunked) - 1, true);
+      http_chunked = true;
+    }
+    else {appendToBuffer(aREST_http_close + 2, sizeof(aREST_http_close) - 3, true);}
+  }
+
+  // First chunk
+  if (http_chunked) {
+    writeChunkSize(buffer + index, length);
+    index = index + 3;
+    addToBuffer(F("\r\n"));
+  }
+
+  // Move the answer right after the headers
+  memmove(buffer + index, buffer + start, length + 1);
+  index = index + length;
+}
+
+// Size of a chunk, on 3 hex digits
+static void writeChunkSize(char * out, uint16_t size) {
 
+  for (int8_t i = 2; i >= 0; i--) {
+    uint8_t digit = size & 0x0F;
+    out[i] = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    size = size >> 4;
+  }
+}
+
+// End the chunk held in the buffer, in the room kept before it, and start the next one
+void writeChunk(bool last) {
+
+  uint16_t length = index - AREST_HTTP_CHUNK_ROOM;
+  if (length == 0) {index = 0;}
+  else {
+    buffer[0] = '\r';
+    buffer[1] = '\n';
+    writeChunkSize(buffer + 2, length);
+    buffer[5] = '\r';
+    buffer[6] = '\n';
+  }
+  if (last) {addToBuffer(F("\r\n0\r\n\r\n"));}
+}
+
+// Set how long a connection may stay idle between requests (ms), and how
+// many requests it may serve. A timeout or max. of 0 closes it after each answer.
+void set_keep_alive(uint16_t timeout, uint8_t max_requests) {
+  keep_alive_timeout = timeout;
+  keep_alive_max = max_requests;
 }
 
 // Reset variables after a request
 void reset_status() {
 
-  #if defined(ESP8266)
-  Serial.print("Memory loss before reset:");
-  Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-  freeMemory = ESP.getFreeHeap();
-  #endif
+  recordRequest();
+  reset_request();
+
+  index = 0;
+  output_flush = NULL;
+  output_dropped = false;
+  http_header_room = 0;
+  http_chunked = false;
+  answer_begun = false;
+
+  AREST_TRACE(AREST_TRACE_DEBUG, AREST_TRACE_FREE_MEMORY, 0, freeHeap() > 0xFFFF ? 0xFFFF : freeHeap());
+}
+
+// Reset the request being parsed
+void reset_request() {
 
-  answer = "";
+  answer_length = 0;
+  answer[0] = '\0';
   command = 'u';
   pin_selected = false;
   state = 'u';
-  arguments = "";
-
-  index = 0;
-  //memset(&buffer[0], 0, sizeof(buffer));
-
-  #if defined(ESP8266)
-  Serial.print("Memory loss after reset:");
-  Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-  freeMemory = ESP.getFreeHeap();
-  Serial.print("Memory free:");
-  Serial.println(freeMemory, DEC);
+  arguments_offset = 0;
+  arguments_length = 0;
+  format = default_format;
+  #if defined(AREST_DELTA)
+  delta = false;
+  #endif
+  #if defined(AREST_WAIT)
+  wait_op = AREST_WAIT_CHANGE;
+  wait_int = 0;
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  wait_float = 0;
+  #endif
+  wait_timeout = AREST_WAIT_TIMEOUT;
+  wait_met = false;
   #endif
+  #if defined(AREST_STREAM)
+  stream_interval = AREST_STREAM_INTERVAL;
+  stream_changes = false;
+  stream_sent = false;
+  #endif
+  batch_key = 0;
+  batch_count = 0;
+
+  http_state = AREST_HTTP_REQUEST_LINE;
+  http_line_length = 0;
+  http_match_connection = 0;
+  http_match_length = 0;
+  http_body_length = 0;
+  http_version = 0;
+  http_keep_alive = false;
+
+  #if defined(AREST_METRICS)
+  request_started = false;
+  #endif
+}
+
+// Exchange the request being parsed with the one of a connection
+void swap_request(aRESTRequest& other) {
 
+  uint8_t * a = (uint8_t *)static_cast<aRESTRequest *>(this);
+  uint8_t * b = (uint8_t *)&other;
+  for (uint16_t i = 0; i < sizeof(aRESTRequest); i++) {
+    uint8_t c = a[i];
+    a[i] = b[i];
+    b[i] = c;
+  }
 }
 
 // Handle request with the Adafruit CC3000 WiFi library
 #ifdef ADAFRUIT_CC3000_H
 bool handle(Adafruit_CC3000_ClientRef& client) {
-	bool result = false;
-	if (client.available()) {
-
-		// Handle request
-		result = handle_proto(client,true,0);
-
-		// Answer
-		sendBuffer(client,32,20);
-		client.stop();
 
-		// Reset variables for the next command
-		reset_status();
-	}
-	return result;
+	// Serve the requests the client has sent so far
+	return handle_http(client,32,20);
 }
 
 template <typename T>
-void publish(Adafruit_CC3000_ClientRef& client, String eventName, T value) {
+bool publish(Adafruit_CC3000_ClientRef& client, const String& eventName, T value) {
 
-  // Publish request
-  publish_proto(client, eventName, value);
+  // Queue the event
+  return publish_proto(client, eventName, value);
 
 }
 
@@ -336,6 +919,9 @@ bool handle(YunClient& client) {
 	bool result = false;
 	if (client.available()) {
 
+		// Answer is streamed to the client if it outgrows the buffer
+		setOutput(client,25,10);
+
 		// Handle request
 		result = handle_proto(client,false,0);
 
@@ -350,10 +936,10 @@ bool handle(YunClient& client) {
 }
 
 template <typename T>
-void publish(YunClient& client, String eventName, T value) {
+bool publish(YunClient& client, const String& eventName, T value) {
 
-  // Publish request
-  publish_proto(client, eventName, value);
+  // Queue the event
+  return publish_proto(client, eventName, value);
 
 }
 
@@ -363,6 +949,14 @@ bool handle(Adafruit_BLE_UART& serial) {
 	bool result = false;
 	if (serial.available()) {
 
+		#if defined(AREST_BINARY)
+		// Binary request
+		if (serial.peek() == 0) {return handle_binary(serial,AREST_SERIAL_TIMEOUT);}
+		#endif
+
+		// Answer is streamed to the client if it outgrows the buffer
+		setOutput(serial,100,1);
+
 		// Handle request
 		result = handle_proto(serial,false,0);
 
@@ -376,135 +970,66 @@ bool handle(Adafruit_BLE_UART& serial) {
 }
 
 template <typename T>
-void publish(Adafruit_BLE_UART& serial, String eventName, T value) {
+bool publish(Adafruit_BLE_UART& serial, const String& eventName, T value) {
 
-  // Publish request
-  publish_proto(client, eventName, value);
+  // Queue the event
+  return publish_proto(serial, eventName, value);
 
 }
 
 // Handle request for the Arduino Ethernet shield
 #elif defined(ethernet_h)
 bool handle(EthernetClient& client){
-	bool result = false;
-	if (client.available()) {
-
-		// Handle request
-		result = handle_proto(client,true,0);
-
-		// Answer
-		sendBuffer(client,50,0);
-		client.stop();
 
-		// Reset variables for the next command
-		reset_status();
-	}
-	return result;
+	// Serve the requests the client has sent so far
+	return handle_http(client,50,0);
 }
 
 template <typename T>
-void publish(EthernetClient& client, String eventName, T value) {
+bool publish(EthernetClient& client, const String& eventName, T value) {
 
-  // Publish request
-  publish_proto(client, eventName, value);
+  // Queue the event
+  return publish_proto(client, eventName, value);
 
 }
 
 // Handle request for the ESP8266 chip
 #elif defined(ESP8266)
 bool handle(WiFiClient& client){
-  bool result = false;
-
-  if (DEBUG_MODE) {
-    Serial.print("Memory loss before available:");
-    Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-    freeMemory = ESP.getFreeHeap();
-  }
-
-  if (client.available()) {
-
-    if (DEBUG_MODE) {
-      Serial.print("Memory loss before handling:");
-      Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-      freeMemory = ESP.getFreeHeap();
-    }
-
-    // Handle request
-    result = handle_proto(client,true,0);
-
-    if (DEBUG_MODE) {
-      Serial.print("Memory loss after handling:");
-      Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-      freeMemory = ESP.getFreeHeap();
-    }
-
-    // Answer
-    sendBuffer(client,0,0);
-    client.stop();
 
-    // Reset variables for the next command
-    reset_status();
-  }
-  return result;
+  // Serve the requests the client has sent so far
+  return handle_http(client,0,0);
 }
 
 template <typename T>
-void publish(WiFiClient& client, String eventName, T value) {
+bool publish(WiFiClient& client, const String& eventName, T value) {
 
-  // Publish request
-  publish_proto(client, eventName, value);
+  // Queue the event
+  return publish_proto(client, eventName, value);
 
 }
 
 // Handle request for the Arduino MKR1000 board
 #elif defined(WIFI_H)
 bool handle(WiFiClient& client){
-  bool result = false;
-
-  if (client.available()) {
-
-
-		if (DEBUG_MODE) {Serial.println(F("Request received"));}
-
-		// Handle request
-		result = handle_proto(client,true,0);
 
-		// Answer
-		sendBuffer(client,0,0);
-		client.stop();
-
-		// Reset variables for the next command
-		reset_status();
-	}
-	return result;
+	// Serve the requests the client has sent so far
+	return handle_http(client,0,0);
 }
 
 // Handle request for the Arduino WiFi shield
 #elif defined(WiFi_h)
 bool handle(WiFiClient& client){
-	bool result = false;
-	if (client.available()) {
-
-		if (DEBUG_MODE) {Serial.println(F("Request received"));}
-
-		// Handle request
-		result = handle_proto(client,true,0);
 
-		// Answer
-		sendBuffer(client,50,1);
-		client.stop();
-
-		// Reset variables for the next command
-		reset_status();
-	}
-	return result;
+	// Serve the requests the client has sent so far
+	return handle_http(client,50,1);
 }
 
 template <typename T>
-void publish(WiFiClient& client, String eventName, T value) {
+bool publish(WiFiClient& client, const String& eventName, T value) {
 
-  // Publish request
-  publish_proto(client, eventName, value);
+  // Queue the event
+  return publish_proto(client, eventName, value);
 
 }
 
@@ -514,8 +1039,16 @@ bool handle(usb_serial_class& serial){
 	bool result = false;
 	if (serial.available()) {
 
+		#if defined(AREST_BINARY)
+		// Binary request
+		if (serial.peek() == 0) {return handle_binary(serial,AREST_SERIAL_TIMEOUT);}
+		#endif
+
+		// Answer is streamed to the client if it outgrows the buffer
+		setOutput(serial,25,1);
+
 		// Handle request
-		result = handle_proto(serial,false,1);
+		result = handle_proto(serial,false,AREST_SERIAL_TIMEOUT);
 
 		// Answer
 		sendBuffer(serial,25,1);
@@ -527,10 +1060,10 @@ bool handle(usb_serial_class& serial){
 }
 
 template <typename T>
-void publish(usb_serial_class& client, String eventName, T value) {
+bool publish(usb_serial_class& client, const String& eventName, T value) {
 
-  // Publish request
-  publish_proto(client, eventName, value);
+  // Queue the event
+  return publish_proto(client, eventName, value);
 
 }
 
@@ -540,6 +1073,14 @@ bool handle(Serial_& serial){
 	bool result = false;
 	if (serial.available()) {
 
+		#if defined(AREST_BINARY)
+		// Binary request
+		if (serial.peek() == 0) {return handle_binary(serial,AREST_SERIAL_TIMEOUT);}
+		#endif
+
+		// Answer is streamed to the client if it outgrows the buffer
+		setOutput(serial,25,0);
+
 		// Handle request
 		result = handle_proto(serial,false,0);
 
@@ -553,10 +1094,10 @@ bool handle(Serial_& serial){
 }
 
 template <typename T>
-void publish(Serial_& client, String eventName, T value) {
+bool publish(Serial_& client, const String& eventName, T value) {
 
-  // Publish request
-  publish_proto(client, eventName, value);
+  // Queue the event
+  return publish_proto(client, eventName, value);
 
 }
 
@@ -566,8 +1107,16 @@ bool handle(HardwareSerial& serial){
 	bool result = false;
 	if (serial.available()) {
 
+		#if defined(AREST_BINARY)
+		// Binary request
+		if (serial.peek() == 0) {return handle_binary(serial,AREST_SERIAL_TIMEOUT);}
+		#endif
+
+		// Answer is streamed to the client if it outgrows the buffer
+		setOutput(serial,100,0);
+
 		// Handle request
-		result = handle_proto(serial,false,1);
+		result = handle_proto(serial,false,AREST_SERIAL_TIMEOUT);
 
 		// Answer
 		sendBuffer(serial,100,0);
@@ -579,10 +1128,10 @@ bool handle(HardwareSerial& serial){
 }
 
 template <typename T>
-void publish(HardwareSerial& client, String eventName, T value) {
+bool publish(HardwareSerial& client, const String& eventName, T value) {
 
-  // Publish request
-  publish_proto(client, eventName, value);
+  // Queue the event
+  return publish_proto(client, eventName, value);
 
 }
 #endif
@@ -600,786 +1149,2982 @@ bool handle(char * string) {
 }
 
 bool handle_proto(char * string) {
-  // Check if there is data available to read
-  for (int i = 0; i < strlen(string); i++){
-
-    char c = string[i];
-    answer = answer + c;
+  // Process the string until its end
+  for (char * p = string; *p != '\0'; p++){
 
-	
     // Process data
-    process(c);
+    process(*p);
 
   }
+  countBytesIn(strlen(string));
 
   // Send command
   return send_command(false);
 }
 
+// Queue an event for the server, and send the queue when it is due. Returns
+// false when there is no room left for the event, which isn't queued: the
+// queue couldn't be sent, or the server failed less than a flush interval ago.
+// Without a queue, returns whether the event was sent, and drops it if not.
 template <typename T, typename V>
-void publish_proto(T& client, String eventName, V value) {
+bool publish_proto(T& client, const String& eventName, V value) {
+
+  #if AREST_EVENT_QUEUE_SIZE == 0
+  if (index > 0 || !queueEvent(eventName, value)) {return false;}
+  bool sent = flush_events(client, true);
+  event_length = 0;
+  resetBuffer();
+  return sent;
+  #else
+  if (!queueEvent(eventName, value)) {
 
-  // Format data
-  String data = "name=" + eventName + "&data=" + String(value);
+    // Make room, at once unless the server just failed
+    if (!flush_events(client, !event_failed) || !queueEvent(eventName, value)) {
+      return false;
+    }
+  }
+  flush_events(client);
+  return true;
+  #endif
+}
 
-  Serial.println("POST /" + String(id) + "/events HTTP/1.1");
-  Serial.println("Host: " + String(remote_server) + ":" + String(port));
-  Serial.println(F("Content-Type: application/x-www-form-urlencoded"));
-  Serial.print(F("Content-Length: "));
-  Serial.println(data.length());
-  Serial.println();
-  Serial.print(data);
+// Send the queued events in one request, on the connection kept open to the
+// server, once they are due (or at once if forced). Call it regularly so that
+// events don't wait longer than the flush interval. After a failure, the
+// events are only tried again a flush interval later. Returns true once the
+// queue is empty. Events count as sent once written to the connection: the
+// status the server answers with isn't checked, and its answer is only read
+// and dropped before the next request.
+template <typename T>
+bool flush_events(T& client, bool force = false) {
+
+  if (event_length == 0) {return true;}
+  bool due = millis() - event_time >= AREST_EVENT_FLUSH_INTERVAL ||
+    (!event_failed && event_length >= AREST_EVENT_FLUSH_SIZE);
+  if (!force && !due) {return false;}
+
+  // Answers to the requests sent before
+  uint8_t block[32];
+  while (client.available() && readBlock(client, block, sizeof(block), 0) > 0) {}
+
+  if (connectClient(client, 0)) {
+
+    // Headers, then the events
+    char header[AREST_EVENT_HEADER_SIZE];
+    uint8_t length = 0;
+    char number[10];
+    uint8_t digits;
+    bool sent = writeEventHeader(client, header, length, aREST_event_request, strlen_P(aREST_event_request), true);
+    sent = sent && writeEventHeader(client, header, length, id, strlen(id), false);
+    sent = sent && writeEventHeader(client, header, length, aREST_event_host, strlen_P(aREST_event_host), true);
+    if (remote_server != NULL) {
+      sent = sent && writeEventHeader(client, header, length, remote_server, strlen(remote_server), false);
+      sent = sent && writeEventHeader(client, header, length, ":", 1, false);
+      digits = countDigits(port);
+      writeDigits(number + digits, port);
+      sent = sent && writeEventHeader(client, header, length, number, digits, false);
+    }
+    sent = sent && writeEventHeader(client, header, length, aREST_event_headers, strlen_P(aREST_event_headers), true);
+    digits = countDigits(event_length);
+    writeDigits(number + digits, event_length);
+    sent = sent && writeEventHeader(client, header, length, number, digits, false);
+    sent = sent && writeEventHeader(client, header, length, "\r\n\r\n", 4, false);
+    sent = sent && client.write((const uint8_t *)header, length) == length;
+    sent = sent && client.write((const uint8_t *)eventQueue(), event_length) == event_length;
+
+    if (sent) {
+      AREST_TRACE(AREST_TRACE_INFO, AREST_TRACE_EVENTS_SENT, 0, event_length);
+      event_length = 0;
+      event_failed = false;
+      return true;
+    }
 
-  // Send request
-  client.println(F("POST /1/events HTTP/1.1"));
-  client.println("Host: " + String(remote_server) + ":" + String(port));
-  client.println(F("Content-Type: application/x-www-form-urlencoded"));
-  client.print(F("Content-Length: "));
-  client.println(data.length());
-  client.println();
-  client.print(data);
+    // Don't leave half a request on the connection
+    stopClient(client, 0);
+  }
 
+  AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_EVENTS_FAILED, 0, event_length);
+  event_failed = true;
+  event_time = millis();
+  return false;
 }
 
+// Add to the headers of an event request, written out as they fill up
 template <typename T>
-bool handle_proto(T& serial, bool headers, uint8_t read_delay)
-{
-	Serial.print("?");
-  // Check if there is data available to read
-  while (serial.available()) {
+static bool writeEventHeader(T& client, char * header, uint8_t& length, const char * toAdd, uint16_t count, bool progmem) {
 
-    // Get the server answer
-    char c = serial.read();
-    if (read_delay) delay(read_delay);
-    answer = answer + c;
-    if (DEBUG_MODE) {Serial.print(c);}
-	
-    // Process data
-    process(c);
+  while (count > 0) {
+    if (length == AREST_EVENT_HEADER_SIZE) {
+      if (client.write((const uint8_t *)header, length) != length) {return false;}
+      length = 0;
+    }
+    uint8_t part = count < AREST_EVENT_HEADER_SIZE - length ? count : AREST_EVENT_HEADER_SIZE - length;
+    if (progmem) {memcpy_P(header + length, toAdd, part);}
+    else {memcpy(header + length, toAdd, part);}
+    length += part;
+    toAdd += part;
+    count -= part;
+  }
+  return true;
+}
 
-   }
+// Connect clients that can to the server, unless they still are
+template <typename C>
+auto connectClient(C& client, int) -> decltype(client.connect((const char *)NULL, (uint16_t)0), bool()) {
+  if (client.connected()) {return true;}
+  return remote_server != NULL && client.connect(remote_server, port);
+}
 
-   // Send command
-   return send_command(headers);
+template <typename C>
+bool connectClient(C& client, long) {
+  return true;
 }
 
-#if defined(PubSubClient_h)
+template <typename C>
+static auto stopClient(C& client, int) -> decltype(client.stop(), void()) {
+  client.stop();
+}
 
-// Process callback
-void handle_callback(PubSubClient& client, char* topic, byte* payload, unsigned int length) {
+template <typename C>
+static void stopClient(C& client, long) {}
 
-  // Process received message
-  int i;
-  char mqtt_msg[100];
-  for(i = 0; i < length; i++) {
-    mqtt_msg[i] = payload[i];
-  }
-  mqtt_msg[i] = '\0';
-  String msgString = String(mqtt_msg);
+// Add an event to the queue, as form fields: all of it, or nothing
+template <typename V>
+bool queueEvent(const String& eventName, V value) {
 
-  if (DEBUG_MODE) {
-    Serial.print(F("Received message via MQTT: "));
-    Serial.println(msgString);
-  }
+  uint16_t start = event_length;
+  bool queued = (start == 0 || queueEventText("&", 1, false)) &&
+    queueEventText("name=", 5, false) &&
+    queueEventText(eventName.c_str(), eventName.length(), true) &&
+    queueEventText("&data=", 6, false) &&
+    queueEventValue(value);
 
-  // Process aREST commands
-    String modified_message = String(msgString) + " /";
-    char char_message[100];
-    modified_message.toCharArray(char_message, 100);
+  if (!queued) {
+    event_length = start;
+    return false;
+  }
+  if (start == 0) {event_time = millis();}
+  return true;
+}
 
-    // Handle command with aREST
-    handle(char_message);
+// Add text to the event queue, URL-encoded or not
+bool queueEventText(const char * text, uint16_t length, bool encode) {
 
-    // Read answer
-    char * answer = getBuffer();
-
-    // Send response
-    if (DEBUG_MODE) {
-      Serial.print("Sending message via MQTT: ");
-      Serial.println(answer);
+  for (uint16_t i = 0; i < length; i++) {
+    char c = text[i];
+    bool plain = !encode || isalnum((uint8_t)c) || c == '-' || c == '_' || c == '.' || c == '~';
+    if (event_length + (plain ? 1 : 3) > AREST_EVENT_ROOM) {return false;}
+    char * queue = eventQueue();
+    if (plain) {queue[event_length++] = c;}
+    else if (c == ' ') {queue[event_length++] = '+';}
+    else {
+      queue[event_length++] = '%';
+      queue[event_length++] = "0123456789ABCDEF"[(uint8_t)c >> 4];
+      queue[event_length++] = "0123456789ABCDEF"[c & 0x0F];
     }
-    client.publish(out_topic, answer);
-    resetBuffer();
-
+  }
+  return true;
 }
 
-// Handle request on the Serial port
-void loop(PubSubClient& client){
+// Events are queued in their own buffer, or in the output buffer while it's
+// free when there's no queue
+char * eventQueue() {
+  #if AREST_EVENT_QUEUE_SIZE > 0
+  return event_queue;
+  #else
+  return buffer;
+  #endif
+}
 
-  // Connect to cloud
-  if (!client.connected()) {
-    reconnect(client);
-  }
-  client.loop();
+// Add the data of an event to the queue
+bool queueEventValue(const char * value) {
+  return queueEventText(value, strlen(value), true);
+}
 
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+bool queueEventValue(const String& value) {
+  return queueEventText(value.c_str(), value.length(), true);
 }
+#endif
 
-void handle(PubSubClient& client){
+bool queueEventValue(unsigned long value) {
+  char number[10];
+  uint8_t digits = countDigits(value);
+  writeDigits(number + digits, value);
+  return queueEventText(number, digits, false);
+}
 
-  // Connect to cloud
-  if (!client.connected()) {
-    reconnect(client);
+bool queueEventValue(long value) {
+  if (value < 0) {
+    return queueEventText("-", 1, false) && queueEventValue(0UL - (unsigned long)value);
   }
-  client.loop();
+  return queueEventValue((unsigned long)value);
+}
 
+bool queueEventValue(unsigned int value) {
+  return queueEventValue((unsigned long)value);
 }
 
-void reconnect(PubSubClient& client) {
-  // Loop until we're reconnected
-  while (!client.connected()) {
-    Serial.print(F("Attempting MQTT connection..."));
+bool queueEventValue(int value) {
+  return queueEventValue((long)value);
+}
 
-    // Attempt to connect
-    if (client.connect(id)) {
-      Serial.println(F("Connected to aREST.io"));
-      client.subscribe(in_topic);
+bool queueEventValue(double value) {
+  char number[AREST_FLOAT_SIZE];
+  uint8_t length = formatFloat(number, value, float_precision);
+  return queueEventText(number, length, false);
+}
 
-      // Subscribe to all
-      if (subscriptions_index > 0) {
+bool queueEventValue(float value) {
+  return queueEventValue((double)value);
+}
 
-        for (int i = 0; i < subscriptions_index; i++) {
-          if (DEBUG_MODE) {
-            Serial.print(F("Subscribing to additional topic: "));
-            Serial.println(subscriptions_names[i]);
-          }
+// Read a command up to the end of its line, leaving any command after it for
+// the next call. A line that isn't over is waited for, at most read_timeout
+// ms for each byte.
+template <typename T>
+bool handle_proto(T& serial, bool headers, uint8_t read_timeout)
+{
+  for (;;) {
 
-          client.subscribe(subscriptions_names[i]);
-        }
+    // Wait for the rest of the line
+    if (!waitForByte(serial, read_timeout)) {break;}
 
-      }
+    // Get the server answer
+    char c = serial.read();
+    countBytesIn(1);
 
-    } else {
-      Serial.print(F("failed, rc="));
-      Serial.print(client.state());
-      Serial.println(F(" try again in 5 seconds"));
-      // Wait 5 seconds before retrying
-      delay(5000);
+    // Process data
+    process(c);
+
+    // End of the line, with its line feed
+    if (c == '\r' || c == '\n') {
+      if (c == '\r' && serial.peek() == '\n') {
+        serial.read();
+        countBytesIn(1);
+      }
+      break;
     }
+   }
+
+   // Send command
+   return send_command(headers);
+}
+
+// Wait for the next byte of a serial command, at most read_timeout ms
+template <typename T>
+static bool waitForByte(T& serial, uint8_t read_timeout) {
+
+  if (serial.available()) {return true;}
+  if (read_timeout == 0) {return false;}
+  uint32_t wait_start = millis();
+  while (!serial.available()) {
+    if (millis() - wait_start >= read_timeout) {return false;}
+    yield();
   }
+  return true;
 }
-#endif
 
-void process(char c){
+#if defined(AREST_BINARY)
+// Read a binary request frame, and answer it in a frame. Bytes are waited for
+// at most read_timeout ms each. A frame that is cut, too long for the request
+// buffer or fails its CRC is answered with AREST_STATUS_BAD_FRAME.
+template <typename T>
+bool handle_binary(T& serial, uint8_t read_timeout) {
 
-  // Check if we are receveing useful data and process it
-  if ((c == '/' || c == '\r') && state == 'u') {
+  #if defined(AREST_METRICS)
+  request_started = true;
+  request_start = micros();
+  #endif
 
-      if (DEBUG_MODE) {
-        #if defined(ESP8266)
-        Serial.print("Memory loss:");
-        Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-        freeMemory = ESP.getFreeHeap();
-        #endif
-        Serial.println(answer);
-      }
+  // Zero bytes before the frame
+  while (serial.peek() == 0) {
+    serial.read();
+    countBytesIn(1);
+  }
 
-      // If the command is mode, and the pin is already selected
-      if (command == 'm' && pin_selected && state == 'u') {
+  // Frame, up to the zero byte ending it
+  uint8_t * frame = (uint8_t *)answer;
+  uint16_t length = 0;
+  bool complete = false;
+  while (waitForByte(serial, read_timeout)) {
+    uint8_t c = serial.read();
+    countBytesIn(1);
+    if (c == 0) {
+      complete = true;
+      break;
+    }
+    if (length < REQUEST_BUFFER_SIZE) {frame[length] = c;}
+    length++;
+  }
 
-        // Get state
-        state = answer[0];
+  uint8_t decoded = 0;
+  if (complete && length <= REQUEST_BUFFER_SIZE) {decoded = cobsDecode(frame, (uint8_t)length);}
 
-     }
+  // Answer: opcode, status & values
+  bool result = false;
+  buffer[0] = 0;
+  index = 2;
+  uint8_t status = AREST_STATUS_BAD_FRAME;
+  if (decoded >= 3 && crc16(frame, decoded - 2) == (frame[decoded - 2] | (uint16_t)frame[decoded - 1] << 8)) {
+    buffer[0] = frame[0];
+    status = binary_command(frame[0], frame + 1, decoded - 3);
+    result = status == AREST_STATUS_OK;
+  }
+  else {AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_BAD_FRAME, 0, length);}
+  if (status != AREST_STATUS_OK) {index = 2;}
+  buffer[1] = status;
+  writeFrame(serial);
 
-     // If a digital command has been received, process the data accordingly
-     if (command == 'd' && pin_selected && state == 'u') {
+  // Reset variables for the next request
+  reset_status();
+  return result;
+}
 
-       // If it's a read command, read from the pin and send data back
-       if (answer[0] == 'r') {state = 'r';}
+// Run a binary request on its arguments, leaving the values of the answer in
+// the buffer. Returns the status of the answer.
+uint8_t binary_command(uint8_t op, uint8_t * arguments, uint8_t count) {
+
+  // Request as the URL parser leaves it, for the trace & metrics
+  switch (op) {
+    case AREST_OP_DIGITAL_READ: command = 'd'; state = 'r'; break;
+    case AREST_OP_DIGITAL_WRITE: command = 'd'; state = 'w'; break;
+    case AREST_OP_ANALOG_READ: command = 'a'; state = 'r'; break;
+    case AREST_OP_ANALOG_WRITE: command = 'a'; state = 'w'; break;
+    case AREST_OP_MODE: command = 'm'; state = count > 1 && arguments[1] ? 'o' : 'i'; break;
+    case AREST_OP_ROUTES: command = 'r'; break;
+  }
+  if (count > 0) {pin = arguments[0];}
+
+  // Variable or function
+  if (op == AREST_OP_GET || op == AREST_OP_CALL) {
+    if (count == 0 || (arguments[0] & 0x3F) == 0) {return AREST_STATUS_BAD_REQUEST;}
+    uint8_t kind = route_kind(arguments[0]);
+    value = route_position(arguments[0]);
+    if (op == AREST_OP_CALL && kind == AREST_ROUTE_FUNCTION && value < functions_index) {command = 'f';}
+    else if (op == AREST_OP_GET && kind == AREST_ROUTE_INT && value < variables_index) {command = 'v';}
+    #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+    else if (op == AREST_OP_GET && kind == AREST_ROUTE_FLOAT && value < float_variables_index) {command = 'l';}
+    else if (op == AREST_OP_GET && kind == AREST_ROUTE_STRING && value < string_variables_index) {command = 's';}
+    #endif
+    else {return AREST_STATUS_BAD_REQUEST;}
+  }
 
-       // If not, get value we want to apply to the pin
-       else {value = answer.toInt(); state = 'w';}
-     }
+  AREST_TRACE(AREST_TRACE_INFO, AREST_TRACE_REQUEST, command, command == 'd' || command == 'a' || command == 'm' ? pin : value);
 
-     // If analog command has been selected, process the data accordingly
-     if (command == 'a' && pin_selected && state == 'u') {
+  switch (op) {
 
-       // If it's a read, read from the correct pin
-       if (answer[0] == 'r') {state = 'r';}
+    case AREST_OP_DIGITAL_READ:
+      if (count != 1) {return AREST_STATUS_BAD_REQUEST;}
+      if (!(enable_byte & AREST_ENB_DIGITAL_READ)) {return AREST_STATUS_DISABLED;}
+      addBinaryValue((long)digitalRead(pin));
+      return AREST_STATUS_OK;
 
-       // Else, write analog value
-       else {value = answer.toInt(); state = 'w';}
-     }
+    case AREST_OP_DIGITAL_WRITE:
+      if (count != 2) {return AREST_STATUS_BAD_REQUEST;}
+      if (!(enable_byte & AREST_ENB_DIGITAL_WRITE)) {return AREST_STATUS_DISABLED;}
+      #if defined(ESP8266)
+      analogWrite(pin, 0);
+      #endif
+      digitalWrite(pin, arguments[1]);
+      return AREST_STATUS_OK;
+
+    case AREST_OP_ANALOG_READ:
+      if (count != 1) {return AREST_STATUS_BAD_REQUEST;}
+      if (!(enable_byte & AREST_ENB_ANALOG_READ)) {return AREST_STATUS_DISABLED;}
+      addBinaryValue((long)analogRead(pin));
+      return AREST_STATUS_OK;
+
+    case AREST_OP_ANALOG_WRITE:
+      if (count != 3) {return AREST_STATUS_BAD_REQUEST;}
+      if (!(enable_byte & AREST_ENB_ANALOG_WRITE)) {return AREST_STATUS_DISABLED;}
+      analogWrite(pin, arguments[1] | (uint16_t)arguments[2] << 8);
+      return AREST_STATUS_OK;
+
+    case AREST_OP_MODE:
+      if (count != 2) {return AREST_STATUS_BAD_REQUEST;}
+      if (!(enable_byte & (AREST_ENB_DIGITAL | AREST_ENB_ANALOG))) {return AREST_STATUS_DISABLED;}
+      pinMode(pin, arguments[1] ? OUTPUT : INPUT);
+      return AREST_STATUS_OK;
+
+    case AREST_OP_GET:
+      if (count != 1) {return AREST_STATUS_BAD_REQUEST;}
+      if (!(enable_byte & AREST_ENB_VARIABLE)) {return AREST_STATUS_DISABLED;}
+      if (command == 'v') {addBinaryValue((long)*int_variables[value]);}
+      #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+      if (command == 'l') {addBinaryValue(*float_variables[value]);}
+      if (command == 's') {addBinaryValue(string_variables[value]->c_str(), string_variables[value]->length());}
+      #endif
+      return AREST_STATUS_OK;
 
-     // If the command is already selected, get the pin
-     if (command != 'u' && pin_selected == false) {
+    case AREST_OP_CALL: {
+      if (!(enable_byte & AREST_ENB_FUNCTION)) {return AREST_STATUS_DISABLED;}
 
-       // Get pin
-       if (answer[0] == 'A') {
-         pin = 14 + answer[1] - '0';
-       }
-       else {
-         pin = answer.toInt();
-       }
-       if (DEBUG_MODE) {
-        Serial.print(F("Selected pin: "));
-        Serial.println(pin);
-       }
-       pin_selected = true;
+      // Arguments end where the CRC was
+      arguments[count] = '\0';
+      addBinaryValue((long)functions[value](String((char *)arguments + 1)));
+      return AREST_STATUS_OK;
+    }
 
-       // Nothing more ?
-       if ((answer[1] != '/' && answer[2] != '/')
-        || (answer[1] == ' ' && answer[2] == '/')
-        || (answer[2] == ' ' && answer[3] == '/')) {
+    case AREST_OP_ROUTES:
+      addBinaryRoutes(AREST_ROUTE_FUNCTION, functions_index, functions_names);
+      addBinaryRoutes(AREST_ROUTE_INT, variables_index, int_variables_names);
+      #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+      addBinaryRoutes(AREST_ROUTE_FLOAT, float_variables_index, float_variables_names);
+      addBinaryRoutes(AREST_ROUTE_STRING, string_variables_index, string_variables_names);
+      #endif
+      return AREST_STATUS_OK;
+  }
+  return AREST_STATUS_BAD_REQUEST;
+}
 
-        // Nothing more & digital ?
-        if (command == 'd') {
+// Add bytes to the binary answer, keeping room for its CRC. Returns false,
+// adding nothing, if they don't fit.
+bool addBinary(const void * data, uint16_t length) {
 
-          // Read all digital ?
-          if (answer[0] == 'a') {state = 'a';}
+  if (index + length > OUTPUT_BUFFER_SIZE - 2) {return false;}
+  memcpy(buffer + index, data, length);
+  index += length;
+  return true;
+}
 
-          // Save state & end there
-          else {state = 'r';}
-        }
+// Add a typed value to the binary answer, low byte first
+void addBinaryValue(uint32_t bits, char type) {
 
-       // Nothing more & analog ?
-       if (command == 'a') {
+  uint8_t bytes[5] = {(uint8_t)type, (uint8_t)bits, (uint8_t)(bits >> 8), (uint8_t)(bits >> 16), (uint8_t)(bits >> 24)};
+  addBinary(bytes, 5);
+}
 
-         // Read all analog ?
-         if (answer[0] == 'a') {state = 'a';}
+void addBinaryValue(long value) {
 
-         // Save state & end there
-         else {state = 'r';}
-       }
-     }
+  addBinaryValue((uint32_t)value, AREST_VALUE_INT);
+}
 
-   }
+void addBinaryValue(float value) {
 
-     // Digital command received ?
-     if (answer.startsWith(F("digital"))) {command = 'd';}
+  uint32_t bits;
+  memcpy(&bits, &value, 4);
+  addBinaryValue(bits, AREST_VALUE_FLOAT);
+}
 
-     // Mode command received ?
-     if (answer.startsWith(F("mode"))) {command = 'm';}
+void addBinaryValue(const char * text, uint16_t length) {
 
-     // Analog command received ?
-     if (answer.startsWith(F("analog"))) {command = 'a';}
+  if (length > 0xFF) {length = 0xFF;}
+  uint8_t header[2] = {AREST_VALUE_STRING, (uint8_t)length};
+  if (index + 2 + length <= OUTPUT_BUFFER_SIZE - 2) {
+    addBinary(header, 2);
+    addBinary(text, length);
+  }
+}
 
-     // Variable or function request received ?
-     if (command == 'u') {
-	   bool foundFlag = false;
-		Serial.print("!");
-       // Check if function name is in the function array
-       if (!foundFlag) for (uint8_t i = 0; i < functions_index; i++){
-		   if (DEBUG_MODE) {
-			   Serial.println(F("Comparing function"));
-			   Serial.println(functions_names[i]);
-		   }
-         if(fastStringCompare(answer, functions_names[i])) {
-		   foundFlag = true;
-		   if (DEBUG_MODE) {Serial.println(F("Found function"));}
-           // End here
-           pin_selected = true;
-           state = 'x';
+// Add the routes of a kind to the binary answer, as many as fit
+void addBinaryRoutes(uint8_t kind, uint8_t count, char ** names) {
 
-           // Set state
-           command = 'f';
-           value = i;
+  for (uint8_t i = 0; i < count; i++) {
+    uint8_t length = strlen(names[i]);
+    uint8_t header[2] = {(uint8_t)((kind << 6) | (i + 1)), length};
+    if (index + 2 + length > OUTPUT_BUFFER_SIZE - 2) {
+      AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_ANSWER_TOO_LONG, 0, index);
+      return;
+    }
+    addBinary(header, 2);
+    addBinary(names[i], length);
+  }
+}
 
-           // Get command
-           arguments = "";
-           uint8_t header_length = strlen(functions_names[i]);
-           if (answer.substring(header_length, header_length + 1) == "?") {
-             uint8_t footer_start = answer.length();
-             if (answer.endsWith(F(" HTTP/")))
-               footer_start -= 6; // length of " HTTP/"
-             arguments = answer.substring(header_length + 8, footer_start);
-           }
-		   break;
-         }
-       }
+// Write the binary answer held in the buffer as a frame: its CRC is added,
+// and it is COBS-encoded between zero bytes, a block at a time
+template <typename T>
+void writeFrame(T& serial) {
+
+  uint16_t crc = crc16((const uint8_t *)buffer, index);
+  buffer[index++] = crc & 0xFF;
+  buffer[index++] = crc >> 8;
+
+  uint16_t sent = 2;
+  serial.write((uint8_t)0);
+  uint16_t start = 0;
+  for (;;) {
+
+    // Block of up to 254 bytes, ending before a zero byte, encoded as its
+    // length + 1 in place of that zero
+    uint16_t end = start;
+    while (end < index && buffer[end] != 0 && end - start < 254) {end++;}
+    serial.write((uint8_t)(end - start + 1));
+    serial.write((const uint8_t *)buffer + start, end - start);
+    sent += end - start + 1;
+    if (end == index) {break;}
+    start = end - start == 254 ? end : end + 1;
+  }
+  serial.write((uint8_t)0);
 
-       // Check if variable name is in int array
-       if (!foundFlag) for (uint8_t i = 0; i < variables_index; i++){
-         if(fastStringCompare(answer, int_variables_names[i])) {
-		   foundFlag = true;
-			if (DEBUG_MODE) {Serial.println(F("Found integer variable"));}
-           // End here
-           pin_selected = true;
-           state = 'x';
+  countBytesOut(sent);
+  AREST_TRACE(AREST_TRACE_INFO, AREST_TRACE_SENT, 0, sent);
+}
 
-           // Set state
-           command = 'v';
-           value = i;
-		   break;
-         }
-       }
+// Decode a COBS frame in place. Returns its decoded length, or 0 if it is cut.
+static uint8_t cobsDecode(uint8_t * frame, uint8_t length) {
 
-       // Check if variable name is in float array (Mega & ESP8266 only)
-       #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
-       if (!foundFlag) for (uint8_t i = 0; i < float_variables_index; i++){
-         if(fastStringCompare(answer, float_variables_names[i])) {
-		   foundFlag = true;
-			if (DEBUG_MODE) {Serial.println(F("Found float variable"));}
-           // End here
-           pin_selected = true;
-           state = 'x';
+  uint8_t in = 0;
+  uint8_t out = 0;
+  while (in < length) {
+    uint8_t code = frame[in++];
+    for (uint8_t i = 1; i < code; i++) {
+      if (in == length) {return 0;}
+      frame[out++] = frame[in++];
+    }
+    if (code < 0xFF && in < length) {frame[out++] = 0;}
+  }
+  return out;
+}
 
-           // Set state
-           command = 'l';
-           value = i;
-		   break;
-         }
-       }
-       #endif
+// CRC16-CCITT (polynomial 0x1021, initial value 0xFFFF) of binary frames
+static uint16_t crc16(const uint8_t * data, uint16_t length) {
 
-       // Check if variable name is in string array (Mega & ESP8266 only)
-       #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
-       if (!foundFlag) for (uint8_t i = 0; i < string_variables_index; i++){
-         if(fastStringCompare(answer, string_variables_names[i])) {
-		   foundFlag = true;
-			if (DEBUG_MODE) {Serial.println(F("Found string variable"));}
-           // End here
-           pin_selected = true;
-           state = 'x';
+  uint16_t crc = 0xFFFF;
+  while (length--) {
+    crc ^= (uint16_t)*data++ << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+#endif
 
-           // Set state
-           command = 's';
-           value = i;
-		   break;
-         }
-       }
-       #endif
+// Serve the HTTP requests a client has sent so far, without waiting for more.
+// Pipelined requests are answered in order, and the connection is kept open:
+// the next requests are answered on a later call, once server.available()
+// hands the client back. It is closed when the client asks, after
+// keep_alive_max requests, or once a request cut short has been idle for
+// keep_alive_timeout ms, what was received of it being answered. A connection
+// idle for keep_alive_timeout counts as a new one.
+template <typename T>
+bool handle_http(T& client, uint8_t chunkSize, uint8_t wait_time) {
 
-       // If the command is "id", return device id, name and status
-       if ( (answer[0] == 'i' && answer[1] == 'd') ){
-			if (DEBUG_MODE) {Serial.println(F("Found id request"));}
-           // Set state
-           command = 'i';
+  bool result = false;
+  bool idle = millis() - http_last_activity >= keep_alive_timeout;
+  bool partial = http_state != AREST_HTTP_REQUEST_LINE || http_line_length > 0;
 
-           // End here
-           pin_selected = true;
-           state = 'x';
-       }
+  if (!client.available()) {
 
-       if (answer[0] == ' '){
+    // Client gone idle in the middle of a request: answer what was received
+    if (partial && idle && client.connected()) {
+      http_keep_alive = false;
+      answer_http(client, chunkSize, wait_time, result);
+      close_http(client);
+    }
+    return result;
+  }
 
-           // Set state
-           command = 'r';
+  // What was left of a request cut short by another client is dropped
+  if (idle) {
+    http_served = 0;
+    if (partial) {reset_request();}
+  }
+  http_last_activity = millis();
 
-           // End here
-           pin_selected = true;
-           state = 'x';
-       }
+  while (http_pending(client)) {
 
-       // Check the type of HTTP request
-       // if (answer.startsWith("GET")) {method = "GET";}
-       // if (answer.startsWith("POST")) {method = "POST";}
-       // if (answer.startsWith("PUT")) {method = "PUT";}
-       // if (answer.startsWith("DELETE")) {method = "DELETE";}
+    // Read up to the end of a request, or of what was received of it
+    if (!read_http(client)) {continue;}
 
-       // if (DEBUG_MODE && method != "") {
-       //  Serial.print("Selected method: ");
-       //  Serial.println(method);
-       // }
+    // Answer it
+    http_served++;
+    if (keep_alive_timeout == 0 || http_served >= keep_alive_max) {http_keep_alive = false;}
+    if (!answer_http(client, chunkSize, wait_time, result)) {
+      close_http(client);
+      return result;
+    }
+  }
 
-     }
+  // Client gone: close its end too, dropping what was received of a request
+  if (!client.connected()) {
+    reset_request();
+    close_http(client);
+  }
+  return result;
+}
 
-     answer = "";
-    }
+// Close the connection of a client served by handle_http(). Pipelined
+// requests left unanswered are dropped with it.
+template <typename T>
+void close_http(T& client) {
+  http_block_length = 0;
+  http_block_offset = 0;
+  http_served = 0;
+  client.stop();
 }
 
-bool send_command(bool headers) {
+// Answer the request read from a client. Returns if the connection is kept open.
+template <typename T>
+bool answer_http(T& client, uint8_t chunkSize, uint8_t wait_time, bool& result) {
 
-	bool result = false;
+  // Answer is streamed to the client if it outgrows the buffer
+  setOutput(client, chunkSize, wait_time);
+  result = send_command(true);
+  sendBuffer(client, chunkSize, wait_time);
 
-   if (DEBUG_MODE) {
+  // Reset variables for the next command
+  bool keep_alive = http_keep_alive;
+  reset_status();
+  return keep_alive;
+}
 
-     #if defined(ESP8266)
-     Serial.print("Memory loss:");
-     Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-     freeMemory = ESP.getFreeHeap();
-     #endif
+// Read an HTTP request from a client, a block at a time: the request line goes
+// to the parser, the headers are only scanned for the connection & the length
+// of the body, the other header lines and the body are skipped without looking
+// at each of their bytes. Returns true at the end of the request, keeping what
+// was read of any pipelined request. At most budget bytes are read.
+template <typename T>
+bool read_http(T& client, uint16_t budget = 0xFFFF) {
+
+  for (;;) {
+
+    // Next block
+    if (http_block_offset == http_block_length) {
+      uint16_t length = client.available();
+      if (length > budget) {length = budget;}
+      if (length > AREST_HTTP_READ_BLOCK) {length = AREST_HTTP_READ_BLOCK;}
+      if (length == 0) {return false;}
+      http_block_length = readBlock(client, http_block, length, 0);
+      http_block_offset = 0;
+      if (http_block_length == 0) {return false;}
+      budget -= http_block_length;
+      countBytesIn(http_block_length);
+      AREST_TRACE(AREST_TRACE_DEBUG, AREST_TRACE_BLOCK, 0, http_block_length);
+    }
 
-     Serial.println(F("Sending command"));
-     Serial.print(F("Command: "));
-     Serial.println(command);
-     Serial.print(F("State: "));
-     Serial.println(state);
-     Serial.print(F("State of buffer at the start: "));
-     Serial.println(buffer);
-   }
+    // Body
+    if (http_state == AREST_HTTP_BODY) {
+      uint8_t length = http_block_length - http_block_offset;
+      if (length > http_body_length) {length = http_body_length;}
+      http_block_offset += length;
+      http_body_length -= length;
+      if (http_body_length == 0) {return true;}
+      continue;
+    }
 
-   // Start of message
-   if (headers && command != 'r') {send_http_headers();}
+    // Header line of no interest: skip to its end
+    if (http_state == AREST_HTTP_HEADER_LINES && http_line_length > 0
+        && http_match_connection == AREST_HTTP_NO_MATCH && http_match_length == AREST_HTTP_NO_MATCH) {
+      const uint8_t * end = (const uint8_t *)memchr(http_block + http_block_offset, '\n', http_block_length - http_block_offset);
+      if (end == NULL) {
+        http_block_offset = http_block_length;
+        continue;
+      }
+      http_block_offset = end - http_block;
+    }
 
-   // Mode selected
-   if (command == 'm' && (enable_byte & (AREST_ENB_DIGITAL | AREST_ENB_ANALOG))){
+    char c = http_block[http_block_offset++];
 
-     // Send feedback to client
-     if (!LIGHTWEIGHT){
-       addToBuffer(F("{\"message\": \"Pin D"));
-       addToBuffer(pin);
-     }
+    // End of a line: a blank one ends the headers
+    if (c == '\n') {
+      if (http_line_length == 0) {
+        if (http_state == AREST_HTTP_REQUEST_LINE) {continue;}
+        if (http_body_length == 0) {return true;}
+        http_state = AREST_HTTP_BODY;
+        continue;
+      }
+      http_state = AREST_HTTP_HEADER_LINES;
+      http_line_length = 0;
+      http_match_connection = 0;
+      http_match_length = 0;
+      continue;
+    }
+    if (c == '\r') {
 
-     // Input
-     if (state == 'i'){
+      // HTTP/1.0 connections are closed, unless asked otherwise
+      if (http_state == AREST_HTTP_REQUEST_LINE && http_line_length > 0) {
+        http_keep_alive = http_version != (((uint32_t)'/' << 24) | ((uint32_t)'1' << 16) | ('.' << 8) | '0');
+        process(c);
+      }
+      continue;
+    }
+    if (http_line_length < 255) {http_line_length++;}
 
-      // Set pin to Input
-      pinMode(pin,INPUT);
+    // Request line
+    if (http_state == AREST_HTTP_REQUEST_LINE) {
+      http_version = (http_version << 8) | (uint8_t)c;
+      process(c);
+      continue;
+    }
 
-      // Send feedback to client
-      if (!LIGHTWEIGHT){addToBuffer(F(" set to input\", "));}
-     }
+    // Headers
+    http_match_connection = matchHeader(http_match_connection, c, aREST_header_connection);
+    if (http_match_connection == sizeof(aREST_header_connection) - 1 && c != ':' && c != ' ') {
+      http_keep_alive = (c == 'k' || c == 'K');
+      http_match_connection = AREST_HTTP_NO_MATCH;
+    }
+    http_match_length = matchHeader(http_match_length, c, aREST_header_content_length);
+    if (http_match_length == sizeof(aREST_header_content_length) - 1 && c >= '0' && c <= '9') {
+      if (http_body_length < 6553) {http_body_length = http_body_length * 10 + (c - '0');}
+    }
+  }
+}
 
-     // Output
-     if (state == 'o'){
+// Whether a request, or part of one, is waiting to be read from a client
+template <typename T>
+bool http_pending(T& client) {
+  return http_block_offset < http_block_length || client.available();
+}
 
-       // Set to Output
-       pinMode(pin,OUTPUT);
+// Read up to length bytes, all available, at once for clients that can
+template <typename C>
+static auto readBlock(C& client, uint8_t * block, uint8_t length, int) -> decltype(client.read(block, (size_t)length), uint8_t()) {
+  int count = client.read(block, (size_t)length);
+  return count > 0 ? count : 0;
+}
 
-       // Send feedback to client
-       if (!LIGHTWEIGHT){addToBuffer(F(" set to output\", "));}
-     }
-	 result = true;
+template <typename C>
+static uint8_t readBlock(C& client, uint8_t * block, uint8_t length, long) {
+  uint8_t count = 0;
+  while (count < length && client.available()) {block[count++] = client.read();}
+  return count;
+}
 
-   }
+// Open a connection of a connection table
+void open_connection(aRESTConnection& connection) {
+
+  swap_request(connection.request);
+  reset_request();
+  http_block_length = 0;
+  http_block_offset = 0;
+  swap_request(connection.request);
+  connection.last_activity = millis();
+  connection.served = 0;
+  connection.open = true;
+  connection.step = AREST_STEP_READ;
+  connection.stalled = false;
+  connection.room_reported = false;
+  #if defined(AREST_STREAM)
+  connection.request.streaming = false;
+  #endif
+}
 
-   // Digital selected
-   if (command == 'd') {
-     if (state == 'r' && (enable_byte & AREST_ENB_DIGITAL_READ)){
+// Close a connection of a connection table, with its request swapped in:
+// whatever ends it, the stream slot & output buffer it holds are released
+template <typename T>
+void close_connection(T& client, aRESTConnection& connection) {
 
-       // Read from pin
-       value = digitalRead(pin);
+  #if defined(AREST_STREAM)
+  if (streaming) {
+    stream_count--;
+    streaming = false;
+  }
+  #endif
+  if (output_owner == &connection) {
+    index = 0;
+    output_flush = NULL;
+    output_owner = NULL;
+  }
+  connection.open = false;
+  client.stop();
+}
 
-       // Send answer
-       if (LIGHTWEIGHT){addToBuffer(value);}
-       else {
-        addToBuffer(F("{\"return_value\": "));
-        addToBuffer(value);
-        addToBuffer(F(", "));
-      }
-	  result = true;
+// Advance a connection of a connection table as far as it goes without
+// waiting for its client: read at most budget bytes, answer at most one
+// request, and write what the client takes of the answer, the rest being
+// sent on the next calls. Returns the result of the last step.
+template <typename T>
+uint8_t handle_connection(T& client, aRESTConnection& connection, uint8_t chunkSize, uint16_t budget) {
+
+  uint16_t read = 0;
+  uint8_t result = AREST_SLICE_BUSY;
+  while (connection.open && result == AREST_SLICE_BUSY) {
+    if (connection.step == AREST_STEP_READ) {
+      if (read >= budget) {break;}
+      read += AREST_HTTP_READ_BLOCK;
+    }
+    result = step_connection(client, connection, chunkSize);
+  }
+  return result;
+}
+
+// Advance a connection by one step at most, without waiting for its client
+// nor for any time: read a block of its request, build the answer, or write
+// what the client takes of it. The output buffer holds one answer at a time,
+// the other connections build theirs once it is sent. Answers that outgrow
+// the buffer are streamed as they are built, as long as the client takes
+// each full buffer at once.
+template <typename T>
+uint8_t step_connection(T& client, aRESTConnection& connection, uint8_t chunkSize) {
+
+  uint8_t result = AREST_SLICE_BUSY;
+  swap_request(connection.request);
+
+  // Write what the client takes of the answer
+  if (connection.step == AREST_STEP_SEND) {
+    result = sendStep(client, connection, chunkSize);
+  }
+
+  #if defined(AREST_WAIT)
+  // Wait for the condition of the request, checked on every pass, without
+  // holding the output buffer
+  else if (connection.step == AREST_STEP_WAIT) {
+    if (!client.connected()) {connection.open = false;}
+    else if (waitOver()) {connection.step = AREST_STEP_ANSWER;}
+    else {result = AREST_SLICE_IDLE;}
+  }
+  #endif
+
+  #if defined(AREST_STREAM)
+  // Build the next event of a stream once it is due, and the output buffer
+  // is free
+  else if (connection.step == AREST_STEP_STREAM) {
+    if (!client.connected()) {connection.open = false;}
+    else if ((stream_sent && millis() - stream_last < stream_interval) || output_owner != NULL) {
+      result = AREST_SLICE_IDLE;
+    }
+    else {
+      stream_last = millis();
+      output_owner = &connection;
+      output_flush = NULL;
+      if (streamEvent()) {
+        countBytesOut(index);
+        connection.sent = 0;
+        connection.stalled = false;
+        connection.step = AREST_STEP_SEND;
+      }
+
+      // Event too large for the output buffer: the stream ends
+      else if (output_dropped) {
+        AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_ANSWER_TOO_LONG, 0, index);
+        output_dropped = false;
+        connection.open = false;
+      }
+      else {
+        index = 0;
+        output_owner = NULL;
+        result = AREST_SLICE_IDLE;
+      }
+    }
+  }
+  #endif
+
+  // Build the answer, once the output buffer is free and the client isn't
+  // full: one that stays full for the send timeout is given up on
+  else if (connection.step == AREST_STEP_ANSWER) {
+    if (writeRoom(client, connection.room_reported) == 0) {
+      if (!connection.stalled) {
+        connection.stalled = true;
+        connection.stall_start = millis();
+      }
+      else if (millis() - connection.stall_start > AREST_SEND_TIMEOUT) {
+        AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_SEND_TIMEOUT, 0, 0);
+        connection.open = false;
+      }
+      result = AREST_SLICE_IDLE;
+    }
+    else if (output_owner == NULL) {
+      output_owner = &connection;
+      setSliceOutput(client);
+      send_command(true);
+      if (http_header_room) {writeHttpHeaders(true);}
+      else if (http_chunked) {writeChunk(true);}
+
+      // Answer the client couldn't take as it outgrew the buffer: cut, and
+      // the connection closed
+      if (output_dropped) {
+        AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_ANSWER_TOO_LONG, 0, index);
+        index = 0;
+        http_keep_alive = false;
+      }
+      countBytesOut(index);
+      connection.sent = 0;
+      connection.stalled = false;
+      connection.step = AREST_STEP_SEND;
+    }
+    else {result = AREST_SLICE_IDLE;}
+  }
+
+  // Read a block of the request
+  else if (http_pending(client)) {
+    connection.last_activity = millis();
+    if (read_http(client, AREST_HTTP_READ_BLOCK)) {
+      connection.served++;
+      if (keep_alive_timeout == 0 || connection.served >= keep_alive_max) {http_keep_alive = false;}
+      connection.step = AREST_STEP_ANSWER;
+      #if defined(AREST_WAIT)
+      if (command == 'W') {connection.step = AREST_STEP_WAIT;}
+      #endif
+      #if defined(AREST_STREAM)
+      if (command == 'S' && stream_count < AREST_MAX_STREAMS) {
+        stream_count++;
+        streaming = true;
+        connection.step = AREST_STEP_STREAM;
+      }
+      #endif
+    }
+  }
+
+  // Client gone or idle: answer what was received of a request, and close
+  else if (!client.connected() || millis() - connection.last_activity >= keep_alive_timeout) {
+    if (http_state != AREST_HTTP_REQUEST_LINE || http_line_length > 0) {
+      http_keep_alive = false;
+      connection.step = AREST_STEP_ANSWER;
+    }
+    else {connection.open = false;}
+  }
+
+  else {result = AREST_SLICE_IDLE;}
+
+  if (!connection.open) {close_connection(client, connection);}
+  swap_request(connection.request);
+  return result;
+}
+
+// Write a chunk of the answer of a connection, as much as its client takes
+template <typename T>
+uint8_t sendStep(T& client, aRESTConnection& connection, uint8_t chunkSize) {
+
+  bool timeout = false;
+  if (connection.sent < index) {
+    uint16_t length = index - connection.sent;
+    if (chunkSize && length > chunkSize) {length = chunkSize;}
+    int room = writeRoom(client, connection.room_reported);
+    if (room >= 0 && room < length) {length = room;}
+    size_t written = length > 0 ? client.write((const uint8_t *)buffer + connection.sent, length) : 0;
+    connection.sent += written;
+
+    if (connection.sent < index) {
+      if (written > 0) {
+        connection.stalled = false;
+        return AREST_SLICE_BUSY;
+      }
+
+      // Client full: wait for it, up to the send timeout
+      if (!connection.stalled) {
+        connection.stalled = true;
+        connection.stall_start = millis();
+        send_stalls++;
+      }
+      timeout = !client.connected() || millis() - connection.stall_start > AREST_SEND_TIMEOUT;
+      if (!timeout) {return AREST_SLICE_IDLE;}
+      AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_SEND_TIMEOUT, 0, index - connection.sent);
+    }
+  }
+
+  // Answer sent: the output buffer is free again
+  AREST_TRACE(AREST_TRACE_INFO, AREST_TRACE_SENT, 0, connection.sent);
+
+  #if defined(AREST_STREAM)
+  // Event of a stream sent: on to the next one, unless the client is gone
+  if (streaming) {
+    index = 0;
+    output_flush = NULL;
+    output_owner = NULL;
+    if (!timeout) {
+      connection.step = AREST_STEP_STREAM;
+      return AREST_SLICE_BUSY;
+    }
+  }
+  #endif
+
+  connection.open = http_keep_alive && !timeout;
+  reset_status();
+  output_owner = NULL;
+  connection.step = AREST_STEP_READ;
+  connection.stalled = false;
+  connection.last_activity = millis();
+  return AREST_SLICE_ANSWERED;
+}
+
+// Whether two clients are the same connection, for clients that can tell
+template <typename C>
+static auto same_client(C& a, C& b, int) -> decltype(static_cast<bool (C::*)(const C&)>(&C::operator==), bool()) {
+  return a == b;
+}
+
+template <typename C>
+static auto same_client(C& a, C& b, long) -> decltype(static_cast<bool (C::*)(const C&) const>(&C::operator==), bool()) {
+  return a == b;
+}
+
+template <typename C>
+static bool same_client(C& a, C& b, ...) {
+  return false;
+}
+
+// Match the name of a header, in lower case, one character at a time
+static uint8_t matchHeader(uint8_t matched, char c, PGM_P name) {
+
+  if (matched == AREST_HTTP_NO_MATCH || pgm_read_byte(name + matched) == '\0') {return matched;}
+  if (c >= 'A' && c <= 'Z') {c += 'a' - 'A';}
+  return c == (char)pgm_read_byte(name + matched) ? matched + 1 : AREST_HTTP_NO_MATCH;
+}
+
+#if defined(PubSubClient_h)
+
+// Process callback: the payload goes straight to the parser, whatever its
+// length, and the answer is published from the output buffer
+void handle_callback(PubSubClient& client, char*, byte* payload, unsigned int length) {
+
+  // Process aREST commands, ended like handle(char *) expects them
+  for (unsigned int i = 0; i < length; i++) {
+    process(payload[i]);
+  }
+  countBytesIn(length);
+  process(' ');
+  process('/');
+  send_command(false);
+
+  // Answers the MQTT client can't send are replaced by an error
+  if (index > mqttPayloadSize(client, out_topic, 0)) {
+    AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_ANSWER_TOO_LONG, 0, index);
+    resetBuffer();
+    addToBuffer(F("{\"message\": \"Answer too long\", "));
+    addTrailerToBuffer();
+  }
+
+  // Send response
+  client.publish(out_topic, (const uint8_t *)buffer, index);
+  countBytesOut(index);
+
+  // Reset variables for the next command
+  reset_status();
+}
+
+// Largest payload the MQTT client can publish on a topic: its packet, less
+// the fixed header, topic length & topic
+template <typename C>
+auto mqttPayloadSize(C& client, const char * topic, int) -> decltype(client.getBufferSize(), uint16_t()) {
+  return client.getBufferSize() - 5 - 2 - strlen(topic);
+}
+
+template <typename C>
+uint16_t mqttPayloadSize(C& client, const char * topic, long) {
+  return MQTT_MAX_PACKET_SIZE - 5 - 2 - strlen(topic);
+}
+
+// Handle request on the Serial port
+void loop(PubSubClient& client){
+
+  // Connect to cloud, without waiting for it
+  reconnect(client);
+  client.loop();
+  publish_telemetry(client);
+
+}
+
+void handle(PubSubClient& client){
+
+  // Connect to cloud, without waiting for it
+  reconnect(client);
+  client.loop();
+  publish_telemetry(client);
+
+}
+
+// Publish a variable over MQTT on its own when it moves by more than deadband
+// from the value last published, at most every min_interval ms, and at least
+// every max_interval ms unless it is 0. Returns false for names that aren't
+// variables, or when NUMBER_WATCHES variables are already watched.
+bool watch(const char * variable_name, float deadband = 0, uint32_t min_interval = AREST_TELEMETRY_MIN_INTERVAL, uint32_t max_interval = 0) {
+
+  uint8_t route = find_route(variable_name);
+  if (route == AREST_NO_ROUTE || route_kind(route) == AREST_ROUTE_FUNCTION) {return false;}
+
+  uint8_t i = 0;
+  while (i < watches_index && watches[i].route != route) {i++;}
+  if (i == NUMBER_WATCHES) {return false;}
+  if (i == watches_index) {watches_index++;}
+
+  watches[i].route = route;
+  watches[i].published = false;
+  watches[i].deadband = deadband;
+  watches[i].min_interval = min_interval;
+  watches[i].max_interval = max_interval;
+  return true;
+}
+
+// Publish the watched variables that are due in a single message on the
+// publish topic, as {"client_id": "...", "variables": {"name": value, ...}}.
+// Variables that don't fit in the output buffer or in an MQTT packet are left
+// for the next one, and all of them if the client fails to publish it.
+bool publish_telemetry(PubSubClient& client) {
+
+  if (watches_index == 0 || !client.connected() || index > 0) {return false;}
+
+  // Variables due
+  uint32_t now = millis();
+  bool any = false;
+  for (uint8_t i = 0; i < watches_index; i++) {
+    aRESTWatch& w = watches[i];
+    uint32_t elapsed = now - w.last_publish;
+    w.due = !w.published
+      || (w.max_interval > 0 && elapsed >= w.max_interval)
+      || (elapsed >= w.min_interval && watchChanged(w));
+    any = any || w.due;
+  }
+  if (!any) {return false;}
+
+  // Message, as long as the client can publish
+  uint16_t size = mqttPayloadSize(client, publish_topic, 0);
+  if (size > OUTPUT_BUFFER_SIZE - 1) {size = OUTPUT_BUFFER_SIZE - 1;}
+  addToBuffer(F("{\"client_id\": \""));
+  addToBuffer(id);
+  addToBuffer(F("\", \"variables\": {"));
+  uint16_t start = index;
+  for (uint8_t i = 0; i < watches_index; i++) {
+    aRESTWatch& w = watches[i];
+    if (!w.due) {continue;}
+
+    uint16_t mark = index;
+    if (index > start) {addToBuffer(F(", "));}
+    addToBuffer(F("\""));
+    addToBuffer(route_name(w.route));
+    addToBuffer(F("\": "));
+    addVariableToBuffer(w.route);
+
+    // Room left for the end of the message ?
+    if (index + 2 > size) {
+      index = mark;
+      buffer[index] = '\0';
+      w.due = false;
+    }
+  }
+  bool result = index > start;
+  addToBuffer(F("}}"));
+
+  // Published variables are measured from their value now
+  result = result && client.publish(publish_topic, (const uint8_t *)buffer, index);
+  for (uint8_t i = 0; result && i < watches_index; i++) {
+    if (watches[i].due) {watchPublished(watches[i], now);}
+  }
+  resetBuffer();
+  return result;
+}
+
+// Whether a watched variable moved past its deadband since last published
+bool watchChanged(aRESTWatch& w) {
+
+  uint8_t i = route_position(w.route);
+  switch (route_kind(w.route)) {
+
+    case AREST_ROUTE_INT: {
+      long value = *int_variables[i];
+      if (value == w.last.int_value) {return false;}
+      return w.deadband <= 0 || fabs((float)value - (float)w.last.int_value) > w.deadband;
+    }
+
+    #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+    case AREST_ROUTE_FLOAT: {
+      float value = *float_variables[i];
+      if (memcmp(&value, &w.last.float_value, sizeof(float)) == 0) {return false;}
+      if (isnan(value) || isnan(w.last.float_value)) {return true;}
+      return w.deadband <= 0 || fabs(value - w.last.float_value) > w.deadband;
+    }
+
+    case AREST_ROUTE_STRING:
+      return stringHash(*string_variables[i]) != w.last.string_hash;
+    #endif
+  }
+  return false;
+}
+
+// Keep the value of a watched variable as published
+void watchPublished(aRESTWatch& w, uint32_t now) {
+
+  uint8_t i = route_position(w.route);
+  switch (route_kind(w.route)) {
+    case AREST_ROUTE_INT: w.last.int_value = *int_variables[i]; break;
+    #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+    case AREST_ROUTE_FLOAT: w.last.float_value = *float_variables[i]; break;
+    case AREST_ROUTE_STRING: w.last.string_hash = stringHash(*string_variables[i]); break;
+    #endif
+  }
+  w.published = true;
+  w.last_publish = now;
+}
+
+// Connect to the MQTT broker without waiting for it: at most one attempt per
+// call, and none before the backoff delay that follows a failed attempt is
+// over. A lost connection is tried again right away. Returns if connected.
+bool reconnect(PubSubClient& client) {
+
+  if (client.connected()) {return true;}
+
+  // Connection lost
+  if (mqtt_online) {
+    mqtt_online = false;
+    mqtt_disconnects++;
+    mqtt_wait = 0;
+    AREST_TRACE(AREST_TRACE_INFO, AREST_TRACE_MQTT_LOST, 0, mqtt_disconnects);
+  }
+
+  uint32_t now = millis();
+  if (now - mqtt_last_attempt < mqtt_wait) {return false;}
+  mqtt_last_attempt = now;
+
+  // Attempt to connect
+  if (client.connect(id)) {
+    client.subscribe(in_topic);
+
+    // Subscribe to all
+    for (int i = 0; i < subscriptions_index; i++) {
+      client.subscribe(subscriptions_names[i]);
+    }
+
+    mqtt_online = true;
+    mqtt_connects++;
+    AREST_TRACE(AREST_TRACE_INFO, AREST_TRACE_MQTT_CONNECTED, 0, mqtt_connects);
+    mqtt_backoff = AREST_MQTT_BACKOFF_MIN;
+    return true;
+  }
+
+  // Wait before the next attempt, twice as long after each failure
+  mqtt_failures++;
+  mqtt_wait = mqtt_backoff - random(mqtt_backoff / 2 + 1);
+  mqtt_backoff = mqtt_backoff > AREST_MQTT_BACKOFF_MAX / 2 ? AREST_MQTT_BACKOFF_MAX : 2 * mqtt_backoff;
+  AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_MQTT_FAILED, client.state(), mqtt_wait / 1000);
+  return false;
+}
+
+// Health of the MQTT connection: successful connections, failed attempts,
+// and connections lost
+uint16_t get_mqtt_connects() {
+  return mqtt_connects;
+}
+
+uint16_t get_mqtt_failures() {
+  return mqtt_failures;
+}
+
+uint16_t get_mqtt_disconnects() {
+  return mqtt_disconnects;
+}
+#endif
+
+void process(char c){
+
+  #if defined(AREST_METRICS)
+  if (!request_started) {
+    request_started = true;
+    request_start = micros();
+  }
+  #endif
+
+  // Batch query: items are read one at a time
+  if (state == 'b') {
+    process_batch(c);
+    return;
+  }
+
+  // Store the character in the current segment, as long as the route is not found
+  if (state == 'u') {
+    if (answer_length < REQUEST_BUFFER_SIZE - 1) {
+      answer_length++;
+    }
+    else if (c != '/' && c != '\r') {
+      // Segment too long: drop the character, but keep the separator
+      return;
+    }
+    answer[answer_length - 1] = c;
+    answer[answer_length] = '\0';
+
+    // Batch query received ?
+    if (command == 'u' && answer_length == 6 && strncmp_P(answer, PSTR("batch?"), 6) == 0) {
+      command = 'b';
+      state = 'b';
+      pin_selected = true;
+      answer_length = 0;
+      answer[0] = '\0';
+      return;
+    }
+
+    #if defined(AREST_STREAM)
+    // Stream of a batch received ?
+    if (command == 'u' && answer_length == 7 && strncmp_P(answer, PSTR("stream?"), 7) == 0) {
+      command = 'S';
+      state = 'b';
+      pin_selected = true;
+      answer_length = 0;
+      answer[0] = '\0';
+      return;
+    }
+    #endif
+  }
+
+  // Check if we are receveing useful data and process it
+  if ((c == '/' || c == '\r') && state == 'u') {
+
+      // Parameters of the query
+      const char * query = strchr(answer, '?');
+      if (query != NULL) {query_parameters(query);}
+
+      AREST_TRACE(AREST_TRACE_DEBUG, AREST_TRACE_SEGMENT, answer[0], answer_length);
+      if (answer_length == REQUEST_BUFFER_SIZE - 1) {
+        AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_SEGMENT_TOO_LONG, command, answer_length);
+      }
+
+      // If the command is mode, and the pin is already selected
+      if (command == 'm' && pin_selected && state == 'u') {
+
+        // Get state
+        state = answer_at(0);
+
+     }
+
+     #if defined(AREST_METRICS)
+     // Metrics, in the Prometheus format ?
+     if (command == 'M' && state == 'u') {
+       state = answer_at(0) == 'p' ? 'P' : 'x';
+     }
+     #endif
+
+     // If a digital command has been received, process the data accordingly
+     if (command == 'd' && pin_selected && state == 'u') {
+
+       // If it's a read command, read from the pin and send data back
+       if (answer_at(0) == 'r') {state = 'r';}
+
+       // If not, get value we want to apply to the pin
+       else {value = atoi(answer); state = 'w';}
+     }
+
+     // If analog command has been selected, process the data accordingly
+     if (command == 'a' && pin_selected && state == 'u') {
+
+       // If it's a read, read from the correct pin
+       if (answer_at(0) == 'r') {state = 'r';}
+
+       // Else, write analog value
+       else {value = atoi(answer); state = 'w';}
+     }
+
+     #if defined(AREST_WAIT)
+     // Wait: get what is waited on
+     if (command == 'W' && pin_selected == false) {waitTarget();}
+     #endif
+
+     // If the command is already selected, get the pin
+     if (command != 'u' && pin_selected == false) {
+
+       // Get pin
+       if (answer_at(0) == 'A') {
+         pin = 14 + answer_at(1) - '0';
+       }
+       else {
+         pin = atoi(answer);
+       }
+       pin_selected = true;
+
+       // Nothing more ?
+       if ((answer_at(1) != '/' && answer_at(2) != '/')
+        || (answer_at(1) == ' ' && answer_at(2) == '/')
+        || (answer_at(2) == ' ' && answer_at(3) == '/')) {
+
+        // Nothing more & digital ?
+        if (command == 'd') {
+
+          // Read all digital ?
+          if (answer_at(0) == 'a') {state = 'a';}
+
+          // Read all digital, packed ?
+          else if (answer_at(0) == 'p') {state = 'p';}
+
+          // Save state & end there
+          else {state = 'r';}
+        }
+
+       // Nothing more & analog ?
+       if (command == 'a') {
+
+         // Read all analog ?
+         if (answer_at(0) == 'a') {state = 'a';}
+
+         // Read all analog, packed ?
+         else if (answer_at(0) == 'p') {state = 'p';}
+
+         // Save state & end there
+         else {state = 'r';}
+       }
+     }
+
+   }
+
+     // Digital command received ?
+     if (strncmp_P(answer, PSTR("digital"), 7) == 0) {command = 'd';}
+
+     // Mode command received ?
+     if (strncmp_P(answer, PSTR("mode"), 4) == 0) {command = 'm';}
+
+     // Analog command received ?
+     if (strncmp_P(answer, PSTR("analog"), 6) == 0) {command = 'a';}
+
+     #if defined(AREST_WAIT)
+     // Wait command received ?
+     if (command == 'u' && strncmp_P(answer, PSTR("wait/"), 5) == 0) {command = 'W';}
+     #endif
+
+     // Variable or function request received ?
+     if (command == 'u') {
+       // Look the name up in the route index
+       uint8_t route = find_route(answer);
+       if (route != AREST_NO_ROUTE) {
+         uint8_t i = route_position(route);
+
+         // End here
+         pin_selected = true;
+         state = 'x';
+         value = i;
+
+         // Function
+         if (route_kind(route) == AREST_ROUTE_FUNCTION) {
+
+           // Set state
+           command = 'f';
+
+           // Get command: arguments stay in place in the segment buffer
+           arguments_offset = 0;
+           arguments_length = 0;
+           uint8_t header_length = strlen(functions_names[i]);
+           if (answer_at(header_length) == '?' && strncmp_P(answer + header_length, PSTR("?params="), 8) == 0) {
+             uint8_t footer_start = answer_length;
+             if (answer_length >= 6 && strcmp_P(answer + answer_length - 6, PSTR(" HTTP/")) == 0)
+               footer_start -= 6; // length of " HTTP/"
+             if (header_length + 8 < footer_start) {
+               arguments_offset = header_length + 8; // length of "?params="
+               arguments_length = footer_start - arguments_offset;
+
+               // Other parameters follow the arguments
+               const char * end = (const char *)memchr(answer + arguments_offset, '&', arguments_length);
+               if (end != NULL) {arguments_length = end - answer - arguments_offset;}
+             }
+           }
+         }
+
+         // Int variable
+         if (route_kind(route) == AREST_ROUTE_INT) {
+           command = 'v';
+         }
+
+         // Float variable
+         if (route_kind(route) == AREST_ROUTE_FLOAT) {
+           command = 'l';
+         }
+
+         // String variable
+         if (route_kind(route) == AREST_ROUTE_STRING) {
+           command = 's';
+         }
+       }
+
+       #if defined(AREST_METRICS)
+       // Metrics request ?
+       if (route == AREST_NO_ROUTE && answer_length > 7 && strncmp_P(answer, PSTR("metrics"), 7) == 0
+           && (answer[7] == ' ' || answer[7] == '/' || answer[7] == '\r')) {
+         command = 'M';
+         pin_selected = true;
+         if (answer[7] != '/') {state = 'x';}
+       }
+       #endif
+
+       #if AREST_TRACE_LEVEL > 0
+       // Trace request ?
+       if (route == AREST_NO_ROUTE && answer_length > 5 && strncmp_P(answer, PSTR("trace"), 5) == 0
+           && (answer[5] == ' ' || answer[5] == '/' || answer[5] == '\r')) {
+         command = 'T';
+         pin_selected = true;
+         state = 'x';
+       }
+       #endif
+
+       // If the command is "id", return device id, name and status
+       if ( (answer_at(0) == 'i' && answer_at(1) == 'd') ){
+           // Set state
+           command = 'i';
+
+           // End here
+           pin_selected = true;
+           state = 'x';
+       }
+
+       // Root: the path ends here, or its query starts
+       if (answer_at(0) == ' ' || answer_at(0) == '\r' || answer_at(0) == '?'){
+
+           // Set state
+           command = 'r';
+
+           // End here
+           pin_selected = true;
+           state = 'x';
+       }
+
+       // Check the type of HTTP request
+       // if (answer.startsWith("GET")) {method = "GET";}
+       // if (answer.startsWith("POST")) {method = "POST";}
+       // if (answer.startsWith("PUT")) {method = "PUT";}
+       // if (answer.startsWith("DELETE")) {method = "DELETE";}
+
+       // if (DEBUG_MODE && method != "") {
+       //  Serial.print("Selected method: ");
+       //  Serial.println(method);
+       // }
+
+     }
+
+     answer_length = 0;
+     answer[0] = '\0';
+    }
+}
+
+// Sample every digital pin at once, one bit per pin: whole port registers are
+// read where the core exposes them, each of them once
+void sampleDigitalPins(uint8_t * sample) {
+
+  memset(sample, 0, AREST_DIGITAL_SAMPLE_SIZE);
+
+  #if defined(ESP8266) && !defined(AREST_PORTABLE_PIN_READS)
+  uint32_t gpio = GPI;
+  for (uint8_t i = 0; i < 16 && i < NUMBER_DIGITAL_PINS; i++) {
+    if (gpio & (1UL << i)) {sample[i >> 3] |= 1 << (i & 7);}
+  }
+  if (NUMBER_DIGITAL_PINS > 16 && (GP16I & 0x01)) {sample[2] |= 0x01;}
+
+  #elif defined(AREST_PORT_REGISTERS)
+  uint8_t ports[AREST_MAX_PORTS];
+  uint16_t ports_read = 0;
+  for (uint8_t i = 0; i < NUMBER_DIGITAL_PINS; i++) {
+    uint8_t port = digitalPinToPort(i);
+    if (port == NOT_A_PIN || port >= AREST_MAX_PORTS) {continue;}
+    if (!(ports_read & (1 << port))) {
+      ports[port] = *portInputRegister(port);
+      ports_read |= 1 << port;
+    }
+    if (ports[port] & digitalPinToBitMask(i)) {sample[i >> 3] |= 1 << (i & 7);}
+  }
+
+  #else
+  for (uint8_t i = 0; i < NUMBER_DIGITAL_PINS; i++) {
+    if (digitalRead(i)) {sample[i >> 3] |= 1 << (i & 7);}
+  }
+  #endif
+}
+
+// Sample every analog pin in one pass
+void sampleAnalogPins(uint16_t * sample) {
+
+  for (uint8_t i = 0; i < NUMBER_ANALOG_PINS; i++) {
+    sample[i] = analogRead(i);
+  }
+}
+
+// Read a batch query such as batch?v=temperature,humidity&d=6,7&a=0,3,
+// resolving each item as it ends
+void process_batch(char c) {
+
+  // End of an item, of a list or of the query
+  if (c == ',' || c == '&' || c == ' ' || c == '/' || c == '\r' || c == '\n') {
+    if (answer_length > 0) {add_batch_item();}
+    answer_length = 0;
+    answer[0] = '\0';
+    if (c == '&') {batch_key = 0;}
+    if (c != ',' && c != '&') {state = 'x';}
+    return;
+  }
+
+  // Key of a list
+  if (c == '=') {
+    batch_key = answer_at(0);
+    answer_length = 0;
+    answer[0] = '\0';
+    return;
+  }
+
+  if (answer_length < REQUEST_BUFFER_SIZE - 1) {
+    answer[answer_length++] = c;
+    answer[answer_length] = '\0';
+  }
+}
+
+// Add the item held in the segment buffer to the batch
+void add_batch_item() {
+
+  if (batch_count == AREST_BATCH_SIZE) {return;}
+
+  // Variable
+  if (batch_key == 'v') {
+    uint8_t route = find_route(answer);
+    if (route == AREST_NO_ROUTE || route_kind(route) == AREST_ROUTE_FUNCTION) {return;}
+    batch_items[batch_count] = route;
+  }
+
+  // Answer format
+  else if (batch_key == 'f') {
+    request_format(answer[0]);
+    return;
+  }
+
+  #if defined(AREST_STREAM)
+  // Time between the events of a stream, and whether only changes are sent
+  else if (batch_key == 'i') {
+    stream_interval = strtoul(answer, NULL, 10);
+    return;
+  }
+  else if (batch_key == 'c') {
+    stream_changes = answer[0] == '1';
+    return;
+  }
+  #endif
+
+  // Digital or analog pin
+  else if (batch_key == 'd' || batch_key == 'a') {
+    const char * number = answer[0] == 'A' || answer[0] == 'D' ? answer + 1 : answer;
+    if (*number < '0' || *number > '9') {return;}
+    batch_items[batch_count] = atoi(number);
+  }
+
+  else {return;}
+
+  batch_types[batch_count] = batch_key;
+  batch_count++;
+}
+
+// Values of the variables & pins of a batch
+void addBatchItems() {
+
+  for (uint8_t i = 0; i < batch_count; i++) {
+    uint8_t item = batch_items[i];
+
+    if (batch_types[i] == 'v' && (enable_byte & AREST_ENB_VARIABLE)) {
+      addKey(route_name(item));
+      addVariableValue(item);
+    }
+    else if (batch_types[i] == 'd' && (enable_byte & AREST_ENB_DIGITAL_READ)) {
+      addKey('D', item);
+      addValue((long)digitalRead(item));
+    }
+    else if (batch_types[i] == 'a' && (enable_byte & AREST_ENB_ANALOG_READ)) {
+      addKey('A', item);
+      addValue((long)analogRead(item));
+    }
+  }
+}
+
+#if defined(AREST_STREAM)
+
+// Build the next event of a stream, after the headers for the first one: the
+// values of its batch as a data line, like the answer to the batch. Events
+// are built in the output buffer alone: one that outgrows it is dropped, and
+// output_dropped set. Returns false when only changes are sent and the data
+// didn't change.
+bool streamEvent() {
+
+  index = 0;
+  if (!stream_sent) {appendToBuffer(aREST_stream_headers, sizeof(aREST_stream_headers) - 1, true);}
+  uint16_t start = index;
+  addToBuffer(F("data: "));
+
+  // Text formats only, ended by a blank line instead of the line break
+  if (format == AREST_FORMAT_CBOR) {format = AREST_FORMAT_JSON;}
+  answer_begun = false;
+  beginAnswer();
+  addBatchItems();
+  endAnswer();
+  if (output_dropped) {return false;}
+  buffer[index - 2] = '\n';
+
+  uint32_t hash = 2166136261UL;
+  for (uint16_t i = start; i < index; i++) {
+    hash = (hash ^ (uint8_t)buffer[i]) * 16777619UL;
+  }
+  if (stream_sent && stream_changes && hash == stream_hash) {return false;}
+  stream_hash = hash;
+  stream_sent = true;
+  return true;
+}
+
+// Number of connections streaming
+uint8_t get_streams() {
+  return stream_count;
+}
+
+#endif
+
+// Character of the current segment, 0 past its end
+char answer_at(uint8_t i) {
+  return i < answer_length ? answer[i] : '\0';
+}
+
+bool send_command(bool headers) {
+
+	bool result = false;
+
+   if (command == 'u') {AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_NOT_UNDERSTOOD, 0, 0);}
+   else {AREST_TRACE(AREST_TRACE_INFO, AREST_TRACE_REQUEST, command, command == 'd' || command == 'a' || command == 'm' ? pin : value);}
+
+   // Start of message
+   if (headers) {send_http_headers();}
+
+   // Mode selected
+   if (command == 'm' && (enable_byte & (AREST_ENB_DIGITAL | AREST_ENB_ANALOG))){
+
+     // Input
+     if (state == 'i'){
+
+      // Set pin to Input
+      pinMode(pin,INPUT);
+     }
+
+     // Output
+     if (state == 'o'){
+
+       // Set to Output
+       pinMode(pin,OUTPUT);
+     }
+
+     // Send feedback to client
+     if (state == 'i' || state == 'o') {
+       beginAnswer();
+       beginText(F("message"));
+       addText(F("Pin D"));
+       addText(pin);
+       addText(state == 'i' ? F(" set to input") : F(" set to output"));
+       endText();
+     }
+	 result = true;
+
+   }
+
+   // Digital selected
+   if (command == 'd') {
+     if (state == 'r' && (enable_byte & AREST_ENB_DIGITAL_READ)){
+
+       // Read from pin
+       value = digitalRead(pin);
+
+       // Send answer
+       beginAnswer();
+       addKey(F("return_value"));
+       addValue((long)value);
+	  result = true;
+     }
+
+     #if !defined(__AVR_ATmega32U4__) || !defined(ADAFRUIT_CC3000_H)
+     if ((state == 'a' || state == 'p') && (enable_byte & AREST_ENB_DIGITAL_READ)) {
+
+       // Read all pins at once
+       uint8_t sample[AREST_DIGITAL_SAMPLE_SIZE];
+       sampleDigitalPins(sample);
+
+       beginAnswer();
+
+       // Packed: bitmask in hex, pin 0 being the lowest bit
+       if (state == 'p') {
+         char packed[(NUMBER_DIGITAL_PINS + 3) / 4 + 3] = "0x";
+         char * out = packed + 2;
+         for (int8_t n = (NUMBER_DIGITAL_PINS + 3) / 4 - 1; n >= 0; n--) {
+           uint8_t nibble = (sample[n >> 1] >> ((n & 1) * 4)) & 0x0F;
+           *out++ = nibble < 10 ? '0' + nibble : 'A' + nibble - 10;
+         }
+         *out = '\0';
+         addKey(F("digital"));
+         addValue(packed);
+       }
+
+       else {
+         for (uint8_t i = 0; i < NUMBER_DIGITAL_PINS; i++) {
+           addKey('D', i);
+           addValue((long)((sample[i >> 3] >> (i & 7)) & 0x01));
+         }
+       }
+	 result = true;
+    }
+    #endif
+
+     if (state == 'w' && (enable_byte & AREST_ENB_DIGITAL_WRITE)) {
+
+       // Disable analogWrite if ESP8266
+       #if defined(ESP8266)
+       analogWrite(pin, 0);
+       #endif
+
+       // Apply on the pin
+       digitalWrite(pin,value);
+
+       // Send feedback to client
+       beginAnswer();
+       beginText(F("message"));
+       addText(F("Pin D"));
+       addText(pin);
+       addText(F(" set to "));
+       addText(value);
+       endText();
+	   result = true;
+     }
+   }
+
+   // Analog selected
+   if (command == 'a') {
+     if (state == 'r' && (enable_byte & AREST_ENB_ANALOG_READ)){
+       // Read analog value
+       value = analogRead(pin);
+
+       // Send feedback to client
+       beginAnswer();
+       addKey(F("return_value"));
+       addValue((long)value);
+	   result = true;
      }
+     #if !defined(__AVR_ATmega32U4__)
+     if ((state == 'a' || state == 'p') && (enable_byte & AREST_ENB_ANALOG_READ)) {
+
+       // Read all pins in one pass, before formatting any of them
+       uint16_t sample[NUMBER_ANALOG_PINS];
+       sampleAnalogPins(sample);
+
+       beginAnswer();
+       if (state == 'p') {beginArray(F("analog"));}
+
+       for (uint8_t i = 0; i < NUMBER_ANALOG_PINS; i++) {
+
+         // Send feedback to client
+         if (state != 'p') {addKey('A', i);}
+         addValue((long)sample[i]);
+       }
+       if (state == 'p') {endArray();}
+	 result = true;
+   }
+   #endif
+   if (state == 'w' && (enable_byte & AREST_ENB_ANALOG_WRITE)) {
+
+     // Write output value
+     analogWrite(pin,value);
+
+     // Send feedback to client
+     beginAnswer();
+     beginText(F("message"));
+     addText(F("Pin D"));
+     addText(pin);
+     addText(F(" set to "));
+     addText(value);
+     endText();
+
+   }
+   result = true;
+  }
+
+  // Variable selected
+  if (command == 'v' && (enable_byte & AREST_ENB_VARIABLE)) {   
+
+       // Send feedback to client
+       beginAnswer();
+       addKey(int_variables_names[value]);
+       addValue((long)*int_variables[value]);
+	   result = true;
+  }
+
+  // Float variable selected (Mega only)
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  if (command == 'l' && (enable_byte & AREST_ENB_VARIABLE)) {          
+
+       // Send feedback to client
+       beginAnswer();
+       addKey(float_variables_names[value]);
+       addValue(*float_variables[value]);
+	   result = true;
+  }
+  #endif
+
+  // String variable selected (Mega & ESP8266 only)
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  if (command == 's' && (enable_byte & AREST_ENB_VARIABLE)) {          
+
+       // Send feedback to client
+       beginAnswer();
+       addKey(string_variables_names[value]);
+       addValue(*string_variables[value]);
+	   result = true;
+  }
+  #endif
+
+  // Function selected
+  if (command == 'f' && (enable_byte & AREST_ENB_FUNCTION)) {
+	  
+    // Start response...
+    beginAnswer();
+  
+    // Execute function
+    answer[arguments_offset + arguments_length] = '\0';
+    uint8_t retVal = functions[value](String(answer + arguments_offset));
+
+    // Send feedback to client, after the empty member JSON clients were
+    // always given
+    if (format == AREST_FORMAT_JSON) {addToBuffer(F(", "));}
+    addKey(F("return_value"));
+    addValue((long)retVal);
+	result = true;
+  }
+
+  // Batch of variables & pins, and streams answered once
+  if (command == 'b' || command == 'S') {
+    beginAnswer();
+    addBatchItems();
+	result = true;
+  }
+
+  if (command == 'r' || command == 'u') {
+    #if defined(AREST_RESPONSE_CACHE)
+    if (!cachedAnswer(AREST_CACHE_ROOT)) {
+      root_answer();
+      cacheAnswer(AREST_CACHE_ROOT);
+    }
+    #else
+    root_answer();
+    #endif
+	result = true;
+  }
+
+  #if defined(AREST_WAIT)
+  // Wait: the value waited on, and whether the condition was met
+  if (command == 'W') {
+    if (!wait_met) {wait_met = waitCondition();}
+    beginAnswer();
+    if (wait_type == 'v') {
+      addKey(route_name(wait_target));
+      addVariableValue(wait_target);
+    }
+    else {
+      addKey(wait_type == 'd' ? 'D' : 'A', wait_target);
+      addValue(waitValue());
+    }
+    addKey(F("met"));
+    addValue(wait_met);
+    result = true;
+  }
+  #endif
+
+  // Diagnostics are always JSON, and write the start of their answer
+  if (command == 'T' || command == 'M') {
+    format = AREST_FORMAT_JSON;
+    answer_begun = true;
+  }
+
+  #if AREST_TRACE_LEVEL > 0
+  if (command == 'T') {
+    trace_answer();
+    result = true;
+  }
+  #endif
+
+  #if defined(AREST_METRICS)
+  if (command == 'M') {
+    if (state == 'P') {metricsText();}
+    else {metrics_answer();}
+    result = true;
+  }
+  #endif
+
+  if (command == 'i') {
+    #if defined(AREST_RESPONSE_CACHE)
+    if (!cachedAnswer(AREST_CACHE_ID)) {
+      id_answer();
+      cacheAnswer(AREST_CACHE_ID);
+    }
+    #else
+    id_answer();
+    #endif
+	result = true;
+  }
+
+   // End of message
+   if (command != 'r' && command != 'u' && command != 'i' && !(command == 'M' && state == 'P')) {
+     endAnswer();
+   }
+
+   // End here
+   return result;
+}
+
+virtual void root_answer() {
+
+  #if defined(AREST_DELTA)
+  // Delta answer: an object in every format, with the sequence number of the
+  // last change. A sequence the board hasn't reached (it restarted since)
+  // asks for every variable.
+  if (delta) {
+    scanChanges();
+    if (format == AREST_FORMAT_LIGHT) {format = AREST_FORMAT_JSON;}
+    if (since > change_sequence) {since = 0;}
+  }
+  #endif
+
+  beginAnswer();
+
+  // Lightweight: the ID alone
+  if (format == AREST_FORMAT_LIGHT) {addValue(id);}
+  else {
+    beginObject(F("variables"));
+
+    // Int variables
+    for (uint8_t i = 0; i < variables_index; i++){
+      if (unchanged(AREST_ROUTE_INT, i)) {continue;}
+      addKey(int_variables_names[i]);
+      addValue((long)*int_variables[i]);
+    }
+
+    #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+    // String variables
+    for (uint8_t i = 0; i < string_variables_index; i++){
+      if (unchanged(AREST_ROUTE_STRING, i)) {continue;}
+      addKey(string_variables_names[i]);
+      addValue(*string_variables[i]);
+    }
+
+    // Float variables
+    for (uint8_t i = 0; i < float_variables_index; i++){
+      if (unchanged(AREST_ROUTE_FLOAT, i)) {continue;}
+      addKey(float_variables_names[i]);
+      addValue(*float_variables[i]);
+    }
+    #endif
+
+    endObject();
+
+    #if defined(AREST_DELTA)
+    if (delta) {
+      addKey(F("sequence"));
+      addValue((long)change_sequence);
+    }
+    #endif
+  }
+
+  // End
+  endAnswer();
+}
+
+void id_answer() {
+
+  beginAnswer();
+  if (format == AREST_FORMAT_LIGHT) {addValue(id);}
+  endAnswer();
+}
+
+// End of every answer: data about the board, rendered again after the ID
+// or name changed
+void addTrailerToBuffer() {
+
+  if (trailer_length == 0) {
+
+    strcpy_P(trailer, PSTR("\"id\": \""));
+    strcat(trailer, id);
+    strcat_P(trailer, PSTR("\", \"name\": \""));
+    strcat(trailer, name);
+    #if !defined(PubSubClient_h)
+    strcat_P(trailer, PSTR("\", \"hardware\": \"" HARDWARE));
+    #endif
+    strcat_P(trailer, PSTR("\", \"connected\": true}\r\n"));
+    trailer_length = strlen(trailer);
+  }
+
+  appendToBuffer(trailer, trailer_length);
+}
+
+// Answer serializer: send_command() & root_answer() describe an answer as
+// keys & values, written in the format of the request. JSON members of the
+// answer object end with ", " as the trailer follows them, those of nested
+// objects & arrays are separated; lightweight answers are the values alone,
+// separated by commas; CBOR answers are maps of indefinite length.
+void beginAnswer() {
+
+  answer_begun = true;
+  answer_depth = 0;
+  answer_first = true;
+  answer_keyed = false;
+  if (format == AREST_FORMAT_JSON) {addToBuffer(F("{"));}
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(5, 31);}
+  #endif
+}
+
+// End of the answer: data about the board, or a line end for lightweight ones
+void endAnswer() {
+
+  if (format == AREST_FORMAT_LIGHT) {
+    addToBuffer(F("\r\n"));
+    return;
+  }
+  if (!answer_begun) {beginAnswer();}
+
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {
+    addKey(F("id"));
+    addValue(id);
+    addKey(F("name"));
+    addValue(name);
+    #if !defined(PubSubClient_h)
+    addKey(F("hardware"));
+    addValue(HARDWARE);
+    #endif
+    addKey(F("connected"));
+    addCborHead(7, 21);
+    addCborHead(7, 31);
+    return;
+  }
+  #endif
+  addTrailerToBuffer();
+}
+
+// Key of the next value
+void addKey(const char * key, uint16_t length, bool progmem) {
+
+  if (format == AREST_FORMAT_JSON) {
+    addToBuffer(answer_depth > 0 && !answer_first ? F(", \"") : F("\""));
+    appendToBuffer(key, length, progmem);
+    addToBuffer(F("\": "));
+    answer_first = false;
+  }
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {
+    addCborHead(3, length);
+    appendToBuffer(key, length, progmem);
+  }
+  #endif
+  answer_keyed = true;
+}
+
+void addKey(const char * key) {
+
+  addKey(key, strlen(key), false);
+}
+
+void addKey(const __FlashStringHelper * key) {
+
+  addKey((PGM_P)key, strlen_P((PGM_P)key), true);
+}
+
+// Key made of a letter & a pin number, like D6
+void addKey(char prefix, uint8_t number) {
+
+  char key[5] = {prefix};
+  uint8_t digits = countDigits(number);
+  writeDigits(key + 1 + digits, number);
+  addKey(key, 1 + digits, false);
+}
+
+// Before & after each value: separators of lists & of the members of the answer
+void beginValue() {
+
+  if (format == AREST_FORMAT_LIGHT && !answer_first) {addToBuffer(F(","));}
+  if (format == AREST_FORMAT_JSON && !answer_keyed && !answer_first) {addToBuffer(F(", "));}
+  answer_first = false;
+  answer_keyed = false;
+}
+
+void endValue() {
+
+  if (format == AREST_FORMAT_JSON && answer_depth == 0) {addToBuffer(F(", "));}
+}
+
+void addValue(long value) {
+
+  beginValue();
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {
+    if (value < 0) {addCborHead(1, -1 - value);}
+    else {addCborHead(0, value);}
+  }
+  else
+  #endif
+  addToBuffer(value);
+  endValue();
+}
+
+void addValue(bool value) {
+
+  beginValue();
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(7, value ? 21 : 20);}
+  else
+  #endif
+  addToBuffer(value ? F("true") : F("false"));
+  endValue();
+}
+
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+void addValue(float value) {
+
+  beginValue();
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {
+    uint32_t bits;
+    memcpy(&bits, &value, 4);
+    uint8_t bytes[5] = {0xFA, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits};
+    appendToBuffer((const char *)bytes, 5);
+  }
+  else
+  #endif
+  addToBuffer(value);
+  endValue();
+}
+
+void addValue(const String& value) {
+
+  addValue(value.c_str(), value.length());
+}
+#endif
+
+void addValue(const char * value) {
+
+  addValue(value, strlen(value));
+}
+
+void addValue(const char * value, uint16_t length) {
+
+  beginValue();
+  if (format == AREST_FORMAT_JSON) {addToBuffer(F("\""));}
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(3, length);}
+  #endif
+  appendToBuffer(value, length);
+  if (format == AREST_FORMAT_JSON) {addToBuffer(F("\""));}
+  endValue();
+}
+
+// Value of a variable, from its route
+void addVariableValue(uint8_t route) {
 
-     #if !defined(__AVR_ATmega32U4__) || !defined(ADAFRUIT_CC3000_H)
-     if (state == 'a' && (enable_byte & AREST_ENB_DIGITAL_READ)) {
-       if (!LIGHTWEIGHT) {addToBuffer(F("{"));}
+  uint8_t i = route_position(route);
+  if (route_kind(route) == AREST_ROUTE_INT) {addValue((long)*int_variables[i]);}
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  if (route_kind(route) == AREST_ROUTE_FLOAT) {addValue(*float_variables[i]);}
+  if (route_kind(route) == AREST_ROUTE_STRING) {addValue(*string_variables[i]);}
+  #endif
+}
 
-       for (uint8_t i = 0; i < NUMBER_DIGITAL_PINS; i++) {
+// Object or array as the next value
+void beginObject(const __FlashStringHelper * key) {
 
-         // Read analog value
-         value = digitalRead(i);
+  addKey(key);
+  beginValue();
+  if (format == AREST_FORMAT_JSON) {addToBuffer(F("{"));}
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(5, 31);}
+  #endif
+  answer_depth++;
+  answer_first = true;
+}
 
-         // Send feedback to client
-         if (LIGHTWEIGHT){
-           addToBuffer(value);
-           addToBuffer(F(","));
-         }
-         else {
-           addToBuffer(F("\"D"));
-           addToBuffer(i);
-           addToBuffer(F("\": "));
-           addToBuffer(value);
-           addToBuffer(F(", "));
-         }
-     }
-	 result = true;
-    }
-    #endif
+void endObject() {
 
-     if (state == 'w' && (enable_byte & AREST_ENB_DIGITAL_WRITE)) {
+  answer_depth--;
+  if (format == AREST_FORMAT_JSON) {addToBuffer(answer_first ? F(" }") : F("}"));}
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(7, 31);}
+  #endif
+  answer_first = false;
+  endValue();
+}
 
-       // Disable analogWrite if ESP8266
-       #if defined(ESP8266)
-       analogWrite(pin, 0);
-       #endif
+void beginArray(const __FlashStringHelper * key) {
 
-       // Apply on the pin
-       digitalWrite(pin,value);
+  addKey(key);
+  beginValue();
+  if (format == AREST_FORMAT_JSON) {addToBuffer(F("["));}
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(4, 31);}
+  #endif
+  answer_depth++;
+  answer_first = true;
+}
 
-       // Send feedback to client
-       if (!LIGHTWEIGHT){
-        addToBuffer(F("{\"message\": \"Pin D"));
-        addToBuffer(pin);
-        addToBuffer(F(" set to "));
-        addToBuffer(value);
-        addToBuffer(F("\", "));
-       }
-	   result = true;
-     }
-   }
+void endArray() {
 
-   // Analog selected
-   if (command == 'a') {
-     if (state == 'r' && (enable_byte & AREST_ENB_ANALOG_READ)){
-       // Read analog value
-       value = analogRead(pin);
+  answer_depth--;
+  if (format == AREST_FORMAT_JSON) {addToBuffer(F("]"));}
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(7, 31);}
+  #endif
+  answer_first = false;
+  endValue();
+}
 
-       // Send feedback to client
-       if (LIGHTWEIGHT){addToBuffer(value);}
-       else {
-        addToBuffer(F("{\"return_value\": "));
-        addToBuffer(value);
-        addToBuffer(F(", "));
-       }
-	   result = true;
-     }
-     #if !defined(__AVR_ATmega32U4__)
-     if (state == 'a' && (enable_byte & AREST_ENB_ANALOG_READ)) {
-       if (!LIGHTWEIGHT) {addToBuffer(F("{"));}
+// Text value written a piece at a time, such as a message. Lightweight
+// answers leave messages out.
+void beginText(const __FlashStringHelper * key) {
 
-       for (uint8_t i = 0; i < NUMBER_ANALOG_PINS; i++) {
+  if (format == AREST_FORMAT_LIGHT) {return;}
+  addKey(key);
+  beginValue();
+  if (format == AREST_FORMAT_JSON) {addToBuffer(F("\""));}
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(3, 31);}
+  #endif
+}
 
-         // Read analog value
-         value = analogRead(i);
+void addText(const __FlashStringHelper * text) {
 
-         // Send feedback to client
-         if (LIGHTWEIGHT){
-           addToBuffer(value);
-           addToBuffer(F(","));
-         }
-         else {
-           addToBuffer(F("\"A"));
-           addToBuffer(i);
-           addToBuffer(F("\": "));
-           addToBuffer(value);
-           addToBuffer(F(", "));
-         }
-     }
-	 result = true;
-   }
-   #endif
-   if (state == 'w' && (enable_byte & AREST_ENB_ANALOG_WRITE)) {
+  if (format == AREST_FORMAT_LIGHT) {return;}
+  uint16_t length = strlen_P((PGM_P)text);
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(3, length);}
+  #endif
+  appendToBuffer((PGM_P)text, length, true);
+}
 
-     // Write output value
-     analogWrite(pin,value);
+void addText(uint16_t number) {
 
-     // Send feedback to client
-     addToBuffer(F("{\"message\": \"Pin D"));
-     addToBuffer(pin);
-     addToBuffer(F(" set to "));
-     addToBuffer(value);
-     addToBuffer(F("\", "));
+  if (format == AREST_FORMAT_LIGHT) {return;}
+  char text[5];
+  uint8_t length = countDigits(number);
+  writeDigits(text + length, number);
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(3, length);}
+  #endif
+  appendToBuffer(text, length);
+}
 
-   }
-   result = true;
+void endText() {
+
+  if (format == AREST_FORMAT_LIGHT) {return;}
+  if (format == AREST_FORMAT_JSON) {addToBuffer(F("\""));}
+  #if defined(AREST_CBOR)
+  if (format == AREST_FORMAT_CBOR) {addCborHead(7, 31);}
+  #endif
+  endValue();
+}
+
+#if defined(AREST_CBOR)
+// Head of a CBOR item: major type & argument, 31 for the items of
+// indefinite length & their end
+void addCborHead(uint8_t major, uint32_t argument) {
+
+  uint8_t head[5] = {(uint8_t)(major << 5)};
+  uint8_t length = 1;
+  if (argument < 24 || argument == 31) {head[0] |= argument;}
+  else if (argument <= 0xFF) {
+    head[0] |= 24;
+    head[length++] = argument;
+  }
+  else if (argument <= 0xFFFF) {
+    head[0] |= 25;
+    head[length++] = argument >> 8;
+    head[length++] = argument;
+  }
+  else {
+    head[0] |= 26;
+    head[length++] = argument >> 24;
+    head[length++] = argument >> 16;
+    head[length++] = argument >> 8;
+    head[length++] = argument;
   }
+  appendToBuffer((const char *)head, length);
+}
+#endif
 
-  // Variable selected
-  if (command == 'v' && (enable_byte & AREST_ENB_VARIABLE)) {   
+// Ask for an answer format, from the first letter of its name
+void request_format(char name) {
 
-       // Send feedback to client
-       if (LIGHTWEIGHT){addToBuffer(*int_variables[value]);}
-       else {
-        addToBuffer(F("{\""));
-        addToBuffer(int_variables_names[value]);
-        addToBuffer(F("\": "));
-        addToBuffer(*int_variables[value]);
-        addToBuffer(F(", "));
-       }
-	   result = true;
+  if (name == 'j') {format = AREST_FORMAT_JSON;}
+  if (name == 'l') {format = AREST_FORMAT_LIGHT;}
+  #if defined(AREST_CBOR)
+  if (name == 'c') {format = AREST_FORMAT_CBOR;}
+  #endif
+}
+
+// Whether the '=' at p ends the given key of a query
+static bool queryKey(const char * query, const char * p, PGM_P key, uint8_t length) {
+  return p - query > length && strncmp_P(p - length, key, length) == 0
+    && (p[-length - 1] == '?' || p[-length - 1] == '&');
+}
+
+// Parameters of a query: format of the answer (fmt), sequence number a
+// delta answer starts after (since), and condition of a wait (op, value &
+// timeout)
+void query_parameters(const char * query) {
+
+  for (const char * p = strchr(query, '='); p != NULL; p = strchr(p + 1, '=')) {
+    if (queryKey(query, p, PSTR("fmt"), 3)) {request_format(p[1]);}
+    #if defined(AREST_DELTA)
+    if (queryKey(query, p, PSTR("since"), 5)) {
+      delta = true;
+      since = strtoul(p + 1, NULL, 10);
+    }
+    #endif
+    #if defined(AREST_WAIT)
+    if (command == 'W') {
+      if (queryKey(query, p, PSTR("op"), 2)) {wait_op = waitOperator(p + 1);}
+      if (queryKey(query, p, PSTR("value"), 5)) {
+        wait_int = strtol(p + 1, NULL, 10);
+        #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+        wait_float = atof(p + 1);
+        #endif
+      }
+      if (queryKey(query, p, PSTR("timeout"), 7)) {wait_timeout = strtoul(p + 1, NULL, 10);}
+    }
+    #endif
   }
+}
 
-  // Float variable selected (Mega only)
-  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
-  if (command == 'l' && (enable_byte & AREST_ENB_VARIABLE)) {          
+#if defined(AREST_WAIT)
 
-       // Send feedback to client
-       if (LIGHTWEIGHT){addToBuffer(*float_variables[value]);}
-       else {
-        addToBuffer(F("{\""));
-        addToBuffer(float_variables_names[value]);
-        addToBuffer(F("\": "));
-        addToBuffer(*float_variables[value]);
-        addToBuffer(F(", "));
-       }
-	   result = true;
+// Comparison of a wait, from its name
+static uint8_t waitOperator(const char * name) {
+
+  PGM_P names = PSTR("eqnegtgeltle");
+  for (uint8_t i = 0; i < 6; i++) {
+    if (name[0] == (char)pgm_read_byte(names + 2 * i) && name[1] == (char)pgm_read_byte(names + 2 * i + 1)) {
+      return AREST_WAIT_EQ + i;
+    }
+  }
+  return AREST_WAIT_CHANGE;
+}
+
+// What a wait is on: a variable, or a digital (D6) or analog (A0) pin that
+// can be read. Anything else is answered like an unknown route.
+void waitTarget() {
+
+  pin_selected = true;
+  state = 'x';
+
+  uint8_t route = find_route(answer);
+  if (route != AREST_NO_ROUTE && route_kind(route) != AREST_ROUTE_FUNCTION && (enable_byte & AREST_ENB_VARIABLE)) {
+    wait_type = 'v';
+    wait_target = route;
+    if (route_kind(route) == AREST_ROUTE_STRING) {wait_op = AREST_WAIT_CHANGE;}
+  }
+  else if (answer[0] == 'D' && answer[1] >= '0' && answer[1] <= '9' && (enable_byte & AREST_ENB_DIGITAL_READ)) {
+    wait_type = 'd';
+    wait_target = atoi(answer + 1);
   }
+  else if (answer[0] == 'A' && answer[1] >= '0' && answer[1] <= '9' && (enable_byte & AREST_ENB_ANALOG_READ)) {
+    wait_type = 'a';
+    wait_target = atoi(answer + 1);
+  }
+  else {
+    command = 'u';
+    return;
+  }
+
+  // Waiting for a change: compared to the value now
+  wait_start = millis();
+  if (wait_op == AREST_WAIT_CHANGE) {
+    wait_int = waitValue();
+    #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+    if (wait_type == 'v' && route_kind(route) == AREST_ROUTE_FLOAT) {wait_float = *float_variables[route_position(route)];}
+    #endif
+  }
+}
+
+// Value waited on, but float variables: strings by their hash
+long waitValue() {
+
+  if (wait_type == 'd') {return digitalRead(wait_target);}
+  if (wait_type == 'a') {return analogRead(wait_target);}
+  uint8_t i = route_position(wait_target);
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  if (route_kind(wait_target) == AREST_ROUTE_STRING) {return (long)stringHash(*string_variables[i]);}
   #endif
+  return route_kind(wait_target) == AREST_ROUTE_INT ? *int_variables[i] : 0;
+}
 
-  // String variable selected (Mega & ESP8266 only)
+// Whether the condition of a wait holds
+bool waitCondition() {
+
+  int8_t order;
   #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
-  if (command == 's' && (enable_byte & AREST_ENB_VARIABLE)) {          
+  if (wait_type == 'v' && route_kind(wait_target) == AREST_ROUTE_FLOAT) {
+    float current = *float_variables[route_position(wait_target)];
+    order = current < wait_float ? -1 : (current > wait_float ? 1 : 0);
+  }
+  else
+  #endif
+  {
+    long current = waitValue();
+    order = current < wait_int ? -1 : (current > wait_int ? 1 : 0);
+  }
 
-       // Send feedback to client
-       if (LIGHTWEIGHT){addToBuffer(*string_variables[value]);}
-       else {
-        addToBuffer(F("{\""));
-        addToBuffer(string_variables_names[value]);
-        addToBuffer(F("\": \""));
-        addToBuffer(*string_variables[value]);
-        addToBuffer(F("\", "));
-       }
-	   result = true;
+  switch (wait_op) {
+    case AREST_WAIT_EQ: return order == 0;
+    case AREST_WAIT_GT: return order > 0;
+    case AREST_WAIT_GE: return order >= 0;
+    case AREST_WAIT_LT: return order < 0;
+    case AREST_WAIT_LE: return order <= 0;
+  }
+  return order != 0;
+}
+
+// Whether a wait is over: its condition holds, or it timed out
+bool waitOver() {
+
+  wait_met = waitCondition();
+  return wait_met || millis() - wait_start >= wait_timeout;
+}
+
+#endif
+
+// Default answer format, for requests that don't ask for one
+void set_format(uint8_t answer_format) {
+
+  default_format = answer_format;
+  format = answer_format;
+  touch();
+}
+
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+// FNV-1a hash of a String & its length
+static uint32_t stringHash(const String& value) {
+  uint32_t hash = 2166136261UL ^ value.length();
+  const char * c = value.c_str();
+  for (unsigned int i = 0; i < value.length(); i++) {
+    hash = (hash ^ (uint8_t)c[i]) * 16777619UL;
   }
+  return hash;
+}
+#endif
+
+#if defined(AREST_RESPONSE_CACHE)
+
+// Copy a cached answer to the buffer; on a miss, start recording the answer
+// about to be built
+bool cachedAnswer(uint8_t entry) {
+
+  cache_start = AREST_CACHE_NOT_RECORDING;
+  if (cache_mode == AREST_CACHE_OFF || format != default_format) {return false;}
+  #if defined(AREST_DELTA)
+  if (delta) {return false;}
   #endif
+  if (entry == AREST_CACHE_ROOT && cache_mode == AREST_CACHE_SNAPSHOT && variablesChanged()) {
+    cache_lengths[AREST_CACHE_ROOT] = 0;
+  }
 
-  // Function selected
-  if (command == 'f' && (enable_byte & AREST_ENB_FUNCTION)) {
-	  
-    // Start response...
-    if (!LIGHTWEIGHT) { 
-	  addToBuffer(F("{"));
-	}
-  
-    // Execute function
-    uint8_t retVal = functions[value](arguments);
-
-    // Send feedback to client
-    if (!LIGHTWEIGHT) {
-     addToBuffer(F(", "));
-     addToBuffer(F("\"return_value\": "));
-     addToBuffer(retVal);
-     addToBuffer(F(", "));
-     //addToBuffer(F(", \"message\": \""));
-     //addToBuffer(functions_names[value]);
-     //addToBuffer(F(" executed\", "));
+  if (cache_lengths[entry] > 0) {
+    appendToBuffer(entry == AREST_CACHE_ROOT ? cache_root : cache_id, cache_lengths[entry]);
+    return true;
+  }
+
+  cache_start = index;
+  return false;
+}
+
+// Keep the answer just built, unless part of it was already sent
+void cacheAnswer(uint8_t entry) {
+
+  if (cache_start == AREST_CACHE_NOT_RECORDING) {return;}
+  uint16_t length = index - cache_start;
+  if (length > 0 && length <= (entry == AREST_CACHE_ROOT ? AREST_CACHE_SIZE : AREST_CACHE_ID_SIZE)) {
+    memcpy(entry == AREST_CACHE_ROOT ? cache_root : cache_id, buffer + cache_start, length);
+    cache_lengths[entry] = length;
+  }
+  cache_start = AREST_CACHE_NOT_RECORDING;
+}
+
+// Compare the variables to their last snapshot, and take a new one
+bool variablesChanged() {
+
+  bool changed = false;
+
+  for (uint8_t i = 0; i < variables_index; i++) {
+    if (int_snapshot[i] != *int_variables[i]) {
+      int_snapshot[i] = *int_variables[i];
+      changed = true;
     }
-	result = true;
   }
 
-  if (command == 'r' || command == 'u') {
-    root_answer();
-	result = true;
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  for (uint8_t i = 0; i < float_variables_index; i++) {
+    if (memcmp(&float_snapshot[i], float_variables[i], sizeof(float)) != 0) {
+      float_snapshot[i] = *float_variables[i];
+      changed = true;
+    }
   }
 
-  if (command == 'i') {
-    if (LIGHTWEIGHT) {addToBuffer(id);}
-    else {
-      addToBuffer(F("{"));
+  for (uint8_t i = 0; i < string_variables_index; i++) {
+    uint32_t hash = stringHash(*string_variables[i]);
+    if (string_snapshot[i] != hash) {
+      string_snapshot[i] = hash;
+      changed = true;
     }
-	result = true;
   }
+  #endif
 
-   // End of message
-   if (LIGHTWEIGHT){
-     addToBuffer(F("\r\n"));
-   }
+  return changed;
+}
 
-   else {
+// Choose how changes of the variables are found
+void set_cache(uint8_t mode) {
+  cache_mode = mode;
+  touch();
+}
 
-     if (command != 'r' && command != 'u') {
-       addToBuffer(F("\"id\": \""));
-       addToBuffer(this->id);
-       addToBuffer(F("\", \"name\": \""));
-       addToBuffer(name);
-       #if !defined(PubSubClient_h)
-       addToBuffer(F("\", \"hardware\": \""));
-       addToBuffer(HARDWARE);
-       #endif
-       addToBuffer(F("\", \"connected\": true}\r\n"));
-     }
-   }
+// Rebuild the cached answers on the next request
+void touch() {
+  cache_lengths[AREST_CACHE_ROOT] = 0;
+  cache_lengths[AREST_CACHE_ID] = 0;
+}
 
-   if (DEBUG_MODE) {
-     #if defined(ESP8266)
-     Serial.print("Memory loss:");
-     Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-     freeMemory = ESP.getFreeHeap();
-     #endif
-     Serial.print(F("State of buffer at the end: "));
-     Serial.println(buffer);
-   }
+#else
 
-   // End here
-   return result;
+// Without the cache, every answer is rebuilt anyway
+void touch() {}
+
+#endif
+
+// After a variable changed: rebuild the root answer on the next request, and
+// give the change a sequence number for delta answers
+void touch(int * variable) {
+  for (uint8_t i = 0; i < variables_index; i++) {
+    if (int_variables[i] == variable) {variableChanged(AREST_ROUTE_INT, i);}
+  }
 }
 
-virtual void root_answer() {
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+void touch(float * variable) {
+  for (uint8_t i = 0; i < float_variables_index; i++) {
+    if (float_variables[i] == variable) {variableChanged(AREST_ROUTE_FLOAT, i);}
+  }
+}
 
-  #if defined(ADAFRUIT_CC3000_H) || defined(ESP8266) || defined(ethernet_h) || defined(WiFi_h)
-    #if !defined(PubSubClient_h)
-      if (command != 'u') {
-        addToBuffer(F("HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nAccess-Control-Allow-Methods: POST, GET, PUT, OPTIONS\r\nContent-Type: application/json\r\nConnection: close\r\n\r\n"));
-      }
-    #endif
+void touch(String * variable) {
+  for (uint8_t i = 0; i < string_variables_index; i++) {
+    if (string_variables[i] == variable) {variableChanged(AREST_ROUTE_STRING, i);}
+  }
+}
+#endif
+
+void variableChanged(uint8_t kind, uint8_t i) {
+
+  (void)kind;
+  (void)i;
+  #if defined(AREST_RESPONSE_CACHE)
+  cache_lengths[AREST_CACHE_ROOT] = 0;
   #endif
+  #if defined(AREST_DELTA)
+  markChanged(kind, i);
+  #endif
+}
 
-  if (LIGHTWEIGHT) {addToBuffer(id);}
-  else {
+#if defined(AREST_DELTA)
 
-    // Start
-    addToBuffer(F("{\"variables\": {"));
+// Give a change of a variable the next sequence number; its value is the one
+// later compared to
+void markChanged(uint8_t kind, uint8_t i) {
 
-    #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  change_sequence++;
+  if (kind == AREST_ROUTE_INT) {
+    int_changes[i] = change_sequence;
+    int_reference[i] = *int_variables[i];
+  }
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  if (kind == AREST_ROUTE_FLOAT) {
+    float_changes[i] = change_sequence;
+    float_reference[i] = *float_variables[i];
+  }
+  if (kind == AREST_ROUTE_STRING) {
+    string_changes[i] = change_sequence;
+    string_reference[i] = stringHash(*string_variables[i]);
+  }
+  #endif
+}
+
+// Find the variables changed since their last change, comparing them to the
+// value they had then
+void scanChanges() {
+
+  for (uint8_t i = 0; i < variables_index; i++) {
+    if (int_reference[i] != *int_variables[i]) {markChanged(AREST_ROUTE_INT, i);}
+  }
+
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  for (uint8_t i = 0; i < float_variables_index; i++) {
+    if (memcmp(&float_reference[i], float_variables[i], sizeof(float)) != 0) {markChanged(AREST_ROUTE_FLOAT, i);}
+  }
+
+  for (uint8_t i = 0; i < string_variables_index; i++) {
+    if (string_reference[i] != stringHash(*string_variables[i])) {markChanged(AREST_ROUTE_STRING, i);}
+  }
+  #endif
+}
+
+// Whether a delta answer leaves a variable out
+bool unchanged(uint8_t kind, uint8_t i) {
+
+  if (!delta) {return false;}
+  if (kind == AREST_ROUTE_INT) {return int_changes[i] <= since;}
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  if (kind == AREST_ROUTE_FLOAT) {return float_changes[i] <= since;}
+  if (kind == AREST_ROUTE_STRING) {return string_changes[i] <= since;}
+  #endif
+  return false;
+}
+
+// Sequence number of the last change of a variable
+uint32_t get_sequence() {
+  scanChanges();
+  return change_sequence;
+}
+
+#else
+
+bool unchanged(uint8_t, uint8_t) {return false;}
+
+#endif
+
+// Free memory, where it is known
+static uint32_t freeHeap() {
+  #if defined(ESP8266)
+  return ESP.getFreeHeap();
+  #elif defined(__AVR__)
+  extern char __heap_start;
+  extern char * __brkval;
+  char top;
+  return &top - (__brkval == NULL ? &__heap_start : __brkval);
+  #else
+  return 0;
+  #endif
+}
+
+#if AREST_TRACE_LEVEL > 0
+
+// Record an event in the trace, over the oldest one once it is full
+void trace(uint8_t event, uint8_t a, uint16_t b) {
+
+  aRESTTraceRecord& record = trace_records[trace_next];
+  record.time = micros();
+  record.event = event;
+  record.a = a;
+  record.b = b;
+  trace_next = (trace_next + 1) % AREST_TRACE_SIZE;
+  if (trace_count < AREST_TRACE_SIZE) {trace_count++;}
+}
+
+// Trace as JSON, oldest event first: [time, event, a, b] for each of them
+void trace_answer() {
+
+  addToBuffer(F("{\"trace\": ["));
+  uint8_t record = (trace_next + AREST_TRACE_SIZE - trace_count) % AREST_TRACE_SIZE;
+  for (uint8_t i = 0; i < trace_count; i++) {
+    addToBuffer(i == 0 ? F("[") : F(", ["));
+    addToBuffer((unsigned long)trace_records[record].time);
+    addToBuffer(F(", "));
+    addToBuffer(trace_records[record].event);
+    addToBuffer(F(", "));
+    addToBuffer(trace_records[record].a);
+    addToBuffer(F(", "));
+    addToBuffer(trace_records[record].b);
+    addToBuffer(F("]"));
+    record = (record + 1) % AREST_TRACE_SIZE;
+  }
+  addToBuffer(F("], "));
+}
+
+// Forget the events recorded so far
+void clear_trace() {
+  trace_count = 0;
+}
+
+#endif
+
+#if defined(AREST_METRICS)
+
+// Count the bytes of requests read, and of answers sent
+void countBytesIn(uint16_t count) {
+  metric_bytes_in += count;
+}
+
+void countBytesOut(uint16_t count) {
+  metric_bytes_out += count;
+  if (count > metric_buffer_max) {metric_buffer_max = count;}
+}
+
+// Count the request just answered in the histogram of its route, or as an
+// error if it wasn't understood
+void recordRequest() {
+
+  if (!request_started) {return;}
+  uint32_t elapsed = micros() - request_start;
+  if (index > metric_buffer_max) {metric_buffer_max = index;}
+
+  // Free memory when metrics were first recorded
+  if (metric_heap_start == 0) {metric_heap_start = freeHeap();}
 
-    // Int variables
-    if (variables_index == 0 && string_variables_index == 0 && float_variables_index == 0){
-      addToBuffer(F(" }, "));
-    }
-    else {
+  uint16_t slot = metricSlot();
+  if (slot == AREST_METRIC_NONE) {
+    metric_errors++;
+    return;
+  }
+  uint8_t bucket = 0;
+  while (bucket < AREST_METRIC_BUCKETS - 1 && elapsed > pgm_read_dword(&aREST_metric_bounds[bucket])) {bucket++;}
+  metric_buckets[slot][bucket]++;
+  metric_sums[slot] += elapsed;
+}
 
-      if (variables_index > 0){
+// Metrics slot of the request parsed
+uint16_t metricSlot() {
+  switch (command) {
+    case 'r': return AREST_METRIC_ROOT;
+    case 'i': return AREST_METRIC_ID;
+    case 'd': return AREST_METRIC_DIGITAL;
+    case 'a': return AREST_METRIC_ANALOG;
+    case 'm': return AREST_METRIC_MODE;
+    case 'b': return AREST_METRIC_BATCH;
+    case 'S': return AREST_METRIC_BATCH;
+    case 'M': return AREST_METRIC_METRICS;
+    case 'T': return AREST_METRIC_TRACE;
+    case 'W': return AREST_METRIC_WAIT;
+    case 'f': return AREST_METRIC_ROUTES + value;
+    case 'v': return AREST_METRIC_ROUTES + NUMBER_FUNCTIONS + value;
+    case 'l': return AREST_METRIC_ROUTES + NUMBER_FUNCTIONS + NUMBER_VARIABLES + value;
+    case 's': return AREST_METRIC_ROUTES + NUMBER_FUNCTIONS + 2 * NUMBER_VARIABLES + value;
+  }
+  return AREST_METRIC_NONE;
+}
 
-        for (uint8_t i = 0; i < variables_index; i++){
-          addToBuffer(F("\""));
-          addToBuffer(int_variables_names[i]);
-          addToBuffer(F("\": "));
-          addToBuffer(*int_variables[i]);
-          addToBuffer(F(", "));
-        }
+// Add the name of the route of a metrics slot to the buffer
+void addMetricName(uint16_t slot) {
 
-      }
-      if (string_variables_index > 0){
-
-        for (uint8_t i = 0; i < string_variables_index; i++){
-          addToBuffer(F("\""));
-          addToBuffer(string_variables_names[i]);
-          addToBuffer(F("\": \""));
-          addToBuffer(*string_variables[i]);
-          addToBuffer(F("\", "));
-        }
+  if (slot < AREST_METRIC_ROUTES) {
+    PGM_P name = aREST_metric_names;
+    for (uint8_t i = 0; i < slot; i++) {name += strlen_P(name) + 1;}
+    appendToBuffer(name, strlen_P(name), true);
+    return;
+  }
 
-      }
-      if (float_variables_index > 0){
-
-        for (uint8_t i = 0; i < float_variables_index; i++){
-          addToBuffer(F("\""));
-          addToBuffer(float_variables_names[i]);
-          addToBuffer(F("\": "));
-          addToBuffer(*float_variables[i]);
-          addToBuffer(F(", "));
-        }
+  // Route of a function or variable
+  uint16_t position = slot - AREST_METRIC_ROUTES;
+  uint8_t kind = AREST_ROUTE_FUNCTION;
+  if (position >= NUMBER_FUNCTIONS) {
+    position -= NUMBER_FUNCTIONS;
+    kind = AREST_ROUTE_INT + position / NUMBER_VARIABLES;
+    position = position % NUMBER_VARIABLES;
+  }
+  addToBuffer(route_name((kind << 6) | (position + 1)));
+}
 
-      }
-      removeLastBufferChar();
-      removeLastBufferChar();
-      addToBuffer(F("}, "));
+// Requests counted in a metrics slot
+uint32_t metricCount(uint16_t slot) {
+  uint32_t count = 0;
+  for (uint8_t i = 0; i < AREST_METRIC_BUCKETS; i++) {count += metric_buckets[slot][i];}
+  return count;
+}
 
+// Metrics as JSON: totals, then [count, total µs, requests in each bucket]
+// for each route requested so far
+void metrics_answer() {
+
+  uint32_t requests = metric_errors;
+  for (uint16_t slot = 0; slot < AREST_METRIC_SLOTS; slot++) {requests += metricCount(slot);}
+
+  addToBuffer(F("{\"metrics\": {\"requests\": "));
+  addToBuffer((unsigned long)requests);
+  addToBuffer(F(", \"errors\": "));
+  addToBuffer((unsigned long)metric_errors);
+  addToBuffer(F(", \"bytes_in\": "));
+  addToBuffer((unsigned long)metric_bytes_in);
+  addToBuffer(F(", \"bytes_out\": "));
+  addToBuffer((unsigned long)metric_bytes_out);
+  addToBuffer(F(", \"buffer_max\": "));
+  addToBuffer(metric_buffer_max);
+  addToBuffer(F(", \"heap_delta\": "));
+  addToBuffer(heapDelta());
+  addToBuffer(F(", \"buckets\": ["));
+  for (uint8_t i = 0; i < AREST_METRIC_BUCKETS - 1; i++) {
+    if (i > 0) {addToBuffer(F(", "));}
+    addToBuffer((unsigned long)pgm_read_dword(&aREST_metric_bounds[i]));
+  }
+  addToBuffer(F("], \"routes\": {"));
+
+  bool first = true;
+  for (uint16_t slot = 0; slot < AREST_METRIC_SLOTS; slot++) {
+    uint32_t count = metricCount(slot);
+    if (count == 0) {continue;}
+    addToBuffer(first ? F("\"") : F(", \""));
+    first = false;
+    addMetricName(slot);
+    addToBuffer(F("\": ["));
+    addToBuffer((unsigned long)count);
+    addToBuffer(F(", "));
+    addToBuffer((unsigned long)metric_sums[slot]);
+    for (uint8_t i = 0; i < AREST_METRIC_BUCKETS; i++) {
+      addToBuffer(F(", "));
+      addToBuffer((unsigned long)metric_buckets[slot][i]);
     }
-    #else
-    // Int variables
-    if (variables_index > 0){
-
-      for (uint8_t i = 0; i < variables_index-1; i++){
-        addToBuffer(F("\""));
-        addToBuffer(int_variables_names[i]);
-        addToBuffer(F("\": "));
-        addToBuffer(*int_variables[i]);
-        addToBuffer(F(", "));
-      }
+    addToBuffer(F("]"));
+  }
+  addToBuffer(F("}}, "));
+}
 
-      // End
-      addToBuffer(F("\""));
-      addToBuffer(int_variables_names[variables_index-1]);
-      addToBuffer(F("\": "));
-      addToBuffer(*int_variables[variables_index-1]);
-      addToBuffer(F("}, "));
-    }
-    else {
-      addToBuffer(F(" }, "));
+// Metrics in the Prometheus text format, with cumulative buckets
+void metricsText() {
+
+  uint32_t requests = metric_errors;
+  for (uint16_t slot = 0; slot < AREST_METRIC_SLOTS; slot++) {requests += metricCount(slot);}
+
+  addToBuffer(F("# TYPE arest_requests_total counter\narest_requests_total "));
+  addToBuffer((unsigned long)requests);
+  addToBuffer(F("\n# TYPE arest_request_errors_total counter\narest_request_errors_total "));
+  addToBuffer((unsigned long)metric_errors);
+  addToBuffer(F("\n# TYPE arest_received_bytes_total counter\narest_received_bytes_total "));
+  addToBuffer((unsigned long)metric_bytes_in);
+  addToBuffer(F("\n# TYPE arest_sent_bytes_total counter\narest_sent_bytes_total "));
+  addToBuffer((unsigned long)metric_bytes_out);
+  addToBuffer(F("\n# TYPE arest_buffer_max_bytes gauge\narest_buffer_max_bytes "));
+  addToBuffer(metric_buffer_max);
+  addToBuffer(F("\n# TYPE arest_heap_delta_bytes gauge\narest_heap_delta_bytes "));
+  addToBuffer(heapDelta());
+  addToBuffer(F("\n# TYPE arest_request_duration_microseconds histogram\n"));
+
+  for (uint16_t slot = 0; slot < AREST_METRIC_SLOTS; slot++) {
+    uint32_t count = metricCount(slot);
+    if (count == 0) {continue;}
+    uint32_t cumulated = 0;
+    for (uint8_t i = 0; i < AREST_METRIC_BUCKETS; i++) {
+      cumulated += metric_buckets[slot][i];
+      addToBuffer(F("arest_request_duration_microseconds_bucket{route=\""));
+      addMetricName(slot);
+      addToBuffer(F("\",le=\""));
+      if (i < AREST_METRIC_BUCKETS - 1) {addToBuffer((unsigned long)pgm_read_dword(&aREST_metric_bounds[i]));}
+      else {addToBuffer(F("+Inf"));}
+      addToBuffer(F("\"} "));
+      addToBuffer((unsigned long)cumulated);
+      addToBuffer(F("\n"));
     }
-    #endif
-
+    addToBuffer(F("arest_request_duration_microseconds_sum{route=\""));
+    addMetricName(slot);
+    addToBuffer(F("\"} "));
+    addToBuffer((unsigned long)metric_sums[slot]);
+    addToBuffer(F("\narest_request_duration_microseconds_count{route=\""));
+    addMetricName(slot);
+    addToBuffer(F("\"} "));
+    addToBuffer((unsigned long)count);
+    addToBuffer(F("\n"));
   }
+}
 
-  // End
-  addToBuffer(F("\"id\": \""));
-  addToBuffer(id);
-  addToBuffer(F("\", \"name\": \""));
-  addToBuffer(name);
-  #if !defined(PubSubClient_h)
-  addToBuffer(F("\", \"hardware\": \""));
-  addToBuffer(HARDWARE);
-  #endif
-  addToBuffer(F("\", \"connected\": true}\r\n"));
+// Memory lost since metrics were first recorded (0 where free memory isn't known)
+long heapDelta() {
+  return metric_heap_start == 0 ? 0 : (long)metric_heap_start - (long)freeHeap();
+}
+
+// Start the metrics over
+void reset_metrics() {
+  memset(metric_buckets, 0, sizeof(metric_buckets));
+  memset(metric_sums, 0, sizeof(metric_sums));
+  metric_errors = 0;
+  metric_bytes_in = 0;
+  metric_bytes_out = 0;
+  metric_buffer_max = 0;
+  metric_heap_start = 0;
 }
 
+#else
+
+// Without metrics, nothing is counted
+void countBytesIn(uint16_t) {}
+void countBytesOut(uint16_t) {}
+void recordRequest() {}
+
+#endif
+
 void variable(char * variable_name, int *variable){
 
   int_variables[variables_index] = variable;
   int_variables_names[variables_index] = variable_name;
+  add_route(AREST_ROUTE_INT, variables_index);
   variables_index++;
+  touch(variable);
 
 }
 
@@ -1389,7 +4134,9 @@ void variable(char * variable_name, float *variable){
 
   float_variables[float_variables_index] = variable;
   float_variables_names[float_variables_index] = variable_name;
+  add_route(AREST_ROUTE_FLOAT, float_variables_index);
   float_variables_index++;
+  touch(variable);
 
 }
 #endif
@@ -1400,7 +4147,9 @@ void variable(char * variable_name, String *variable){
 
   string_variables[string_variables_index] = variable;
   string_variables_names[string_variables_index] = variable_name;
+  add_route(AREST_ROUTE_STRING, string_variables_index);
   string_variables_index++;
+  touch(variable);
 
 }
 #endif
@@ -1409,13 +4158,94 @@ void function(char * function_name, int (*f)(String)){
 
   functions_names[functions_index] = function_name;
   functions[functions_index] = f;
+  add_route(AREST_ROUTE_FUNCTION, functions_index);
   functions_index++;
 }
 
+// Route index: open addressing table of (kind, position + 1) bytes, hashed on
+// the route name; an empty slot is 0
+static uint8_t route_kind(uint8_t route) {
+  return route >> 6;
+}
+
+static uint8_t route_position(uint8_t route) {
+  return (route & 0x3F) - 1;
+}
+
+// Hash of a name, stopping at the first character that ends a route name
+static uint16_t route_hash(const char * name, uint8_t * length) {
+  uint16_t hash = 5381;
+  uint8_t i = 0;
+  for (char c = name[0]; c != '\0' && c != '?' && c != ' ' && c != '/' && c != '\r' && c != '\n'; c = name[++i]) {
+    hash = (hash << 5) + hash + c;
+  }
+  *length = i;
+  return hash;
+}
+
+// Add the value of a variable to the buffer, from its route
+void addVariableToBuffer(uint8_t route) {
+
+  uint8_t i = route_position(route);
+  if (route_kind(route) == AREST_ROUTE_INT) {addToBuffer(*int_variables[i]);}
+
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  if (route_kind(route) == AREST_ROUTE_FLOAT) {addToBuffer(*float_variables[i]);}
+  if (route_kind(route) == AREST_ROUTE_STRING) {
+    addToBuffer(F("\""));
+    addToBuffer(*string_variables[i]);
+    addToBuffer(F("\""));
+  }
+  #endif
+}
+
+// Name of the variable or function a route points to
+const char * route_name(uint8_t route) {
+  uint8_t i = route_position(route);
+  switch (route_kind(route)) {
+    case AREST_ROUTE_FUNCTION: return functions_names[i];
+    case AREST_ROUTE_INT: return int_variables_names[i];
+    #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+    case AREST_ROUTE_FLOAT: return float_variables_names[i];
+    case AREST_ROUTE_STRING: return string_variables_names[i];
+    #endif
+  }
+  return "";
+}
+
+// Slot holding the route named like the start of name, or the empty slot ending its probe sequence
+uint16_t route_slot(const char * name) {
+  uint8_t length;
+  uint16_t slot = route_hash(name, &length) % ROUTE_INDEX_SIZE;
+  while (route_index[slot] != AREST_NO_ROUTE) {
+    const char * candidate = route_name(route_index[slot]);
+    if (strncmp(candidate, name, length) == 0 && candidate[length] == '\0') break;
+    if (++slot == ROUTE_INDEX_SIZE) slot = 0;
+  }
+  return slot;
+}
+
+void add_route(uint8_t kind, uint8_t position) {
+  uint8_t route = (kind << 6) | (position + 1);
+  uint16_t slot = route_slot(route_name(route));
+
+  // On duplicate names, keep the route that a lookup used to find first
+  if (route_index[slot] == AREST_NO_ROUTE || route_kind(route_index[slot]) > kind) {
+    route_index[slot] = route;
+  }
+}
+
+// Route for the name at the start of a URL segment, or AREST_NO_ROUTE
+uint8_t find_route(const char * segment) {
+  return route_index[route_slot(segment)];
+}
+
 // Set device ID
 void set_id(char *device_id){
  
   strncpy(id,device_id, ID_SIZE);
+  trailer_length = 0;
+  touch();
 
   #if defined(PubSubClient_h)
   strcpy(in_topic, id);
@@ -1433,11 +4263,15 @@ void set_id(char *device_id){
 // Set device name
 void set_name(char *device_name){
   strcpy(name, device_name);
+  trailer_length = 0;
+  touch();
 }
 
 // Set device name
 void set_name(String device_name){
   device_name.toCharArray(name, NAME_SIZE);
+  trailer_length = 0;
+  touch();
 }
 
 // Set device ID
@@ -1451,189 +4285,325 @@ void set_id(String device_id){
 // Remove last char from buffer
 void removeLastBufferChar() {
 
-  index = index - 1;
+  if (index > 0) {
+    index = index - 1;
+    buffer[index] = '\0';
+  }
 
 }
 
-// Add to output buffer
-void addToBuffer(char * toAdd){
+// Make room for length contiguous characters in the output buffer, sending
+// what it holds to the output client if needed. Returns where to write them,
+// or NULL if they don't fit and there is no client to send the buffer to.
+char * reserveBuffer(uint16_t length) {
 
-  if (DEBUG_MODE) {
-    #if defined(ESP8266)
-    Serial.print("Memory loss:");
-    Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-    freeMemory = ESP.getFreeHeap();
-    #endif
-    Serial.print(F("Added to buffer as char: "));
+  if (index + length > OUTPUT_BUFFER_SIZE - 1) {
+    if (!flushBuffer() || index + length > OUTPUT_BUFFER_SIZE - 1) {
+      output_dropped = true;
+      return NULL;
+    }
   }
+  return buffer + index;
+}
+
+// Add length characters to the output buffer, streaming it out as it fills up
+void appendToBuffer(const char * toAdd, uint16_t length, bool progmem = false) {
 
-  for (int i = 0; i < strlen(toAdd); i++){
-    buffer[index+i] = toAdd[i];
+  while (length > 0) {
+    uint16_t room = OUTPUT_BUFFER_SIZE - 1 - index;
+    if (room == 0) {
+      if (!flushBuffer()) {
+        output_dropped = true;
+        break;
+      }
+      room = OUTPUT_BUFFER_SIZE - 1 - index;
+    }
+    uint16_t count = length < room ? length : room;
+    if (progmem) {memcpy_P(buffer + index, toAdd, count);}
+    else {memcpy(buffer + index, toAdd, count);}
+    index = index + count;
+    toAdd += count;
+    length -= count;
   }
-  index = index + strlen(toAdd);
+  buffer[index] = '\0';
 }
 
 // Add to output buffer
-#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
-void addToBuffer(String toAdd){
+void addToBuffer(const char * toAdd){
 
-  if (DEBUG_MODE) {
-    #if defined(ESP8266)
-    Serial.print("Memory loss:");
-    Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-    freeMemory = ESP.getFreeHeap();
-    #endif
-    Serial.print(F("Added to buffer as String: "));
-    Serial.println(toAdd);
-  }
+  appendToBuffer(toAdd, strlen(toAdd));
+}
 
-  for (int i = 0; i < toAdd.length(); i++){
-    buffer[index+i] = toAdd[i];
-  }
-  index = index + toAdd.length();
+// Add to output buffer
+#if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+void addToBuffer(const String& toAdd){
+
+  appendToBuffer(toAdd.c_str(), toAdd.length());
 }
 #endif
 
 // Add to output buffer
 void addToBuffer(uint16_t toAdd){
-  
-  //char number[10];
-  //itoa(toAdd,number,10);
 
-  addToBuffer(String(toAdd));
+  addToBuffer((unsigned long)toAdd);
 }
 
 // Add to output buffer
 void addToBuffer(long toAdd){
 
-  //char number[20];
-  //sprintf(number,"%d",toAdd);
-
-  addToBuffer(String(toAdd));
+  if (toAdd < 0) {
+    appendToBuffer("-", 1);
+    addToBuffer(0UL - (unsigned long)toAdd);
+  }
+  else {
+    addToBuffer((unsigned long)toAdd);
+  }
 }
 
 // Add to output buffer
 void addToBuffer(uint8_t toAdd){
 
-  //char number[10];
-  //itoa(toAdd,number,10);
-
-  addToBuffer(String(toAdd));
+  addToBuffer((unsigned long)toAdd);
 }
 
 // Add to output buffer
 void addToBuffer(int toAdd){
 
-  //char number[10];
-  //itoa(toAdd,number,10);
+  addToBuffer((long)toAdd);
+}
+
+// Add to output buffer, digits written in place
+void addToBuffer(unsigned long toAdd){
 
-  addToBuffer(String(toAdd));
+  uint8_t digits = countDigits(toAdd);
+  char * p = reserveBuffer(digits);
+  if (p == NULL) return;
+
+  writeDigits(p + digits, toAdd);
+  index = index + digits;
+  buffer[index] = '\0';
 }
 
 // Add to output buffer (Mega & ESP only)
 #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
 void addToBuffer(float toAdd){
 
-  char number[10];
-  dtostrf(toAdd, 5, 2, number);
-
-  addToBuffer(number);
+  addToBuffer((double)toAdd);
 }
 
 void addToBuffer(double toAdd) {
-	
-  char number[10];
-  dtostrf(toAdd, 5, 2, number);
 
-  addToBuffer(number);
+  char number[AREST_FLOAT_SIZE];
+  uint8_t length = formatFloat(number, toAdd, float_precision);
+
+  // Right-aligned on 5 characters, like dtostrf(toAdd, 5, ...) used to do
+  for (uint8_t i = length; i < 5; i++) {
+    appendToBuffer(" ", 1);
+  }
+  appendToBuffer(number, length);
 }
 #endif
 
 // Add to output buffer
 void addToBuffer(const __FlashStringHelper *toAdd){
 
-  if (DEBUG_MODE) {
-    #if defined(ESP8266)
-    Serial.print("Memory loss:");
-    Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-    freeMemory = ESP.getFreeHeap();
-    #endif
-    Serial.print(F("Added to buffer as progmem: "));
-    Serial.println(toAdd);
-  }
+  PGM_P p = reinterpret_cast<PGM_P>(toAdd);
+  appendToBuffer(p, strlen_P(p), true);
+}
 
-  uint8_t idx = 0;
+// Client the answer is streamed to when it outgrows the output buffer
+template <typename T>
+void setOutput(T& client, uint8_t chunkSize, uint8_t wait_time) {
 
-  PGM_P p = reinterpret_cast<PGM_P>(toAdd);
+  output_client = &client;
+  output_flush = &aREST::flushOutput<T>;
+  output_chunk_size = chunkSize;
+  output_wait_time = wait_time;
+}
 
-  while (1) {
-    unsigned char c = pgm_read_byte(p++);
-    if (c == 0) break;
-    buffer[index + idx] = c;
-    idx++;
-  }
-  index = index + idx;
+template <typename T>
+void flushOutput() {
+  writeBuffer(*static_cast<T*>(output_client), output_chunk_size, output_wait_time);
 }
 
+// Client the answer of a connection served in time slices is streamed to:
+// without ever waiting for it, so the rest of an answer it can't take at
+// once is dropped
 template <typename T>
-void sendBuffer(T& client, uint8_t chunkSize, uint8_t wait_time) {
+void setSliceOutput(T& client) {
 
-  if (DEBUG_MODE) {
-    #if defined(ESP8266)
-    Serial.print("Memory loss before sending:");
-    Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-    freeMemory = ESP.getFreeHeap();
-    #endif
-    Serial.print(F("Buffer size: "));
-    Serial.println(index);
+  output_client = &client;
+  output_flush = &aREST::flushSlice<T>;
+}
+
+template <typename T>
+void flushSlice() {
+
+  T& client = *static_cast<T*>(output_client);
+  uint16_t sent = 0;
+  while (!output_dropped && sent < index) {
+    uint16_t length = index - sent;
+    int room = writeRoom(client, output_owner->room_reported);
+    if (room >= 0 && room < length) {length = room;}
+    size_t written = length > 0 ? client.write((const uint8_t *)buffer + sent, length) : 0;
+    if (written == 0) {output_dropped = true;}
+    sent += written;
   }
+  countBytesOut(sent);
+  resetBuffer();
+}
 
-  // Send all of it
-  if (chunkSize == 0) {
-	client.print(buffer);
+// Send the content of the output buffer to the output client, if any
+bool flushBuffer() {
+
+  if (output_flush == NULL) {
+    return false;
   }
 
-  // Send chunk by chunk
-  else {
+  // Answer streamed before its length is known
+  if (http_header_room) {writeHttpHeaders(false);}
+  else if (http_chunked) {writeChunk(false);}
 
-    // Max iteration
-    uint8_t max_iteration = (int)(index/chunkSize) + 1;
+  (this->*output_flush)();
 
-    // Send data
-    for (uint8_t i = 0; i < max_iteration; i++) {
-      char intermediate_buffer[chunkSize+1];
-      memcpy(intermediate_buffer, buffer + i*chunkSize, chunkSize);
-      intermediate_buffer[chunkSize] = '\0';
+  #if defined(AREST_RESPONSE_CACHE)
+  // An answer partly sent can't be recorded
+  cache_start = AREST_CACHE_NOT_RECORDING;
+  #endif
 
-      // Send intermediate buffer
-      #ifdef ADAFRUIT_CC3000_H
-      client.fastrprint(intermediate_buffer);
-      #else
-      client.print(intermediate_buffer);
-      #endif
+  // Room for the size of the next chunk
+  if (http_chunked) {
+    index = AREST_HTTP_CHUNK_ROOM;
+    buffer[index] = '\0';
+  }
+  return true;
+}
+
+// Send the content of the output buffer and empty it
+template <typename T>
+void writeBuffer(T& client, uint8_t chunkSize, uint8_t wait_time) {
+
+  uint32_t start = micros();
+  #if AREST_TRACE_LEVEL > 0
+  uint16_t stalls = send_stalls;
+  #endif
+  countBytesOut(index);
+
+  // Fixed chunks, with a pause after each of them
+  if (pacing == AREST_PACING_FIXED) {
+    uint16_t chunk = chunkSize ? chunkSize : index;
+    for (uint16_t offset = 0; offset < index; offset += chunk) {
+      uint16_t length = index - offset < chunk ? index - offset : chunk;
+      client.write((const uint8_t *)buffer + offset, length);
 
       // Wait for client to get data
-      delay(wait_time);
+      if (chunkSize) {delay(wait_time);}
+    }
+  }
+
+  // Flow control: write what the client takes, only wait when it is full
+  else {
+    uint16_t chunk = chunkSize ? chunkSize : index;
+    if (pacing == AREST_PACING_ADAPTIVE) {
+      if (adaptive_chunk == 0) {adaptive_chunk = chunk;}
+      chunk = adaptive_chunk;
+    }
 
-      if (DEBUG_MODE) {
-        Serial.print(F("Sent buffer: "));
-        Serial.println(intermediate_buffer);
+    uint16_t offset = 0;
+    bool stalled = false;
+    bool room_reported = false;
+    uint32_t stall_start = 0;
+    while (offset < index) {
+      uint16_t length = index - offset < chunk ? index - offset : chunk;
+
+      // Don't offer more than the client says it can take right now, and
+      // nothing while it is full
+      int room = writeRoom(client, room_reported);
+      if (room >= 0 && room < length) {length = room;}
+
+      size_t written = length > 0 ? client.write((const uint8_t *)buffer + offset, length) : 0;
+      offset += written;
+
+      // The client took it all: learn a larger chunk
+      if (length > 0 && written == length) {
+        stalled = false;
+        if (pacing == AREST_PACING_ADAPTIVE && length == chunk && chunk < OUTPUT_BUFFER_SIZE) {
+          chunk = chunk + chunk / 4 + 1;
+        }
+        continue;
+      }
+
+      // Short write, or none as the client is full: learn a smaller chunk
+      // from a short write, & back off
+      if (length > 0 && pacing == AREST_PACING_ADAPTIVE && chunk > AREST_MIN_CHUNK_SIZE) {
+        chunk = chunk / 2 > AREST_MIN_CHUNK_SIZE ? chunk / 2 : AREST_MIN_CHUNK_SIZE;
+      }
+      send_stalls++;
+      if (written > 0 || !stalled) {
+        stalled = true;
+        stall_start = millis();
       }
+      else if (millis() - stall_start > AREST_SEND_TIMEOUT) {
+        AREST_TRACE(AREST_TRACE_ERROR, AREST_TRACE_SEND_TIMEOUT, 0, index - offset);
+        break;
+      }
+      if (wait_time) {delay(wait_time);}
+      else {yield();}
     }
-  }
 
-  if (DEBUG_MODE) {
-    #if defined(ESP8266)
-    Serial.print("Memory loss after sending:");
-    Serial.println(freeMemory - ESP.getFreeHeap(),DEC);
-    freeMemory = ESP.getFreeHeap();
-    #endif
-    Serial.print(F("Buffer size: "));
-    Serial.println(index);
+    if (pacing == AREST_PACING_ADAPTIVE) {adaptive_chunk = chunk;}
   }
 
-    // Reset the buffer
-    resetBuffer();
+  last_send_time = micros() - start;
+  AREST_TRACE(AREST_TRACE_INFO, AREST_TRACE_SENT, send_stalls - stalls > 0xFF ? 0xFF : send_stalls - stalls, index);
+  resetBuffer();
+}
+
+// Room in the client's write buffer, or -1 if it can't tell
+template <typename T>
+static auto availableForWrite(T& client, int) -> decltype(client.availableForWrite()) {
+  return client.availableForWrite();
+}
+
+template <typename T>
+static int availableForWrite(T& client, long) {
+  return -1;
+}
+
+// Room in the client's write buffer, 0 when it is full, or -1 if it can't
+// tell: clients that keep the Print default always report 0, which is only
+// taken for a full buffer once the client reported some room
+template <typename T>
+static int writeRoom(T& client, bool& reported) {
+  int room = availableForWrite(client, 0);
+  if (room > 0) {reported = true;}
+  return room == 0 && !reported ? -1 : room;
+}
+
+// Set how answers are paced: AREST_PACING_FIXED, AREST_PACING_FLOW or AREST_PACING_ADAPTIVE
+void set_pacing(uint8_t mode) {
+  pacing = mode;
+  adaptive_chunk = 0;
+}
+
+// Time taken to send the last answer, in microseconds
+uint32_t get_send_time() {
+  return last_send_time;
+}
+
+// Number of times sending had to wait for the client
+uint16_t get_send_stalls() {
+  return send_stalls;
+}
+
+template <typename T>
+void sendBuffer(T& client, uint8_t chunkSize, uint8_t wait_time) {
+
+  // HTTP headers, now that the length of the answer is known, or last chunk
+  if (http_header_room) {writeHttpHeaders(true);}
+  else if (http_chunked) {writeChunk(true);}
+
+  writeBuffer(client, chunkSize, wait_time);
 }
 
 char * getBuffer() {
@@ -1642,9 +4612,118 @@ char * getBuffer() {
 
 void resetBuffer(){
 
-  memset(&buffer[0], 0, sizeof(buffer));
-  // free(buffer);
+  index = 0;
+  buffer[0] = '\0';
+  http_header_room = 0;
+
+}
+
+// Set the number of decimals used for float variables
+void set_float_precision(uint8_t precision) {
+  float_precision = precision > AREST_FLOAT_MAX_PRECISION ? AREST_FLOAT_MAX_PRECISION : precision;
+  touch();
+}
+
+// Number of decimal digits of a number
+static uint8_t countDigits(unsigned long number) {
+  uint8_t digits = 1;
+  unsigned long limit = 10;
+  while (digits < 10 && number >= limit) {
+    digits++;
+    limit *= 10;
+  }
+  return digits;
+}
+
+// Write the decimal digits of a number backwards from end, two at a time
+static void writeDigits(char * end, unsigned long number) {
+
+  // 32 bit divisions are slow on 8 bit chips: only use them for large numbers
+  while (number > 0xFFFF) {
+    uint8_t pair = (number % 100) * 2;
+    number /= 100;
+    *--end = pgm_read_byte(&aREST_digit_pairs[pair + 1]);
+    *--end = pgm_read_byte(&aREST_digit_pairs[pair]);
+  }
+
+  uint16_t small = number;
+  while (small >= 100) {
+    uint8_t pair = (small % 100) * 2;
+    small /= 100;
+    *--end = pgm_read_byte(&aREST_digit_pairs[pair + 1]);
+    *--end = pgm_read_byte(&aREST_digit_pairs[pair]);
+  }
+  if (small >= 10) {
+    *--end = pgm_read_byte(&aREST_digit_pairs[small * 2 + 1]);
+    *--end = pgm_read_byte(&aREST_digit_pairs[small * 2]);
+  }
+  else {
+    *--end = '0' + small;
+  }
+}
+
+// Format a float into out (AREST_FLOAT_SIZE characters), returns its length.
+// Values from 1e9 up use an exponent so the output stays bounded.
+static uint8_t formatFloat(char * out, double number, uint8_t precision) {
+
+  char * p = out;
 
+  if (isnan(number)) {
+    memcpy(p, "nan", 3);
+    return 3;
+  }
+  if (number < 0) {
+    *p++ = '-';
+    number = -number;
+  }
+  if (isinf(number)) {
+    memcpy(p, "inf", 3);
+    return p - out + 3;
+  }
+
+  // Large values: one digit & an exponent
+  uint16_t exponent = 0;
+  if (number >= 1e9) {
+    while (number >= 10) {
+      number /= 10;
+      exponent++;
+    }
+  }
+
+  // Split in whole & rounded fraction parts
+  unsigned long scale = 1;
+  for (uint8_t i = 0; i < precision; i++) scale *= 10;
+  unsigned long whole = (unsigned long)number;
+  unsigned long fraction = (unsigned long)((number - whole) * scale + 0.5);
+  if (fraction >= scale) {
+    whole++;
+    fraction -= scale;
+  }
+  if (exponent > 0 && whole == 10) {
+    whole = 1;
+    exponent++;
+  }
+
+  uint8_t digits = countDigits(whole);
+  writeDigits(p + digits, whole);
+  p += digits;
+
+  if (precision > 0) {
+    *p++ = '.';
+    memset(p, '0', precision);
+    writeDigits(p + precision, fraction);
+    p += precision;
+  }
+
+  if (exponent > 0) {
+    *p++ = 'e';
+    *p++ = '+';
+    digits = countDigits(exponent);
+    writeDigits(p + digits, exponent);
+    p += digits;
+  }
+
+  return p - out;
 }
 
 // For non AVR boards
@@ -1679,39 +4758,75 @@ uint8_t getEnable (void) {
 	return enable_byte;
 }
 
-bool fastStringCompare (String s1, String s2) {
-	bool result = true;
-	int cnt = 0;
-	if (s2.length() > s1.length()) return false;
-	while (result && (cnt < s2.length())) {
-		result = (s1[cnt] == s2[cnt]);
-		cnt++;
-	}
-	return result;
-}
-
 private:
-  String answer;
-  char command;
-  uint8_t pin;
-  char state;
-  uint16_t value;
-  boolean pin_selected;
-  
   // enable byte
   uint8_t enable_byte = 0xff;
 
-  char* remote_server;
-  int port;
+  // Decimals of float variables
+  uint8_t float_precision = 2;
+
+  char* remote_server = NULL;
+  int port = 80;
+
+  // Events queued for the server, and time the oldest one was queued (or
+  // the last failure to send them)
+  #if AREST_EVENT_QUEUE_SIZE > 0
+  char event_queue[AREST_EVENT_QUEUE_SIZE];
+  #endif
+  uint16_t event_length = 0;
+  uint32_t event_time;
+  bool event_failed = false;
 
   char name[NAME_SIZE];
   char id[ID_SIZE+1];
-  String arguments;
+
+  // Trailer of every answer, built from the ID & name
+  char trailer[AREST_TRAILER_SIZE];
+  uint16_t trailer_length = 0;
 
   // Output buffer
   char buffer[OUTPUT_BUFFER_SIZE];
   uint16_t index;
 
+  // Answer format by default, and state of the answer serializer
+  uint8_t default_format = AREST_FORMAT;
+  bool answer_begun = false;
+  uint8_t answer_depth;
+  bool answer_first;
+  bool answer_keyed;
+
+  // Pacing of the answer & its measurements
+  uint8_t pacing = AREST_PACING;
+  uint16_t adaptive_chunk;
+  uint32_t last_send_time;
+  uint16_t send_stalls;
+
+  // Room kept for the HTTP headers & keep-alive policy
+  uint16_t http_header_room;
+  bool http_chunked;
+  uint16_t keep_alive_timeout = AREST_HTTP_KEEP_ALIVE_TIMEOUT;
+  uint8_t keep_alive_max = AREST_HTTP_KEEP_ALIVE_MAX;
+
+  // Requests served on the connection kept open by handle(), and when it was last active
+  uint8_t http_served = 0;
+  uint32_t http_last_activity = 0;
+
+  // Connection served in time slices whose answer is in the output buffer
+  aRESTConnection * output_owner = NULL;
+
+  #if defined(AREST_STREAM)
+  // Connections streaming
+  uint8_t stream_count = 0;
+  #endif
+
+  // Client the output buffer is flushed to while an answer is built, and
+  // whether part of the answer was dropped as it outgrew the buffer
+  void * output_client;
+  void (aREST::*output_flush)();
+  uint8_t output_chunk_size;
+  uint8_t output_wait_time;
+  bool output_dropped = false;
+
   // Status LED
   uint8_t status_led_pin;
 
@@ -1730,10 +4845,23 @@ private:
 
   // Subscribe topics & handlers
   uint8_t subscriptions_index;
-  char * subscriptions_names[NUMBER_SUBSCRIPTIONS];
+  char subscriptions_names[NUMBER_SUBSCRIPTIONS][SUBSCRIPTION_SIZE];
+
+  // Connection to the broker: backoff between attempts & health counters
+  bool mqtt_online;
+  uint32_t mqtt_last_attempt;
+  uint32_t mqtt_wait;
+  uint32_t mqtt_backoff = AREST_MQTT_BACKOFF_MIN;
+  uint16_t mqtt_connects;
+  uint16_t mqtt_failures;
+  uint16_t mqtt_disconnects;
 
   // aREST.io server
   char* mqtt_server = "45.55.79.41";
+
+  // Variables published when they change
+  uint8_t watches_index;
+  aRESTWatch watches[NUMBER_WATCHES];
   #endif
 
   // Float variables arrays (Mega & ESP8266 only)
@@ -1755,6 +4883,58 @@ private:
   int (*functions[NUMBER_FUNCTIONS])(String);
   char * functions_names[NUMBER_FUNCTIONS];
 
+  // Route index
+  uint8_t route_index[ROUTE_INDEX_SIZE];
+
+  // Cached answers & snapshot of the variables they were built from
+  #if defined(AREST_RESPONSE_CACHE)
+  uint8_t cache_mode = AREST_CACHE_SNAPSHOT;
+  uint16_t cache_start = AREST_CACHE_NOT_RECORDING;
+  uint16_t cache_lengths[2] = {0, 0};
+  char cache_root[AREST_CACHE_SIZE];
+  char cache_id[AREST_CACHE_ID_SIZE];
+  int int_snapshot[NUMBER_VARIABLES];
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  float float_snapshot[NUMBER_VARIABLES];
+  uint32_t string_snapshot[NUMBER_VARIABLES];
+  #endif
+  #endif
+
+  #if defined(AREST_DELTA)
+  // Delta answers: sequence number of the last change, and of the last
+  // change of each variable with the value it had then
+  uint32_t change_sequence = 0;
+  uint32_t int_changes[NUMBER_VARIABLES];
+  int int_reference[NUMBER_VARIABLES];
+  #if defined(__AVR_ATmega1280__) || defined(__AVR_ATmega2560__) || defined(ESP8266) || defined(CORE_WILDFIRE) || !defined(ADAFRUIT_CC3000_H)
+  uint32_t float_changes[NUMBER_VARIABLES];
+  float float_reference[NUMBER_VARIABLES];
+  uint32_t string_changes[NUMBER_VARIABLES];
+  uint32_t string_reference[NUMBER_VARIABLES];
+  #endif
+  #endif
+
+  #if AREST_TRACE_LEVEL > 0
+  // Trace: ring of the last events, the next one being written over the
+  // oldest once it is full
+  aRESTTraceRecord trace_records[AREST_TRACE_SIZE];
+  uint8_t trace_next = 0;
+  uint8_t trace_count = 0;
+  #endif
+
+  #if defined(AREST_METRICS)
+  // Metrics: requests in each latency bucket & total latency of each route,
+  // requests not understood, bytes read & sent, largest answer held in the
+  // buffer, and free memory when metrics were first recorded
+  uint32_t metric_buckets[AREST_METRIC_SLOTS][AREST_METRIC_BUCKETS] = {};
+  uint32_t metric_sums[AREST_METRIC_SLOTS] = {};
+  uint32_t metric_errors = 0;
+  uint32_t metric_bytes_in = 0;
+  uint32_t metric_bytes_out = 0;
+  uint16_t metric_buffer_max = 0;
+  uint32_t metric_heap_start = 0;
+  #endif
+
   // Memory debug
   #if defined(ESP8266)
   int freeMemory;
@@ -1762,4 +4942,107 @@ private:
 
 };
 
+// Connection table: serves up to N clients at once, advancing each of them a
+// little on every call to handle() instead of waiting for any of them
+template <typename T, uint8_t N = AREST_MAX_CONNECTIONS>
+class aRESTConnections {
+
+public:
+
+aRESTConnections(aREST& rest, uint8_t chunkSize = 0) : rest(rest), chunk_size(chunkSize) {
+
+  for (uint8_t i = 0; i < N; i++) {
+    connections[i].open = false;
+  }
+}
+
+// Serve a new client. Returns false if the table is full.
+bool add(T& client) {
+
+  if (!client) {return false;}
+
+  uint8_t slot = N;
+  for (uint8_t i = 0; i < N; i++) {
+
+    // Client already served
+    if (connections[i].open && aREST::same_client(clients[i], client, 0)) {return true;}
+
+    if (!connections[i].open && slot == N) {slot = i;}
+  }
+  if (slot == N) {return false;}
+
+  clients[slot] = client;
+  rest.open_connection(connections[slot]);
+  return true;
+}
+
+// Advance every connection as far as it goes without waiting for any
+// client: at most AREST_CONNECTION_BUDGET bytes read & one request answered
+// per connection. Returns the number of requests answered.
+uint8_t handle() {
+
+  uint8_t answered = 0;
+  for (uint8_t i = 0; i < N; i++) {
+    if (!connections[i].open) {continue;}
+
+    uint8_t result = rest.handle_connection(clients[i], connections[i], chunk_size, AREST_CONNECTION_BUDGET);
+    if (!connections[i].open) {clients[i] = T();}
+    if (result == AREST_SLICE_ANSWERED) {answered++;}
+  }
+  return answered;
+}
+
+// Advance the connections a step at a time, in turn, until budget µs are
+// spent or none of them has anything to do: reading a request, answering it
+// & sending the answer are spread over successive calls, and nothing waits.
+// A call may overrun its budget by one step. Returns the number of requests
+// answered.
+uint8_t handle(uint32_t budget) {
+
+  uint32_t start = micros();
+  uint8_t answered = 0;
+  bool busy = true;
+  while (busy && micros() - start < budget) {
+    busy = false;
+    for (uint8_t n = 0; n < N && micros() - start < budget; n++) {
+      uint8_t i = next;
+      next = (next + 1) % N;
+      if (!connections[i].open) {continue;}
+
+      uint8_t result = rest.step_connection(clients[i], connections[i], chunk_size);
+      if (!connections[i].open) {clients[i] = T();}
+      if (result != AREST_SLICE_IDLE) {busy = true;}
+      if (result == AREST_SLICE_ANSWERED) {answered++;}
+    }
+  }
+
+  uint32_t slice = micros() - start;
+  if (slice > worst_slice) {worst_slice = slice;}
+  return answered;
+}
+
+// Longest call to handle(budget) so far (µs)
+uint32_t get_worst_slice() {
+  return worst_slice;
+}
+
+// Number of open connections
+uint8_t count() {
+
+  uint8_t open = 0;
+  for (uint8_t i = 0; i < N; i++) {
+    if (connections[i].open) {open++;}
+  }
+  return open;
+}
+
+private:
+  aREST& rest;
+  uint8_t chunk_size;
+  T clients[N];
+  aRESTConnection connections[N];
+  uint8_t next = 0;
+  uint32_t worst_slice = 0;
+};
+
 #endif
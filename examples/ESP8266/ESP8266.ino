@@ -12,6 +12,9 @@
 // Create aREST instance
 aREST rest = aREST();
 
+// Connections served at once
+aRESTConnections<WiFiClient> connections(rest);
+
 // WiFi parameters
 const char* ssid = "your_wifi_network_name";
 const char* password = "your_wifi_network_password";
@@ -66,15 +69,11 @@ void setup(void)
 
 void loop() {
 
-  // Handle REST calls
+  // Handle REST calls: new clients are added to the connections, and every
+  // connection is advanced without waiting for its client
   WiFiClient client = server.available();
-  if (!client) {
-    return;
-  }
-  while(!client.available()){
-    delay(1);
-  }
-  rest.handle(client);
+  connections.add(client);
+  connections.handle();
 
 }
 
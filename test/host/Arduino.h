@@ -0,0 +1,312 @@
+/*
+  Minimal Arduino core for building aREST on a host (Linux) machine.
+
+  Only what aREST.h, the host tests and the benchmarks need is provided:
+  String, Print/Stream, a loopback stream standing in for HardwareSerial and
+  network clients, F()/PROGMEM, pin stubs backed by arrays, and a virtual
+  clock so that delay() costs nothing on the host but is still accounted for.
+
+  Heap allocations made by String and by operator new are counted, so the
+  benchmarks can report allocations per request.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <ctype.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+
+// Program memory is plain memory on the host
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*(const unsigned char *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcpy_P strcpy
+#define strcat_P strcat
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
+
+// Number of pins simulated by the mock
+#define MOCK_NUMBER_PINS 64
+
+// Mock state, defined in mock_arduino.cpp
+namespace mock {
+
+  // Heap accounting
+  extern unsigned long heap_allocations;
+  extern unsigned long heap_bytes;
+
+  // Virtual time added by delay()
+  extern unsigned long delayed_ms;
+
+  // Pins
+  extern uint8_t pin_mode[MOCK_NUMBER_PINS];
+  extern uint8_t pin_value[MOCK_NUMBER_PINS];
+  extern int analog_value[MOCK_NUMBER_PINS];
+  extern unsigned long digital_reads;
+  extern unsigned long analog_reads;
+  extern unsigned long port_reads;
+
+  // Input register of a port of 8 pins, built from pin_value
+  volatile uint8_t *port_input(uint8_t port);
+
+  void *malloc(size_t size);
+  void *realloc(void *ptr, size_t size);
+  void free(void *ptr);
+
+  void reset_counters();
+}
+
+// Time
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// Pins
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogWrite(uint8_t pin, int val);
+
+// AVR style port registers: ports 1, 2, ... of 8 pins each
+#define NOT_A_PIN 0
+#define digitalPinToPort(P) ((P) < MOCK_NUMBER_PINS ? (P) / 8 + 1 : NOT_A_PIN)
+#define digitalPinToBitMask(P) (1 << ((P) % 8))
+#define portInputRegister(P) (mock::port_input(P))
+
+// Random numbers
+long random(long max);
+long random(long min, long max);
+void randomSeed(unsigned long seed);
+
+// avr-libc helper
+char *dtostrf(double val, signed char width, unsigned char prec, char *sout);
+
+// String class, following the allocation behaviour of the Arduino WString
+class String {
+
+public:
+  String(const char *cstr = "");
+  String(const String &str);
+  String(String &&rval);
+  String(const __FlashStringHelper *str);
+  explicit String(char c);
+  explicit String(unsigned char value, unsigned char base = 10);
+  explicit String(int value, unsigned char base = 10);
+  explicit String(unsigned int value, unsigned char base = 10);
+  explicit String(long value, unsigned char base = 10);
+  explicit String(unsigned long value, unsigned char base = 10);
+  explicit String(float value, unsigned char decimalPlaces = 2);
+  explicit String(double value, unsigned char decimalPlaces = 2);
+  ~String();
+
+  String &operator=(const String &rhs);
+  String &operator=(String &&rval);
+  String &operator=(const char *cstr);
+
+  bool reserve(unsigned int size);
+  unsigned int length() const { return len; }
+  const char *c_str() const { return buffer ? buffer : ""; }
+
+  bool concat(const String &str);
+  bool concat(const char *cstr);
+  bool concat(const char *cstr, unsigned int length);
+  bool concat(char c);
+  bool concat(int num);
+  bool concat(long num);
+  bool concat(unsigned long num);
+
+  String &operator+=(const String &rhs) { concat(rhs); return *this; }
+  String &operator+=(const char *cstr) { concat(cstr); return *this; }
+  String &operator+=(char c) { concat(c); return *this; }
+  String &operator+=(int num) { concat(num); return *this; }
+  String &operator+=(long num) { concat(num); return *this; }
+
+  friend String operator+(const String &lhs, const String &rhs);
+  friend String operator+(const String &lhs, const char *cstr);
+  friend String operator+(const char *cstr, const String &rhs);
+  friend String operator+(const String &lhs, char c);
+
+  bool equals(const String &s) const;
+  bool equals(const char *cstr) const;
+  bool operator==(const String &rhs) const { return equals(rhs); }
+  bool operator==(const char *cstr) const { return equals(cstr); }
+  bool operator!=(const String &rhs) const { return !equals(rhs); }
+  bool operator!=(const char *cstr) const { return !equals(cstr); }
+
+  bool startsWith(const String &prefix) const;
+  bool startsWith(const String &prefix, unsigned int offset) const;
+  bool endsWith(const String &suffix) const;
+
+  char charAt(unsigned int index) const;
+  char operator[](unsigned int index) const;
+  char &operator[](unsigned int index);
+  void toCharArray(char *buf, unsigned int bufsize, unsigned int index = 0) const;
+
+  int indexOf(char ch, unsigned int fromIndex = 0) const;
+  String substring(unsigned int beginIndex) const { return substring(beginIndex, len); }
+  String substring(unsigned int beginIndex, unsigned int endIndex) const;
+
+  long toInt() const;
+  float toFloat() const;
+
+private:
+  char *buffer;
+  unsigned int capacity;
+  unsigned int len;
+
+  void init();
+  void invalidate();
+  bool changeBuffer(unsigned int maxStrLen);
+  String &copy(const char *cstr, unsigned int length);
+  void move(String &rhs);
+};
+
+// Print & Stream
+class Print {
+
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t size);
+  size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+  size_t write(const char *buf, size_t size) { return write((const uint8_t *)buf, size); }
+  virtual int availableForWrite() { return 0; }
+
+  size_t print(const __FlashStringHelper *str);
+  size_t print(const String &str);
+  size_t print(const char *str);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = DEC);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+
+  size_t println();
+  size_t println(const __FlashStringHelper *str) { return print(str) + println(); }
+  size_t println(const String &str) { return print(str) + println(); }
+  size_t println(const char *str) { return print(str) + println(); }
+  size_t println(char c) { return print(c) + println(); }
+  size_t println(unsigned char n, int base = DEC) { return print(n, base) + println(); }
+  size_t println(int n, int base = DEC) { return print(n, base) + println(); }
+  size_t println(unsigned int n, int base = DEC) { return print(n, base) + println(); }
+  size_t println(long n, int base = DEC) { return print(n, base) + println(); }
+  size_t println(unsigned long n, int base = DEC) { return print(n, base) + println(); }
+  size_t println(double n, int digits = 2) { return print(n, digits) + println(); }
+};
+
+class Stream : public Print {
+
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+  virtual void flush() {}
+
+  void setTimeout(unsigned long timeout) { _timeout = timeout; }
+  size_t readBytes(char *buffer, size_t length);
+  size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *)buffer, length); }
+
+protected:
+  unsigned long _timeout = 1000;
+};
+
+// Loopback stream: bytes queued with inject() are read back by the library,
+// everything the library writes is captured and can be inspected with output()
+#define MOCK_RX_SIZE 16384
+#define MOCK_TX_SIZE 65536
+
+class MockStream : public Stream {
+
+public:
+  MockStream() { clear(); }
+
+  // Test side
+  void inject(const char *data) { inject(data, strlen(data)); }
+  void inject(const char *data, size_t length);
+  const char *output() const { return tx; }
+  size_t output_length() const { return tx_len; }
+  void clear();
+  void clear_output() { tx_len = 0; tx[0] = '\0'; }
+  unsigned long writes() const { return write_calls; }
+  unsigned long reads() const { return read_calls; }
+
+  // Simulate a slow transport: every write() takes at most per_write bytes
+  // (0: no limit), and the next stalled writes or room polls find it full,
+  // once it took the writes after.
+  // availableForWrite() reports the room only when report_room is set,
+  // like clients that don't implement it and inherit the Print default.
+  // A blocking transport waits in a write while it is full, as hardware
+  // serial ports & Ethernet sockets do, then takes it all.
+  void limit_writes(size_t per_write, bool report_room = true) { write_limit = per_write; room_reported = report_room; }
+  void stall(unsigned long writes, unsigned long after = 0) { stalled_writes = writes; stall_after = after; }
+  void block_when_full(bool block) { blocking = block; }
+  unsigned long blocked_writes() const { return blocked_calls; }
+
+  // Library side
+  virtual int available() { return (int)(rx_len - rx_pos); }
+  virtual int read() { read_calls++; return rx_pos < rx_len ? (unsigned char)rx[rx_pos++] : -1; }
+  virtual int read(uint8_t *buf, size_t size);
+  virtual int peek() { return rx_pos < rx_len ? (unsigned char)rx[rx_pos] : -1; }
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+  virtual size_t write(const uint8_t *buf, size_t size);
+  virtual int availableForWrite();
+  using Print::write;
+
+protected:
+  char rx[MOCK_RX_SIZE];
+  size_t rx_len;
+  size_t rx_pos;
+  char tx[MOCK_TX_SIZE + 1];
+  size_t tx_len;
+  unsigned long write_calls;
+  unsigned long read_calls;
+  size_t write_limit = 0;
+  bool room_reported = false;
+  unsigned long stalled_writes = 0;
+  unsigned long stall_after = 0;
+  bool blocking = false;
+  unsigned long blocked_calls = 0;
+};
+
+class HardwareSerial : public MockStream {
+
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void end() {}
+  operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
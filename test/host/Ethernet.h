@@ -0,0 +1,90 @@
+/*
+  Host stand-in for the Arduino Ethernet library. Like on the W5100, an
+  EthernetClient is a handle on a socket: copies of a client share it, and
+  compare equal. Sockets are loopback streams of the mock core. Including
+  this file selects the Ethernet handle() overload in aREST.h, like on a
+  real board.
+*/
+
+#ifndef ethernet_h
+#define ethernet_h
+
+#include "Arduino.h"
+
+#define MOCK_SOCKETS 8
+
+// Socket behind clients
+class MockSocket : public MockStream {
+
+public:
+  MockSocket() : open(true), stops(0), connects(0), refusing(false) {}
+
+  bool open;
+  unsigned long stops;
+  unsigned long connects;
+  bool refusing;
+  char host[64];
+  uint16_t port;
+};
+
+namespace mock {
+  extern MockSocket sockets[MOCK_SOCKETS];
+}
+
+class EthernetClient : public Stream {
+
+public:
+  EthernetClient() : socket(NULL) {}
+  explicit EthernetClient(uint8_t sock) : socket(&mock::sockets[sock]) {}
+
+  // Library side
+  int connect(const char *host, uint16_t port);
+  uint8_t connected() { return socket && (socket->open || socket->available()); }
+  void stop() { if (socket) { socket->open = false; socket->stops++; } }
+  operator bool() { return socket && socket->open; }
+  bool operator==(const EthernetClient &other) { return socket == other.socket; }
+
+  virtual int available() { return socket ? socket->available() : 0; }
+  virtual int read() { return socket ? socket->read() : -1; }
+  virtual int read(uint8_t *buf, size_t size) { return socket ? socket->read(buf, size) : -1; }
+  virtual int peek() { return socket ? socket->peek() : -1; }
+  virtual size_t write(uint8_t c) { return write(&c, 1); }
+  virtual size_t write(const uint8_t *buf, size_t size) { return socket ? socket->write(buf, size) : 0; }
+  virtual int availableForWrite() { return socket ? socket->availableForWrite() : 0; }
+  using Print::write;
+
+  // Test side
+  void inject(const char *data) { socket->inject(data); }
+  const char *output() const { return socket->output(); }
+  size_t output_length() const { return socket->output_length(); }
+  void clear() { socket->clear(); }
+  void clear_output() { socket->clear_output(); }
+  unsigned long writes() const { return socket->writes(); }
+  unsigned long reads() const { return socket->reads(); }
+  void limit_writes(size_t per_write, bool report_room = true) { socket->limit_writes(per_write, report_room); }
+  void stall(unsigned long writes, unsigned long after = 0) { socket->stall(writes, after); }
+  void block_when_full(bool block) { socket->block_when_full(block); }
+  unsigned long blocked_writes() const { return socket->blocked_writes(); }
+  void reconnect() { socket->open = true; }
+  unsigned long stopped() const { return socket->stops; }
+  unsigned long connects() const { return socket->connects; }
+  void refuse(bool refusing) { socket->refusing = refusing; }
+  const char *host() const { return socket->host; }
+  uint16_t port() const { return socket->port; }
+
+private:
+  MockSocket *socket;
+};
+
+// Connect the socket, unless the server is refusing connections
+inline int EthernetClient::connect(const char *host, uint16_t port) {
+  if (!socket) return 0;
+  socket->connects++;
+  if (socket->refusing) return 0;
+  snprintf(socket->host, sizeof(socket->host), "%s", host);
+  socket->port = port;
+  socket->open = true;
+  return 1;
+}
+
+#endif
@@ -0,0 +1,144 @@
+/*
+  Host stand-in for the PubSubClient MQTT library: the client side keeps
+  the API aREST uses, the test side records what was published and
+  delivers messages to the callback.
+*/
+
+#ifndef PubSubClient_h
+#define PubSubClient_h
+
+#include "Arduino.h"
+
+#define MQTT_MAX_PACKET_SIZE 256
+#define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+
+// States reported by state()
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+
+// Messages & subscriptions kept by the mock
+#define MOCK_MQTT_MESSAGES 32
+#define MOCK_MQTT_MESSAGE_SIZE 1024
+#define MOCK_MQTT_TOPICS 16
+#define MOCK_MQTT_TOPIC_SIZE 64
+
+class PubSubClient {
+
+public:
+  PubSubClient() { clear(); }
+  template <typename C> explicit PubSubClient(C &client) { (void)client; clear(); }
+
+  // Library side
+  PubSubClient &setServer(const char *domain, uint16_t port);
+  PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE) { this->callback = callback; return *this; }
+  bool connect(const char *id);
+  bool connected() { return is_connected; }
+  void disconnect() { is_connected = false; }
+  bool subscribe(const char *topic);
+  bool publish(const char *topic, const char *payload);
+  bool publish(const char *topic, const uint8_t *payload, unsigned int length);
+  bool loop() { loops++; return is_connected; }
+  int state() { return is_connected ? MQTT_CONNECTED : MQTT_CONNECTION_TIMEOUT; }
+  uint16_t getBufferSize() { return buffer_size; }
+  bool setBufferSize(uint16_t size) { buffer_size = size; return true; }
+
+  // Test side
+  void clear();
+  void clear_messages() { message_count = 0; }
+  void fail_connects(unsigned long count) { failing_connects = count; }
+  void fail_publishes(unsigned long count) { failing_publishes = count; }
+  void drop() { is_connected = false; }
+  void deliver(const char *topic, const char *payload);
+  int published() const { return message_count; }
+  const char *topic(int i) const { return topics[i]; }
+  const char *payload(int i) const { return payloads[i]; }
+  const char *last_payload() const { return message_count ? payloads[message_count - 1] : ""; }
+  int subscriptions() const { return subscription_count; }
+  const char *subscription(int i) const { return subscribed[i]; }
+  unsigned long connects() const { return connect_calls; }
+  const char *server() const { return server_name; }
+
+private:
+  MQTT_CALLBACK_SIGNATURE;
+  bool is_connected;
+  unsigned long failing_connects;
+  unsigned long failing_publishes;
+  unsigned long connect_calls;
+  unsigned long loops;
+  uint16_t buffer_size;
+  char server_name[MOCK_MQTT_TOPIC_SIZE];
+  int message_count;
+  char topics[MOCK_MQTT_MESSAGES][MOCK_MQTT_TOPIC_SIZE];
+  char payloads[MOCK_MQTT_MESSAGES][MOCK_MQTT_MESSAGE_SIZE];
+  int subscription_count;
+  char subscribed[MOCK_MQTT_TOPICS][MOCK_MQTT_TOPIC_SIZE];
+};
+
+inline void PubSubClient::clear() {
+  callback = NULL;
+  is_connected = false;
+  failing_connects = 0;
+  failing_publishes = 0;
+  connect_calls = 0;
+  loops = 0;
+  buffer_size = MQTT_MAX_PACKET_SIZE;
+  server_name[0] = '\0';
+  message_count = 0;
+  subscription_count = 0;
+}
+
+inline PubSubClient &PubSubClient::setServer(const char *domain, uint16_t port) {
+  (void)port;
+  snprintf(server_name, sizeof(server_name), "%s", domain);
+  return *this;
+}
+
+inline bool PubSubClient::connect(const char *id) {
+  (void)id;
+  connect_calls++;
+  if (failing_connects > 0) {
+    failing_connects--;
+    return false;
+  }
+  is_connected = true;
+  subscription_count = 0;
+  return true;
+}
+
+inline bool PubSubClient::subscribe(const char *topic) {
+  if (!is_connected || subscription_count == MOCK_MQTT_TOPICS) return false;
+  snprintf(subscribed[subscription_count++], MOCK_MQTT_TOPIC_SIZE, "%s", topic);
+  return true;
+}
+
+inline bool PubSubClient::publish(const char *topic, const char *payload) {
+  return publish(topic, (const uint8_t *)payload, strlen(payload));
+}
+
+inline bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int length) {
+  if (!is_connected || message_count == MOCK_MQTT_MESSAGES) return false;
+  if (5 + 2 + strlen(topic) + length > buffer_size) return false;
+  if (failing_publishes > 0) {
+    failing_publishes--;
+    return false;
+  }
+  if (length >= MOCK_MQTT_MESSAGE_SIZE) length = MOCK_MQTT_MESSAGE_SIZE - 1;
+  snprintf(topics[message_count], MOCK_MQTT_TOPIC_SIZE, "%s", topic);
+  memcpy(payloads[message_count], payload, length);
+  payloads[message_count][length] = '\0';
+  message_count++;
+  return true;
+}
+
+// Hand a message to the callback, as loop() does when one arrives
+inline void PubSubClient::deliver(const char *topic, const char *payload) {
+  char topic_copy[MOCK_MQTT_TOPIC_SIZE];
+  uint8_t payload_copy[MOCK_MQTT_MESSAGE_SIZE];
+  snprintf(topic_copy, sizeof(topic_copy), "%s", topic);
+  unsigned int length = strlen(payload);
+  memcpy(payload_copy, payload, length);
+  if (callback) callback(topic_copy, payload_copy, length);
+}
+
+#endif
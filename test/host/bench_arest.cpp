@@ -0,0 +1,281 @@
+/*
+  Request throughput benchmark for the aREST library on the host.
+
+  Recorded request mixes are replayed through handle(char*), through the
+  transport handle() overload (Serial, or Ethernet when built with
+  BENCH_HTTP: one connection per request, and the mix pipelined on one
+  kept-alive connection) and through sendBuffer(). For every mix the benchmark reports
+  requests per second, nanoseconds per request byte parsed, heap allocations
+  per request, response bytes and the time spent in delay() per request.
+  Built with AREST_RESPONSE_CACHE, root & id answers come from the cache.
+*/
+
+#if defined(BENCH_HTTP)
+#include "Ethernet.h"
+#endif
+#include "aREST.h"
+
+#include <time.h>
+
+#if defined(AREST_RESPONSE_CACHE)
+#define CACHE ", cached answers"
+#else
+#define CACHE ""
+#endif
+
+// Iterations per mix
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 20000
+#endif
+
+aREST rest = aREST();
+
+#if defined(BENCH_HTTP)
+EthernetClient port(0);
+#define TRANSPORT "http"
+#else
+HardwareSerial port;
+#define TRANSPORT "serial"
+#endif
+
+// Variables & functions exposed to the API
+int temperature = 24;
+int humidity = 40;
+float voltage = 3.3;
+String status = "running";
+
+int ledControl(String command) {
+  digitalWrite(6, command.toInt());
+  return 1;
+}
+
+int reset(String command) {
+  (void)command;
+  return 0;
+}
+
+// Recorded request mixes
+struct Mix {
+  const char *name;
+  const char *paths[4];
+};
+
+static const Mix mixes[] = {
+  {"digital",   {"/digital/6", "/digital/6/1", "/digital/13/0", "/mode/6/o"}},
+  {"analog",    {"/analog/0", "/analog/3", "/analog/6/100", "/analog/A1"}},
+  {"variables", {"/temperature", "/humidity", "/voltage", "/status"}},
+  {"functions", {"/led?params=1", "/led?params=0", "/reset", "/reset?params=now"}},
+  {"root",      {"/", "/", "/", "/"}},
+  {"id",        {"/id", "/id", "/id", "/id"}},
+  {"mixed",     {"/temperature", "/digital/6", "/led?params=1", "/"}},
+  {"batch",     {"/batch?v=temperature,humidity,voltage,status&d=6,7&a=0,3", "/batch?v=temperature&d=6",
+                 "/batch?v=humidity,voltage&a=1", "/batch?d=2,3,4,5,6,7,8,9"}},
+};
+
+// Results of one run
+struct Result {
+  unsigned long requests;
+  unsigned long long ns;
+  unsigned long long bytes_in;
+  unsigned long long bytes_out;
+  unsigned long allocations;
+  unsigned long delayed_ms;
+};
+
+static unsigned long long now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (unsigned long long)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void report(const char *driver, const char *mix, const Result &r) {
+  double per_request = (double)r.ns / r.requests;
+  printf("%-8s %-12s %12.0f %10.1f %10.2f %10.1f %10.2f\n",
+    driver, mix,
+    1e9 / per_request,
+    (double)r.ns / r.bytes_in,
+    (double)r.allocations / r.requests,
+    (double)r.bytes_out / r.requests,
+    (double)r.delayed_ms / r.requests);
+}
+
+static void start(Result &r) {
+  memset(&r, 0, sizeof(r));
+  mock::reset_counters();
+  mock::delayed_ms = 0;
+}
+
+static void stop(Result &r, unsigned long long t0) {
+  r.ns = now_ns() - t0;
+  r.allocations = mock::heap_allocations;
+  r.delayed_ms = mock::delayed_ms;
+}
+
+// handle(char*): the path used by the MQTT callback
+static void bench_string(const Mix &mix) {
+  char requests[4][64];
+  for (int i = 0; i < 4; i++) {
+    snprintf(requests[i], sizeof(requests[i]), "%s /", mix.paths[i]);
+  }
+
+  Result r;
+  char command[64];
+  start(r);
+  unsigned long long t0 = now_ns();
+  for (unsigned long n = 0; n < BENCH_ITERATIONS; n++) {
+    const char *request = requests[n % 4];
+    strcpy(command, request);
+    rest.handle(command);
+    r.bytes_in += strlen(request);
+    r.bytes_out += strlen(rest.getBuffer());
+    rest.resetBuffer();
+  }
+  stop(r, t0);
+  r.requests = BENCH_ITERATIONS;
+  report("string", mix.name, r);
+}
+
+#if defined(BENCH_HTTP)
+static const char *http_headers_format =
+  "Host: 192.168.2.2\r\n"
+  "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:45.0) Gecko/20100101 Firefox/45.0\r\n"
+  "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+  "Accept-Language: en-US,en;q=0.5\r\n"
+  "Accept-Encoding: gzip, deflate\r\n"
+  "Connection: %s\r\n\r\n";
+
+// HTTP request with browser headers
+static void http_request(char *request, size_t size, const char *path, const char *connection) {
+  int length = snprintf(request, size, "GET %s HTTP/1.1\r\n", path);
+  snprintf(request + length, size - length, http_headers_format, connection);
+}
+#endif
+
+// Transport handle() through the loopback port
+static void bench_transport(const Mix &mix) {
+  char requests[4][512];
+  for (int i = 0; i < 4; i++) {
+    #if defined(BENCH_HTTP)
+    http_request(requests[i], sizeof(requests[i]), mix.paths[i], "close");
+    #else
+    snprintf(requests[i], sizeof(requests[i]), "%s\r", mix.paths[i]);
+    #endif
+  }
+
+  Result r;
+  start(r);
+  unsigned long long t0 = now_ns();
+  for (unsigned long n = 0; n < BENCH_ITERATIONS; n++) {
+    const char *request = requests[n % 4];
+    port.clear();
+    #if defined(BENCH_HTTP)
+    port.reconnect();
+    #endif
+    port.inject(request);
+    rest.handle(port);
+    r.bytes_in += strlen(request);
+    r.bytes_out += port.output_length();
+  }
+  stop(r, t0);
+  r.requests = BENCH_ITERATIONS;
+  report(TRANSPORT, mix.name, r);
+}
+
+#if defined(BENCH_HTTP)
+// The four requests of a mix pipelined on one kept-alive connection
+static void bench_keep_alive(const Mix &mix) {
+  char requests[2048];
+  size_t length = 0;
+  for (int i = 0; i < 4; i++) {
+    http_request(requests + length, sizeof(requests) - length, mix.paths[i], i < 3 ? "keep-alive" : "close");
+    length += strlen(requests + length);
+  }
+
+  Result r;
+  start(r);
+  unsigned long long t0 = now_ns();
+  for (unsigned long n = 0; n < BENCH_ITERATIONS / 4; n++) {
+    port.clear();
+    port.reconnect();
+    port.inject(requests);
+    rest.handle(port);
+    r.bytes_in += length;
+    r.bytes_out += port.output_length();
+  }
+  stop(r, t0);
+  r.requests = BENCH_ITERATIONS / 4 * 4;
+  report("http-ka", mix.name, r);
+}
+#endif
+
+// sendBuffer() alone, on the answer to the root request. A non-zero
+// write_limit makes the port a slow transport taking that many bytes per write
+static void bench_send_buffer(uint8_t pacing, uint8_t chunk_size, uint8_t wait_time, size_t write_limit = 0) {
+  char command[] = "/ /";
+  char name[24];
+  static const char *pacings[] = {"fix", "flow", "adapt"};
+  if (write_limit) {
+    snprintf(name, sizeof(name), "%s s%u", pacings[pacing], (unsigned)write_limit);
+  } else {
+    snprintf(name, sizeof(name), "%s c%u/w%u", pacings[pacing], chunk_size, wait_time);
+  }
+
+  rest.set_pacing(pacing);
+  port.limit_writes(write_limit, false);
+
+  Result r;
+  start(r);
+  unsigned long long total = 0;
+  for (unsigned long n = 0; n < BENCH_ITERATIONS; n++) {
+    rest.handle_proto(command);
+    r.bytes_in += strlen(rest.getBuffer());
+    port.clear();
+    unsigned long long t0 = now_ns();
+    rest.sendBuffer(port, chunk_size, wait_time);
+    total += now_ns() - t0;
+    r.bytes_out += port.output_length();
+    rest.reset_status();
+  }
+  r.ns = total;
+  r.allocations = mock::heap_allocations;
+  r.delayed_ms = mock::delayed_ms;
+  r.requests = BENCH_ITERATIONS;
+  report("send", name, r);
+
+  rest.set_pacing(AREST_PACING);
+  port.limit_writes(0, false);
+}
+
+int main() {
+
+  rest.variable("temperature", &temperature);
+  rest.variable("humidity", &humidity);
+  rest.variable("voltage", &voltage);
+  rest.variable("status", &status);
+  rest.function("led", ledControl);
+  rest.function("reset", reset);
+  rest.set_id("bench1");
+  rest.set_name("bench");
+
+  printf("aREST host benchmark (%s build%s, %d iterations per mix)\n", TRANSPORT, CACHE, BENCH_ITERATIONS);
+  printf("%-8s %-12s %12s %10s %10s %10s %10s\n",
+    "driver", "mix", "req/s", "ns/byte", "allocs/req", "bytes/req", "delay ms");
+
+  const int count = sizeof(mixes) / sizeof(mixes[0]);
+  for (int i = 0; i < count; i++) bench_string(mixes[i]);
+  for (int i = 0; i < count; i++) bench_transport(mixes[i]);
+  #if defined(BENCH_HTTP)
+  for (int i = 0; i < count; i++) bench_keep_alive(mixes[i]);
+  #endif
+
+  bench_send_buffer(AREST_PACING_FIXED, 0, 0);
+  bench_send_buffer(AREST_PACING_FIXED, 25, 0);
+  bench_send_buffer(AREST_PACING_FIXED, 50, 1);
+  bench_send_buffer(AREST_PACING_FIXED, 100, 0);
+  bench_send_buffer(AREST_PACING_FLOW, 25, 0);
+  bench_send_buffer(AREST_PACING_FLOW, 50, 1);
+  bench_send_buffer(AREST_PACING_FLOW, 50, 1, 16);
+  bench_send_buffer(AREST_PACING_ADAPTIVE, 50, 1, 16);
+
+  return 0;
+}
@@ -0,0 +1,120 @@
+/*
+  Text vs. binary protocol benchmark for the aREST library on the Serial
+  transport.
+
+  The same requests are sent as text URLs and as binary frames
+  (AREST_BINARY) through the loopback port. For each of them the benchmark
+  reports the bytes of the request & of its answer, the time they take on a
+  115200 baud link (10 bits per byte), and the time handle() takes on the
+  host: their sum is the round trip time, as the board doesn't answer before
+  the request is read.
+*/
+
+#define AREST_BINARY
+#include "aREST.h"
+
+#include "frames.h"
+
+#include <time.h>
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 20000
+#endif
+
+#define BAUD_RATE 115200
+
+aREST rest = aREST();
+HardwareSerial port;
+
+int temperature = 24;
+float voltage = 3.3;
+String status = "running";
+
+int ledControl(String command) {
+  digitalWrite(6, command.toInt());
+  return 1;
+}
+
+// A request, as text & as a binary request before framing
+struct Request {
+  const char *name;
+  const char *text;
+  uint8_t binary[8];
+  uint8_t binary_length;
+};
+
+static Request requests[] = {
+  {"digital read",  "/digital/6\r",     {AREST_OP_DIGITAL_READ, 6}, 2},
+  {"digital write", "/digital/6/1\r",   {AREST_OP_DIGITAL_WRITE, 6, 1}, 3},
+  {"analog read",   "/analog/0\r",      {AREST_OP_ANALOG_READ, 0}, 2},
+  {"int variable",  "/temperature\r",   {AREST_OP_GET, 0}, 2},
+  {"float variable", "/voltage\r",      {AREST_OP_GET, 0}, 2},
+  {"string variable", "/status\r",      {AREST_OP_GET, 0}, 2},
+  {"function",      "/led?params=1\r",  {AREST_OP_CALL, 0, '1'}, 3},
+};
+
+static unsigned long long now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (unsigned long long)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+// Send a request over and over: bytes of the answer, and time per request (ns)
+static double run(const uint8_t *request, size_t length, size_t *answer_length) {
+  unsigned long long t0 = now_ns();
+  for (int n = 0; n < BENCH_ITERATIONS; n++) {
+    port.clear();
+    port.inject((const char *)request, length);
+    rest.handle(port);
+  }
+  *answer_length = port.output_length();
+  return (double)(now_ns() - t0) / BENCH_ITERATIONS;
+}
+
+static void report(const char *mode, const char *name, size_t in, size_t out, double ns) {
+  double wire_us = (in + out) * 10 * 1e6 / BAUD_RATE;
+  printf("%-7s %-16s %8u %8u %10.1f %10.0f %10.1f\n", mode, name, (unsigned)in, (unsigned)out, wire_us, ns, wire_us + ns / 1000);
+}
+
+int main() {
+
+  rest.variable("temperature", &temperature);
+  rest.variable("voltage", &voltage);
+  rest.variable("status", &status);
+  rest.function("led", ledControl);
+  rest.set_id("bench1");
+  rest.set_name("bench");
+
+  // Routes of the binary requests, from the route index
+  requests[3].binary[1] = rest.find_route("temperature");
+  requests[4].binary[1] = rest.find_route("voltage");
+  requests[5].binary[1] = rest.find_route("status");
+  requests[6].binary[1] = rest.find_route("led");
+
+  printf("aREST text vs. binary benchmark (serial, %d baud, %d iterations per request)\n", BAUD_RATE, BENCH_ITERATIONS);
+  printf("%-7s %-16s %8s %8s %10s %10s %10s\n", "mode", "request", "req B", "ans B", "wire us", "host ns", "rtt us");
+
+  size_t text_total = 0, binary_total = 0;
+  for (size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); i++) {
+    const Request &r = requests[i];
+    size_t out;
+    size_t in = strlen(r.text);
+    double ns = run((const uint8_t *)r.text, in, &out);
+    report("text", r.name, in, out, ns);
+    text_total += in + out;
+
+    uint8_t frame[64];
+    in = frame_request(r.binary, r.binary_length, frame);
+    ns = run(frame, in, &out);
+    uint8_t answer[64];
+    if (unframe_answer((const uint8_t *)port.output(), out, answer) < 2 || answer[1] != AREST_STATUS_OK) {
+      printf("%s: bad binary answer\n", r.name);
+      return 1;
+    }
+    report("binary", r.name, in, out, ns);
+    binary_total += in + out;
+  }
+  printf("bytes on the wire: text %u, binary %u (%.1fx fewer)\n", (unsigned)text_total, (unsigned)binary_total, (double)text_total / binary_total);
+
+  return 0;
+}
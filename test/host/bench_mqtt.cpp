@@ -0,0 +1,70 @@
+/*
+  MQTT command benchmark for the aREST library on the host.
+
+  Delivers commands to handle_callback() through the stand-in MQTT client,
+  as the broker would, and measures the time and heap allocations from the
+  delivery of a command to the publication of its answer.
+*/
+
+#include "PubSubClient.h"
+#include "aREST.h"
+
+#include <time.h>
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 100000
+#endif
+
+PubSubClient mqtt;
+aREST rest = aREST(mqtt);
+
+int temperature = 24;
+int humidity = 40;
+
+int ledControl(String command) {
+  digitalWrite(6, command.toInt());
+  return 1;
+}
+
+void callback(char *topic, uint8_t *payload, unsigned int length) {
+  rest.handle_callback(mqtt, topic, payload, length);
+}
+
+static unsigned long long now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (unsigned long long)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void bench(const char *command) {
+  mock::reset_counters();
+  unsigned long long t0 = now_ns();
+  for (unsigned long n = 0; n < BENCH_ITERATIONS; n++) {
+    mqtt.clear_messages();
+    mqtt.deliver("bench1_in", command);
+  }
+  unsigned long long ns = now_ns() - t0;
+  printf("%-24s %10.1f ns/msg %8.2f allocs/msg %6u bytes/answer\n", command,
+    (double)ns / BENCH_ITERATIONS, (double)mock::heap_allocations / BENCH_ITERATIONS,
+    (unsigned)strlen(mqtt.last_payload()));
+}
+
+int main() {
+
+  rest.variable("temperature", &temperature);
+  rest.variable("humidity", &humidity);
+  rest.function("led", ledControl);
+  rest.set_id("bench1");
+  rest.set_name("bench");
+  mqtt.setCallback(callback);
+  rest.handle(mqtt);
+
+  printf("aREST MQTT command benchmark (%d iterations per command)\n", BENCH_ITERATIONS);
+  bench("/digital/6/1");
+  bench("/temperature");
+  bench("/led?params=0");
+  bench("/id");
+  bench("/");
+
+  return 0;
+}
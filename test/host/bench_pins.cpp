@@ -0,0 +1,63 @@
+/*
+  Bulk pin read benchmark for the aREST library on the host.
+
+  Measures /digital/a, /digital/p, /analog/a and /analog/p through
+  handle(char*), with the number of pin and port register reads each
+  request takes. Built twice: bench_pins samples digital pins from the
+  mock port registers, bench_pins_portable calls digitalRead() per pin.
+*/
+
+#include "aREST.h"
+
+#include <time.h>
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 200000
+#endif
+
+aREST rest = aREST();
+
+static unsigned long long now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (unsigned long long)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void bench(const char *path) {
+  char request[40];
+  char command[40];
+  snprintf(request, sizeof(request), "%s /", path);
+
+  mock::reset_counters();
+  unsigned long long t0 = now_ns();
+  for (unsigned long n = 0; n < BENCH_ITERATIONS; n++) {
+    strcpy(command, request);
+    rest.handle(command);
+    rest.resetBuffer();
+  }
+  unsigned long long ns = now_ns() - t0;
+  printf("%-12s %10.1f ns/req %10.0f req/s %6.2f digitalRead/req %6.2f port reads/req %6.2f analogRead/req\n",
+    path, (double)ns / BENCH_ITERATIONS, BENCH_ITERATIONS * 1e9 / ns,
+    (double)mock::digital_reads / BENCH_ITERATIONS, (double)mock::port_reads / BENCH_ITERATIONS,
+    (double)mock::analog_reads / BENCH_ITERATIONS);
+}
+
+int main() {
+
+  for (int i = 0; i < NUMBER_DIGITAL_PINS; i += 3) mock::pin_value[i] = HIGH;
+  for (int i = 0; i < NUMBER_ANALOG_PINS; i++) mock::analog_value[i] = 100 * i;
+  rest.set_id("bench1");
+  rest.set_name("bench");
+
+#if defined(AREST_PORT_REGISTERS)
+  printf("aREST bulk pin read benchmark (%d digital, %d analog pins, port registers)\n", NUMBER_DIGITAL_PINS, NUMBER_ANALOG_PINS);
+#else
+  printf("aREST bulk pin read benchmark (%d digital, %d analog pins, per-pin reads)\n", NUMBER_DIGITAL_PINS, NUMBER_ANALOG_PINS);
+#endif
+  bench("/digital/a");
+  bench("/digital/p");
+  bench("/analog/a");
+  bench("/analog/p");
+
+  return 0;
+}
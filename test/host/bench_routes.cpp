@@ -0,0 +1,73 @@
+/*
+  Route lookup benchmark for the aREST library on the host.
+
+  Registers NUMBER_VARIABLES int variables and NUMBER_FUNCTIONS functions
+  and measures requests to the first and last registered names, and to an
+  unknown name followed by a known one, through handle(char*). With the route index, the time per
+  request does not depend on where a name sits in the tables.
+*/
+
+#include "aREST.h"
+
+#include <time.h>
+
+#ifndef BENCH_ITERATIONS
+#define BENCH_ITERATIONS 200000
+#endif
+
+aREST rest = aREST();
+
+int values[NUMBER_VARIABLES];
+char variable_names[NUMBER_VARIABLES][16];
+char function_names[NUMBER_FUNCTIONS][16];
+
+int action(String command) {
+  (void)command;
+  return 1;
+}
+
+static unsigned long long now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (unsigned long long)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void bench(const char *label, const char *name) {
+  char request[40];
+  char command[40];
+  snprintf(request, sizeof(request), "/%s /", name);
+
+  mock::reset_counters();
+  unsigned long long t0 = now_ns();
+  for (unsigned long n = 0; n < BENCH_ITERATIONS; n++) {
+    strcpy(command, request);
+    rest.handle(command);
+    rest.resetBuffer();
+  }
+  unsigned long long ns = now_ns() - t0;
+  printf("%-16s %-18s %10.1f ns/req %8.2f allocs/req\n", label, name,
+    (double)ns / BENCH_ITERATIONS, (double)mock::heap_allocations / BENCH_ITERATIONS);
+}
+
+int main() {
+
+  for (int i = 0; i < NUMBER_VARIABLES; i++) {
+    snprintf(variable_names[i], sizeof(variable_names[i]), "sensor_%02d", i);
+    rest.variable(variable_names[i], &values[i]);
+  }
+  for (int i = 0; i < NUMBER_FUNCTIONS; i++) {
+    snprintf(function_names[i], sizeof(function_names[i]), "action_%02d", i);
+    rest.function(function_names[i], action);
+  }
+  rest.set_id("bench1");
+  rest.set_name("bench");
+
+  printf("aREST route lookup benchmark (%d variables, %d functions)\n", NUMBER_VARIABLES, NUMBER_FUNCTIONS);
+  bench("first variable", variable_names[0]);
+  bench("last variable", variable_names[NUMBER_VARIABLES - 1]);
+  bench("first function", function_names[0]);
+  bench("last function", function_names[NUMBER_FUNCTIONS - 1]);
+  bench("miss, then hit", "missing/sensor_00");
+
+  return 0;
+}
@@ -0,0 +1,119 @@
+/*
+  Jitter benchmark for the aREST connection table on the host.
+
+  A flood of pipelined requests from several clients, one of them slow to
+  take its answers & not telling how much it can take, with an answer larger
+  than the output buffer among them, is served by handle(), which answers a
+  request per connection and per call, and by handle(budget), which works in
+  time slices. Every call is timed, adding the time it spent in delay(), and
+  the benchmark reports the mean, 99th percentile & worst call times, and the
+  worst slice handle(budget) reports itself.
+*/
+
+#include "Ethernet.h"
+#include "aREST.h"
+
+#include <algorithm>
+#include <time.h>
+#include <vector>
+
+// Requests per client
+#ifndef BENCH_REQUESTS
+#define BENCH_REQUESTS 2000
+#endif
+
+#define CLIENTS 4
+#define PIPELINE 8
+#define SLOW_WRITE 16
+
+aREST rest = aREST();
+EthernetClient clients[CLIENTS] = {
+  EthernetClient(1), EthernetClient(2), EthernetClient(3), EthernetClient(4)
+};
+
+int temperature = 24;
+int humidity = 40;
+float voltage = 3.3;
+String log_text;
+
+static const char *requests[] = {
+  "GET / HTTP/1.1\r\nHost: 192.168.2.2\r\nConnection: keep-alive\r\n\r\n",
+  "GET /temperature HTTP/1.1\r\nHost: 192.168.2.2\r\nConnection: keep-alive\r\n\r\n",
+  "GET /batch?v=temperature,humidity,voltage&d=2,3,4,5 HTTP/1.1\r\nHost: 192.168.2.2\r\nConnection: keep-alive\r\n\r\n",
+  "GET /digital/6/1 HTTP/1.1\r\nHost: 192.168.2.2\r\nConnection: keep-alive\r\n\r\n",
+  "GET /log HTTP/1.1\r\nHost: 192.168.2.2\r\nConnection: keep-alive\r\n\r\n",
+};
+#define REQUESTS (sizeof(requests) / sizeof(requests[0]))
+
+static unsigned long long now_ns() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (unsigned long long)t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+// Serve the flood, with handle() if budget is 0
+static void bench(const char *name, uint32_t budget) {
+
+  aRESTConnections<EthernetClient, CLIENTS> connections(rest, 50);
+  for (int i = 0; i < CLIENTS; i++) clients[i].clear();
+  clients[0].limit_writes(SLOW_WRITE, false);
+
+  std::vector<unsigned long long> calls;
+  unsigned long long total = 0;
+  int answered = 0;
+  for (int sent = 0; sent < BENCH_REQUESTS; sent += PIPELINE) {
+
+    // Each client opens a connection & pipelines the requests it may send on it
+    for (int i = 0; i < CLIENTS; i++) {
+      clients[i].clear_output();
+      clients[i].reconnect();
+      connections.add(clients[i]);
+      for (int n = 0; n < PIPELINE; n++) clients[i].inject(requests[(sent + n + i) % REQUESTS]);
+    }
+
+    int target = answered + CLIENTS * PIPELINE;
+    while (answered < target) {
+      unsigned long delayed = mock::delayed_ms;
+      unsigned long long t0 = now_ns();
+      answered += budget ? connections.handle(budget) : connections.handle();
+      unsigned long long ns = now_ns() - t0 + (unsigned long long)(mock::delayed_ms - delayed) * 1000000ULL;
+      calls.push_back(ns);
+      total += ns;
+    }
+  }
+
+  std::sort(calls.begin(), calls.end());
+  printf("%-14s %10lu %10.1f %10.1f %10.1f %10lu\n", name,
+    (unsigned long)calls.size(),
+    (double)total / calls.size() / 1000,
+    (double)calls[calls.size() * 99 / 100] / 1000,
+    (double)calls.back() / 1000,
+    (unsigned long)(budget ? connections.get_worst_slice() : 0));
+
+  clients[0].limit_writes(0);
+  delay(AREST_HTTP_KEEP_ALIVE_TIMEOUT);
+  connections.handle();
+}
+
+int main() {
+
+  rest.variable("temperature", &temperature);
+  rest.variable("humidity", &humidity);
+  rest.variable("voltage", &voltage);
+  for (int i = 0; i < 2 * OUTPUT_BUFFER_SIZE; i++) log_text += 'l';
+  rest.variable("log", &log_text);
+  rest.set_id("bench1");
+  rest.set_name("bench");
+  rest.set_keep_alive(AREST_HTTP_KEEP_ALIVE_TIMEOUT, PIPELINE);
+
+  printf("aREST time slice benchmark (%d clients, %d requests each, slow client taking %d bytes per write)\n",
+    CLIENTS, BENCH_REQUESTS, SLOW_WRITE);
+  printf("%-14s %10s %10s %10s %10s %10s\n", "driver", "calls", "mean us", "p99 us", "max us", "worst us");
+
+  bench("handle()", 0);
+  bench("handle(50)", 50);
+  bench("handle(200)", 200);
+  bench("handle(1000)", 1000);
+
+  return 0;
+}
@@ -0,0 +1,82 @@
+/*
+  Host side of the aREST binary protocol (AREST_BINARY), written apart from
+  the library: frames requests and reads the answer frames, for the tests
+  and benchmarks.
+*/
+
+#ifndef aREST_frames_h
+#define aREST_frames_h
+
+#include <stdint.h>
+#include <string.h>
+
+// CRC16-CCITT, polynomial 0x1021, initial value 0xFFFF
+static inline uint16_t frame_crc16(const uint8_t *data, size_t length) {
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+  return crc;
+}
+
+// Frame a request: a zero byte, the COBS encoding of the request and its
+// CRC (low byte first), and a zero byte. Returns the length of the frame.
+static inline size_t frame_request(const uint8_t *request, size_t length, uint8_t *frame) {
+  uint8_t data[1024];
+  memcpy(data, request, length);
+  uint16_t crc = frame_crc16(request, length);
+  data[length++] = crc & 0xFF;
+  data[length++] = crc >> 8;
+
+  size_t out = 0;
+  frame[out++] = 0;
+  size_t code_at = out++;
+  uint8_t code = 1;
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] == 0) {
+      frame[code_at] = code;
+      code_at = out++;
+      code = 1;
+      continue;
+    }
+    frame[out++] = data[i];
+    if (++code == 0xFF) {
+      frame[code_at] = code;
+      code_at = out++;
+      code = 1;
+    }
+  }
+  frame[code_at] = code;
+  frame[out++] = 0;
+  return out;
+}
+
+// Read an answer frame, with or without its zero bytes: the answer is
+// decoded into answer, without its CRC. Returns its length, or -1 if the
+// frame is cut or fails its CRC.
+static inline int unframe_answer(const uint8_t *frame, size_t length, uint8_t *answer) {
+  while (length > 0 && frame[0] == 0) { frame++; length--; }
+  while (length > 0 && frame[length - 1] == 0) length--;
+
+  size_t in = 0, out = 0;
+  while (in < length) {
+    uint8_t code = frame[in++];
+    for (uint8_t i = 1; i < code; i++) {
+      if (in == length || frame[in] == 0) return -1;
+      answer[out++] = frame[in++];
+    }
+    if (code < 0xFF && in < length) answer[out++] = 0;
+  }
+  if (out < 2) return -1;
+  out -= 2;
+  if (frame_crc16(answer, out) != (answer[out] | answer[out + 1] << 8)) return -1;
+  return (int)out;
+}
+
+// Value of 4 bytes, low byte first
+static inline uint32_t frame_value(const uint8_t *bytes) {
+  return bytes[0] | (uint32_t)bytes[1] << 8 | (uint32_t)bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+#endif
@@ -0,0 +1,584 @@
+/*
+  Implementation of the host Arduino core (see Arduino.h).
+*/
+
+#include "Arduino.h"
+
+#include <new>
+#include <time.h>
+
+namespace mock {
+
+  unsigned long heap_allocations = 0;
+  unsigned long heap_bytes = 0;
+  unsigned long delayed_ms = 0;
+
+  uint8_t pin_mode[MOCK_NUMBER_PINS];
+  uint8_t pin_value[MOCK_NUMBER_PINS];
+  int analog_value[MOCK_NUMBER_PINS];
+  unsigned long digital_reads = 0;
+  unsigned long analog_reads = 0;
+  unsigned long port_reads = 0;
+
+  void *malloc(size_t size) {
+    heap_allocations++;
+    heap_bytes += size;
+    return ::malloc(size);
+  }
+
+  void *realloc(void *ptr, size_t size) {
+    heap_allocations++;
+    heap_bytes += size;
+    return ::realloc(ptr, size);
+  }
+
+  void free(void *ptr) {
+    ::free(ptr);
+  }
+
+  void reset_counters() {
+    heap_allocations = 0;
+    heap_bytes = 0;
+    digital_reads = 0;
+    analog_reads = 0;
+    port_reads = 0;
+  }
+
+  volatile uint8_t *port_input(uint8_t port) {
+    static volatile uint8_t registers[MOCK_NUMBER_PINS / 8 + 1];
+    port_reads++;
+    uint8_t value = 0;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      uint8_t pin = (port - 1) * 8 + bit;
+      if (pin < MOCK_NUMBER_PINS && pin_value[pin]) value |= 1 << bit;
+    }
+    registers[port] = value;
+    return &registers[port];
+  }
+}
+
+// Count every operator new as well
+void *operator new(size_t size) {
+  void *p = mock::malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept { mock::free(p); }
+void operator delete[](void *p) noexcept { mock::free(p); }
+void operator delete(void *p, size_t) noexcept { mock::free(p); }
+void operator delete[](void *p, size_t) noexcept { mock::free(p); }
+
+// Time
+static unsigned long long monotonic_us() {
+  static struct timespec start;
+  static bool started = false;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!started) {
+    start = now;
+    started = true;
+  }
+  return (unsigned long long)(now.tv_sec - start.tv_sec) * 1000000ULL
+    + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+unsigned long micros() {
+  return (unsigned long)(monotonic_us() + (unsigned long long)mock::delayed_ms * 1000ULL);
+}
+
+unsigned long millis() {
+  return micros() / 1000;
+}
+
+void delay(unsigned long ms) {
+  mock::delayed_ms += ms;
+}
+
+void delayMicroseconds(unsigned int us) {
+  (void)us;
+}
+
+void yield() {}
+
+// Pins
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < MOCK_NUMBER_PINS) mock::pin_mode[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin < MOCK_NUMBER_PINS) mock::pin_value[pin] = val ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  mock::digital_reads++;
+  return pin < MOCK_NUMBER_PINS ? mock::pin_value[pin] : LOW;
+}
+
+int analogRead(uint8_t pin) {
+  mock::analog_reads++;
+  return pin < MOCK_NUMBER_PINS ? mock::analog_value[pin] : 0;
+}
+
+void analogWrite(uint8_t pin, int val) {
+  if (pin < MOCK_NUMBER_PINS) mock::pin_value[pin] = val ? HIGH : LOW;
+}
+
+// Random numbers
+long random(long max) {
+  return max > 0 ? ::random() % max : 0;
+}
+
+long random(long min, long max) {
+  return max > min ? min + random(max - min) : min;
+}
+
+void randomSeed(unsigned long seed) {
+  srandom(seed);
+}
+
+char *dtostrf(double val, signed char width, unsigned char prec, char *sout) {
+  sprintf(sout, "%*.*f", width, prec, val);
+  return sout;
+}
+
+// String
+void String::init() {
+  buffer = NULL;
+  capacity = 0;
+  len = 0;
+}
+
+void String::invalidate() {
+  if (buffer) mock::free(buffer);
+  init();
+}
+
+bool String::changeBuffer(unsigned int maxStrLen) {
+  char *newbuffer = (char *)mock::realloc(buffer, maxStrLen + 1);
+  if (!newbuffer) return false;
+  buffer = newbuffer;
+  capacity = maxStrLen;
+  return true;
+}
+
+bool String::reserve(unsigned int size) {
+  if (buffer && capacity >= size) return true;
+  if (changeBuffer(size)) {
+    if (len == 0) buffer[0] = '\0';
+    return true;
+  }
+  return false;
+}
+
+String &String::copy(const char *cstr, unsigned int length) {
+  if (!reserve(length)) {
+    invalidate();
+    return *this;
+  }
+  len = length;
+  memcpy(buffer, cstr, length);
+  buffer[len] = '\0';
+  return *this;
+}
+
+void String::move(String &rhs) {
+  if (buffer) mock::free(buffer);
+  buffer = rhs.buffer;
+  capacity = rhs.capacity;
+  len = rhs.len;
+  rhs.init();
+}
+
+String::String(const char *cstr) {
+  init();
+  if (cstr) copy(cstr, strlen(cstr));
+}
+
+String::String(const String &str) {
+  init();
+  *this = str;
+}
+
+String::String(String &&rval) {
+  init();
+  move(rval);
+}
+
+String::String(const __FlashStringHelper *str) {
+  init();
+  const char *p = reinterpret_cast<const char *>(str);
+  if (p) copy(p, strlen(p));
+}
+
+String::String(char c) {
+  init();
+  char buf[2] = {c, 0};
+  *this = buf;
+}
+
+String::String(unsigned char value, unsigned char base) {
+  init();
+  char buf[9];
+  if (base == 16) sprintf(buf, "%x", value); else sprintf(buf, "%u", value);
+  *this = buf;
+}
+
+String::String(int value, unsigned char base) {
+  init();
+  char buf[34];
+  if (base == 16) sprintf(buf, "%x", value); else sprintf(buf, "%d", value);
+  *this = buf;
+}
+
+String::String(unsigned int value, unsigned char base) {
+  init();
+  char buf[33];
+  if (base == 16) sprintf(buf, "%x", value); else sprintf(buf, "%u", value);
+  *this = buf;
+}
+
+String::String(long value, unsigned char base) {
+  init();
+  char buf[34];
+  if (base == 16) sprintf(buf, "%lx", value); else sprintf(buf, "%ld", value);
+  *this = buf;
+}
+
+String::String(unsigned long value, unsigned char base) {
+  init();
+  char buf[33];
+  if (base == 16) sprintf(buf, "%lx", value); else sprintf(buf, "%lu", value);
+  *this = buf;
+}
+
+String::String(float value, unsigned char decimalPlaces) {
+  init();
+  char buf[33];
+  *this = dtostrf(value, decimalPlaces + 2, decimalPlaces, buf);
+}
+
+String::String(double value, unsigned char decimalPlaces) {
+  init();
+  char buf[33];
+  *this = dtostrf(value, decimalPlaces + 2, decimalPlaces, buf);
+}
+
+String::~String() {
+  if (buffer) mock::free(buffer);
+}
+
+String &String::operator=(const String &rhs) {
+  if (this == &rhs) return *this;
+  if (rhs.buffer) copy(rhs.buffer, rhs.len);
+  else invalidate();
+  return *this;
+}
+
+String &String::operator=(String &&rval) {
+  if (this != &rval) move(rval);
+  return *this;
+}
+
+String &String::operator=(const char *cstr) {
+  if (cstr) copy(cstr, strlen(cstr));
+  else invalidate();
+  return *this;
+}
+
+bool String::concat(const char *cstr, unsigned int length) {
+  unsigned int newlen = len + length;
+  if (!cstr) return false;
+  if (length == 0) return true;
+  if (!reserve(newlen)) return false;
+  memmove(buffer + len, cstr, length);
+  len = newlen;
+  buffer[len] = '\0';
+  return true;
+}
+
+bool String::concat(const String &s) {
+  return concat(s.c_str(), s.len);
+}
+
+bool String::concat(const char *cstr) {
+  return cstr ? concat(cstr, strlen(cstr)) : false;
+}
+
+bool String::concat(char c) {
+  return concat(&c, 1);
+}
+
+bool String::concat(int num) {
+  char buf[12];
+  sprintf(buf, "%d", num);
+  return concat(buf);
+}
+
+bool String::concat(long num) {
+  char buf[21];
+  sprintf(buf, "%ld", num);
+  return concat(buf);
+}
+
+bool String::concat(unsigned long num) {
+  char buf[21];
+  sprintf(buf, "%lu", num);
+  return concat(buf);
+}
+
+String operator+(const String &lhs, const String &rhs) {
+  String a(lhs);
+  a.concat(rhs);
+  return a;
+}
+
+String operator+(const String &lhs, const char *cstr) {
+  String a(lhs);
+  a.concat(cstr);
+  return a;
+}
+
+String operator+(const char *cstr, const String &rhs) {
+  String a(cstr);
+  a.concat(rhs);
+  return a;
+}
+
+String operator+(const String &lhs, char c) {
+  String a(lhs);
+  a.concat(c);
+  return a;
+}
+
+bool String::equals(const String &s) const {
+  return len == s.len && strcmp(c_str(), s.c_str()) == 0;
+}
+
+bool String::equals(const char *cstr) const {
+  return strcmp(c_str(), cstr ? cstr : "") == 0;
+}
+
+bool String::startsWith(const String &prefix) const {
+  if (len < prefix.len) return false;
+  return startsWith(prefix, 0);
+}
+
+bool String::startsWith(const String &prefix, unsigned int offset) const {
+  if (offset > len - prefix.len || !buffer || !prefix.buffer) return false;
+  return strncmp(&buffer[offset], prefix.buffer, prefix.len) == 0;
+}
+
+bool String::endsWith(const String &suffix) const {
+  if (len < suffix.len || !buffer || !suffix.buffer) return false;
+  return strcmp(&buffer[len - suffix.len], suffix.buffer) == 0;
+}
+
+char String::charAt(unsigned int index) const {
+  return operator[](index);
+}
+
+char String::operator[](unsigned int index) const {
+  if (index >= len || !buffer) return 0;
+  return buffer[index];
+}
+
+char &String::operator[](unsigned int index) {
+  static char dummy_writable_char;
+  if (index >= len || !buffer) {
+    dummy_writable_char = 0;
+    return dummy_writable_char;
+  }
+  return buffer[index];
+}
+
+void String::toCharArray(char *buf, unsigned int bufsize, unsigned int index) const {
+  if (!bufsize || !buf) return;
+  if (index >= len) {
+    buf[0] = 0;
+    return;
+  }
+  unsigned int n = bufsize - 1;
+  if (n > len - index) n = len - index;
+  strncpy(buf, buffer + index, n);
+  buf[n] = 0;
+}
+
+int String::indexOf(char ch, unsigned int fromIndex) const {
+  if (fromIndex >= len) return -1;
+  const char *temp = strchr(buffer + fromIndex, ch);
+  if (temp == NULL) return -1;
+  return temp - buffer;
+}
+
+String String::substring(unsigned int left, unsigned int right) const {
+  if (left > right) {
+    unsigned int temp = right;
+    right = left;
+    left = temp;
+  }
+  String out;
+  if (left >= len) return out;
+  if (right > len) right = len;
+  out.copy(buffer + left, right - left);
+  return out;
+}
+
+long String::toInt() const {
+  return buffer ? atol(buffer) : 0;
+}
+
+float String::toFloat() const {
+  return buffer ? (float)atof(buffer) : 0;
+}
+
+// Print
+size_t Print::write(const uint8_t *buf, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    if (write(*buf++)) n++;
+    else break;
+  }
+  return n;
+}
+
+size_t Print::print(const __FlashStringHelper *str) {
+  return write(reinterpret_cast<const char *>(str));
+}
+
+size_t Print::print(const String &str) {
+  return write((const uint8_t *)str.c_str(), str.length());
+}
+
+size_t Print::print(const char *str) {
+  return write(str);
+}
+
+size_t Print::print(char c) {
+  return write((uint8_t)c);
+}
+
+size_t Print::print(unsigned char n, int base) {
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(int n, int base) {
+  return print((long)n, base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(long n, int base) {
+  char buf[34];
+  if (base == HEX) sprintf(buf, "%lx", n); else sprintf(buf, "%ld", n);
+  return write(buf);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buf[34];
+  if (base == HEX) sprintf(buf, "%lx", n); else sprintf(buf, "%lu", n);
+  return write(buf);
+}
+
+size_t Print::print(double n, int digits) {
+  char buf[40];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+size_t Print::println() {
+  return write("\r\n");
+}
+
+// Stream
+size_t Stream::readBytes(char *buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    int c = read();
+    if (c < 0) break;
+    *buffer++ = (char)c;
+    count++;
+  }
+  return count;
+}
+
+// Loopback stream
+void MockStream::clear() {
+  rx_len = 0;
+  rx_pos = 0;
+  tx_len = 0;
+  tx[0] = '\0';
+  write_calls = 0;
+  read_calls = 0;
+  blocked_calls = 0;
+}
+
+int MockStream::read(uint8_t *buf, size_t size) {
+  read_calls++;
+  if (size > rx_len - rx_pos) size = rx_len - rx_pos;
+  memcpy(buf, rx + rx_pos, size);
+  rx_pos += size;
+  return (int)size;
+}
+
+void MockStream::inject(const char *data, size_t length) {
+
+  // Drop what was already consumed before queueing more
+  if (rx_pos == rx_len) {
+    rx_pos = 0;
+    rx_len = 0;
+  }
+  if (length > MOCK_RX_SIZE - rx_len) length = MOCK_RX_SIZE - rx_len;
+  memcpy(rx + rx_len, data, length);
+  rx_len += length;
+}
+
+int MockStream::availableForWrite() {
+  if (!room_reported) return 0;
+  if (stalled_writes && !stall_after) {
+    stalled_writes--;
+    return 0;
+  }
+  return write_limit ? (int)write_limit : MOCK_TX_SIZE;
+}
+
+size_t MockStream::write(const uint8_t *buf, size_t size) {
+  write_calls++;
+  bool full = stalled_writes && !stall_after;
+  if (stall_after) stall_after--;
+
+  // Full transport: a blocking one waits 1 ms for each stalled write
+  if (full && blocking) {
+    blocked_calls++;
+    mock::delayed_ms += stalled_writes;
+    stalled_writes = 0;
+  }
+
+  // Slow transport: short or empty writes
+  else if (full) {
+    stalled_writes--;
+    return 0;
+  }
+  if (write_limit && size > write_limit) size = write_limit;
+
+  // Output beyond the capture size is accepted but not kept
+  size_t room = MOCK_TX_SIZE - tx_len;
+  size_t n = size < room ? size : room;
+  memcpy(tx + tx_len, buf, n);
+  tx_len += n;
+  tx[tx_len] = '\0';
+  return size;
+}
+
+HardwareSerial Serial;
+
+// Sockets behind the clients of the Ethernet stand-in
+#include "Ethernet.h"
+
+MockSocket mock::sockets[MOCK_SOCKETS];
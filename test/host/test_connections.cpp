@@ -0,0 +1,455 @@
+/*
+  Host test for the aREST connection table: several loopback Ethernet
+  clients served at once, each advanced a little on every handle() call.
+*/
+
+#include "Ethernet.h"
+
+// Waits & streams served by the connection table
+#define AREST_WAIT
+#define AREST_STREAM
+#include "aREST.h"
+
+#include "test_helpers.h"
+
+#include <time.h>
+
+#define ANSWER "{\"temperature\": 24, \"id\": \"001\", \"name\": \"host\", \"hardware\": \"arduino\", \"connected\": true}\r\n"
+#define REQUEST "GET /temperature HTTP/1.1\r\nHost: 192.168.2.2\r\nConnection: keep-alive\r\n\r\n"
+#define GET(path) "GET " path " HTTP/1.1\r\nHost: 192.168.2.2\r\nConnection: keep-alive\r\n\r\n"
+#define TRAILER "\"id\": \"001\", \"name\": \"host\", \"hardware\": \"arduino\", \"connected\": true}\r\n"
+#define STREAM_HEADERS "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: keep-alive\r\n\r\n"
+#define EVENT(data) "data: {" data "\"id\": \"001\", \"name\": \"host\", \"hardware\": \"arduino\", \"connected\": true}\n\n"
+
+// aREST instance, connection table and clients under test
+aREST rest = aREST();
+aRESTConnections<EthernetClient, 4> connections(rest);
+EthernetClient clients[5] = {
+  EthernetClient(1), EthernetClient(2), EthernetClient(3), EthernetClient(4), EthernetClient(5)
+};
+
+int temperature = 24;
+String label = "ok";
+
+// Open the first count clients
+void connect(int count) {
+  for (int i = 0; i < count; i++) {
+    clients[i].clear();
+    clients[i].reconnect();
+    CHECK(connections.add(clients[i]));
+  }
+}
+
+// Close every connection, letting them time out
+void disconnect() {
+  delay(AREST_HTTP_KEEP_ALIVE_TIMEOUT);
+  connections.handle();
+  CHECK(connections.count() == 0);
+}
+
+void test_concurrent_clients() {
+  connect(4);
+  CHECK(connections.count() == 4);
+
+  // A slow client doesn't hold the others back, and nothing waits for it
+  clients[0].inject("GET /temperature HTTP/1.1\r\nHo");
+  for (int i = 1; i < 4; i++) clients[i].inject(REQUEST);
+  mock::delayed_ms = 0;
+  CHECK(connections.handle() == 3);
+  CHECK(mock::delayed_ms == 0);
+  CHECK(clients[0].output_length() == 0);
+  for (int i = 1; i < 4; i++) CHECK_CONTAINS(clients[i].output(), "\r\n\r\n" ANSWER);
+
+  // It is answered once the rest of its request arrives
+  clients[0].inject("st: 192.168.2.2\r\n\r\n");
+  CHECK(connections.handle() == 1);
+  CHECK_CONTAINS(clients[0].output(), "Connection: keep-alive\r\n\r\n" ANSWER);
+
+  // Connections stay open between requests
+  CHECK(connections.count() == 4);
+  clients[2].clear_output();
+  clients[2].inject(REQUEST);
+  CHECK(connections.handle() == 1);
+  CHECK_CONTAINS(clients[2].output(), ANSWER);
+
+  disconnect();
+}
+
+void test_table_full() {
+  connect(4);
+
+  // A client already in the table is not added twice
+  EthernetClient copy = clients[1];
+  CHECK(connections.add(copy));
+  CHECK(connections.count() == 4);
+
+  // No room for a fifth one
+  clients[4].reconnect();
+  CHECK(!connections.add(clients[4]));
+
+  disconnect();
+  CHECK(connections.add(clients[4]));
+  disconnect();
+}
+
+void test_pipelined_requests() {
+  connect(1);
+
+  // One request answered per connection and per call
+  clients[0].inject(REQUEST REQUEST);
+  CHECK(connections.handle() == 1);
+  CHECK(connections.handle() == 1);
+  CHECK(connections.handle() == 0);
+
+  disconnect();
+}
+
+void test_closed_connections() {
+  connect(2);
+
+  // Client closing its connection after a request
+  clients[0].inject("GET /temperature HTTP/1.1\r\nConnection: close\r\n\r\n");
+  unsigned long stops = clients[0].stopped();
+  CHECK(connections.handle() == 1);
+  CHECK(clients[0].stopped() == stops + 1);
+  CHECK(connections.count() == 1);
+
+  // Idle connection timed out
+  delay(AREST_HTTP_KEEP_ALIVE_TIMEOUT);
+  connections.handle();
+  CHECK(connections.count() == 0);
+}
+
+void test_bounded_iterations() {
+  connect(4);
+
+  // Long requests are read a budget at a time
+  char request[2048];
+  strcpy(request, "GET /temperature HTTP/1.1\r\nCookie: ");
+  size_t length = strlen(request);
+  memset(request + length, 'c', 1500);
+  strcpy(request + length + 1500, "\r\n\r\n");
+  length = strlen(request);
+  for (int i = 0; i < 4; i++) clients[i].inject(request);
+
+  int iterations = 0;
+  int answered = 0;
+  unsigned long long worst = 0;
+  while (answered < 4 && iterations < 100) {
+    for (int i = 0; i < 4; i++) {
+      size_t pending = clients[i].available();
+      CHECK(pending == 0 || pending + AREST_CONNECTION_BUDGET * iterations >= length);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    answered += connections.handle();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    unsigned long long ns = (t1.tv_sec - t0.tv_sec) * 1000000000ULL + t1.tv_nsec - t0.tv_nsec;
+    if (ns > worst) worst = ns;
+    iterations++;
+  }
+  CHECK(answered == 4);
+  CHECK(iterations == (int)((length + AREST_CONNECTION_BUDGET - 1) / AREST_CONNECTION_BUDGET));
+  printf("4 clients, %u byte requests: %d iterations, worst iteration %llu ns\n", (unsigned)length, iterations, worst);
+
+  disconnect();
+}
+
+// Serve every open connection in slices of budget µs until count requests
+// are answered, and return the number of calls it took
+int serve(uint32_t budget, int count) {
+  int calls = 0;
+  int answered = 0;
+  while (answered < count && calls < 10000) {
+    answered += connections.handle(budget);
+    calls++;
+  }
+  CHECK(answered == count);
+  return calls;
+}
+
+void test_time_slices() {
+  connect(4);
+
+  // Requests read, answered & sent over successive calls, without waiting
+  for (int i = 0; i < 4; i++) clients[i].inject(REQUEST);
+  mock::delayed_ms = 0;
+  serve(100, 4);
+  CHECK(mock::delayed_ms == 0);
+  for (int i = 0; i < 4; i++) CHECK_CONTAINS(clients[i].output(), "Connection: keep-alive\r\n\r\n" ANSWER);
+  CHECK(connections.count() == 4);
+  CHECK(connections.get_worst_slice() > 0);
+
+  // A slow client gets its answer a write at a time, the others theirs in between
+  for (int i = 0; i < 4; i++) {
+    clients[i].clear_output();
+    clients[i].inject(REQUEST);
+  }
+  clients[0].limit_writes(8);
+  serve(1000000, 4);
+  CHECK(mock::delayed_ms == 0);
+  for (int i = 0; i < 4; i++) CHECK_CONTAINS(clients[i].output(), ANSWER);
+  CHECK(clients[0].writes() > 10);
+  clients[0].limit_writes(0);
+
+  // A full client isn't written to, as its writes would block past the budget
+  clients[0].clear_output();
+  clients[0].inject(REQUEST);
+  clients[0].stall(3);
+  clients[0].block_when_full(true);
+  serve(1000000, 1);
+  CHECK_CONTAINS(clients[0].output(), ANSWER);
+  CHECK(clients[0].blocked_writes() == 0);
+  clients[0].block_when_full(false);
+
+  // Answers larger than the output buffer are sent a buffer at a time as
+  // they are built; one the client can't take at once is cut, and its
+  // connection closed, instead of waited for
+  label = String();
+  for (int i = 0; i < 3 * OUTPUT_BUFFER_SIZE; i++) label += 'x';
+  clients[0].clear_output();
+  clients[1].clear_output();
+  clients[0].inject(GET("/label"));
+  clients[1].inject(GET("/label"));
+  clients[1].stall(1000000, 1);
+  unsigned long stops = clients[1].stopped();
+  serve(1000000, 2);
+  CHECK(mock::delayed_ms == 0);
+  CHECK_CONTAINS(clients[0].output(), "Transfer-Encoding: chunked\r\n");
+  CHECK_CONTAINS(clients[0].output(), "xxx\", " TRAILER "\r\n0\r\n\r\n");
+  CHECK(clients[1].output_length() > 0 && clients[1].output_length() < label.length());
+  CHECK(clients[1].stopped() == stops + 1);
+  CHECK(connections.count() == 3);
+  clients[1].stall(0);
+  clients[1].reconnect();
+  CHECK(connections.add(clients[1]));
+  label = "ok";
+
+  // The output buffer holds one answer: a client that stalls in the middle
+  // of its answer keeps the others waiting up to the send timeout, then is
+  // dropped
+  for (int i = 0; i < 4; i++) {
+    clients[i].clear_output();
+    clients[i].inject(REQUEST);
+  }
+  clients[0].limit_writes(8);
+  clients[0].stall(1000000, 1);
+  uint8_t answered = connections.handle(1000000);
+  CHECK(clients[0].output_length() == 8);
+  delay(AREST_SEND_TIMEOUT + 1);
+  answered += connections.handle(1000000);
+  CHECK(answered == 4);
+  CHECK(connections.count() == 3);
+  for (int i = 1; i < 4; i++) CHECK_CONTAINS(clients[i].output(), ANSWER);
+  clients[0].stall(0);
+  clients[0].limit_writes(0);
+
+  disconnect();
+}
+
+void test_full_client() {
+  connect(4);
+
+  // A client full before its answer is built leaves the output buffer to the
+  // others, which handle() keeps answering without waiting
+  for (int i = 0; i < 4; i++) clients[i].inject(REQUEST);
+  serve(1000000, 4);
+  for (int i = 0; i < 4; i++) {
+    clients[i].clear_output();
+    clients[i].inject(REQUEST);
+  }
+  clients[0].stall(1000000);
+  mock::delayed_ms = 0;
+  clock_t start = clock();
+  CHECK(connections.handle() == 3);
+  CHECK((clock() - start) * 1000 / CLOCKS_PER_SEC < AREST_SEND_TIMEOUT / 10);
+  CHECK(mock::delayed_ms == 0);
+  CHECK(clients[0].output_length() == 0);
+  for (int i = 1; i < 4; i++) CHECK_CONTAINS(clients[i].output(), ANSWER);
+
+  // ... and again while it stays full
+  for (int i = 1; i < 4; i++) {
+    clients[i].clear_output();
+    clients[i].inject(REQUEST);
+  }
+  CHECK(connections.handle() == 3);
+  for (int i = 1; i < 4; i++) CHECK_CONTAINS(clients[i].output(), ANSWER);
+
+  // It gets its answer once it drains
+  clients[0].stall(0);
+  CHECK(connections.handle() == 1);
+  CHECK_CONTAINS(clients[0].output(), ANSWER);
+
+  // Or is given up on after the send timeout
+  clients[0].clear_output();
+  clients[0].inject(REQUEST);
+  clients[0].stall(1000000);
+  unsigned long stops = clients[0].stopped();
+  CHECK(connections.handle() == 0);
+  delay(AREST_SEND_TIMEOUT + 1);
+  CHECK(connections.handle() == 0);
+  CHECK(clients[0].stopped() == stops + 1);
+  CHECK(clients[0].output_length() == 0);
+  CHECK(connections.count() == 0);
+  clients[0].stall(0);
+}
+
+void test_wait() {
+  connect(2);
+
+  // Parked until the condition holds, the other connection served meanwhile
+  clients[0].inject(GET("/wait/temperature?op=gt&value=30&timeout=5000"));
+  clients[1].inject(REQUEST);
+  mock::delayed_ms = 0;
+  CHECK(connections.handle(1000000) == 1);
+  CHECK(clients[0].output_length() == 0);
+  CHECK_CONTAINS(clients[1].output(), ANSWER);
+  CHECK(connections.handle(1000000) == 0);
+  temperature = 31;
+  CHECK(connections.handle(1000000) == 1);
+  CHECK_CONTAINS(clients[0].output(), "\r\n\r\n{\"temperature\": 31, \"met\": true, " TRAILER);
+  CHECK(mock::delayed_ms == 0);
+  temperature = 24;
+
+  // Or until it times out
+  clients[0].clear_output();
+  clients[0].inject(GET("/wait/D6?op=eq&value=1&timeout=100"));
+  mock::pin_value[6] = LOW;
+  CHECK(connections.handle(1000000) == 0);
+  delay(50);
+  CHECK(connections.handle(1000000) == 0);
+  delay(50);
+  CHECK(connections.handle(1000000) == 1);
+  CHECK_CONTAINS(clients[0].output(), "\r\n\r\n{\"D6\": 0, \"met\": false, " TRAILER);
+
+  // Without a comparison, for a change of the value
+  clients[0].clear_output();
+  mock::analog_value[0] = 100;
+  clients[0].inject(GET("/wait/A0"));
+  CHECK(connections.handle(1000000) == 0);
+  mock::analog_value[0] = 200;
+  CHECK(connections.handle(1000000) == 1);
+  CHECK_CONTAINS(clients[0].output(), "\r\n\r\n{\"A0\": 200, \"met\": true, " TRAILER);
+  CHECK(connections.count() == 2);
+
+  // A client gone while it waits is closed
+  clients[0].inject(GET("/wait/temperature?op=lt&value=0"));
+  CHECK(connections.handle(1000000) == 0);
+  clients[0].stop();
+  connections.handle(1000000);
+  CHECK(connections.count() == 1);
+
+  // Answered at once outside of the time slices (only the keep-alive
+  // timeout is waited for)
+  mock::delayed_ms = 0;
+  clients[4].clear();
+  clients[4].reconnect();
+  clients[4].inject(GET("/wait/temperature?op=ge&value=24&fmt=light"));
+  rest.handle(clients[4]);
+  CHECK_CONTAINS(clients[4].output(), "\r\n\r\n24,true\r\n");
+  clients[4].clear();
+  clients[4].reconnect();
+  clients[4].inject(GET("/wait/temperature?op=ne&value=24"));
+  rest.handle(clients[4]);
+  CHECK_CONTAINS(clients[4].output(), "{\"temperature\": 24, \"met\": false, " TRAILER);
+  CHECK(mock::delayed_ms < AREST_WAIT_TIMEOUT);
+
+  disconnect();
+}
+
+void test_streams() {
+  connect(4);
+
+  // Events pushed on the connection kept open, one per interval
+  mock::pin_value[6] = HIGH;
+  clients[0].inject(GET("/stream?v=temperature&d=6&interval=100"));
+  connections.handle(1000000);
+  CHECK_STR(clients[0].output(), STREAM_HEADERS EVENT("\"temperature\": 24, \"D6\": 1, "));
+  CHECK(rest.get_streams() == 1);
+  clients[0].clear_output();
+  temperature = 25;
+  CHECK(connections.handle(1000000) == 0);
+  CHECK(clients[0].output_length() == 0);
+  delay(100);
+  connections.handle(1000000);
+  CHECK_STR(clients[0].output(), EVENT("\"temperature\": 25, \"D6\": 1, "));
+
+  // Or only when their data changed
+  clients[1].inject(GET("/stream?v=temperature&interval=10&changes=1&fmt=light"));
+  connections.handle(1000000);
+  CHECK_STR(clients[1].output(), STREAM_HEADERS "data: 25\n\n");
+  clients[1].clear_output();
+  delay(10);
+  connections.handle(1000000);
+  CHECK(clients[1].output_length() == 0);
+  temperature = 24;
+  delay(10);
+  connections.handle(1000000);
+  CHECK_STR(clients[1].output(), "data: 24\n\n");
+
+  // Past the limit, a stream is answered once like a batch; other requests
+  // are served meanwhile
+  clients[2].inject(GET("/stream?v=temperature"));
+  clients[3].inject(REQUEST);
+  CHECK(connections.handle(1000000) == 2);
+  CHECK_CONTAINS(clients[2].output(), "Content-Length: 92\r\n");
+  CHECK_CONTAINS(clients[2].output(), "\r\n\r\n" ANSWER);
+  CHECK_CONTAINS(clients[3].output(), ANSWER);
+  CHECK(rest.get_streams() == 2);
+
+  // Streams end when their client is gone
+  clients[0].stop();
+  clients[1].stop();
+  connections.handle(1000000);
+  CHECK(rest.get_streams() == 0);
+  CHECK(connections.count() == 2);
+
+  disconnect();
+
+  // Or when an event outgrows the output buffer
+  connect(1);
+  label = String();
+  for (int i = 0; i < OUTPUT_BUFFER_SIZE; i++) label += 'x';
+  clients[0].inject(GET("/stream?v=label"));
+  connections.handle(1000000);
+  CHECK(rest.get_streams() == 0);
+  CHECK(connections.count() == 0);
+  CHECK(clients[0].output_length() == 0);
+  label = "ok";
+
+  // Streams are served by handle() too
+  connect(1);
+  clients[0].inject(GET("/stream?v=temperature&interval=100"));
+  connections.handle();
+  CHECK_STR(clients[0].output(), STREAM_HEADERS EVENT("\"temperature\": 24, "));
+  CHECK(rest.get_streams() == 1);
+  clients[0].clear_output();
+  delay(100);
+  connections.handle();
+  CHECK_STR(clients[0].output(), EVENT("\"temperature\": 24, "));
+  clients[0].stop();
+  connections.handle();
+  CHECK(rest.get_streams() == 0);
+  CHECK(connections.count() == 0);
+}
+
+int main() {
+
+  rest.variable("temperature", &temperature);
+  rest.variable("label", &label);
+  rest.set_id("001");
+  rest.set_name("host");
+
+  test_concurrent_clients();
+  test_table_full();
+  test_pipelined_requests();
+  test_closed_connections();
+  test_bounded_iterations();
+  test_time_slices();
+  test_full_client();
+  test_wait();
+  test_streams();
+
+  return test_summary("test_connections");
+}
@@ -0,0 +1,45 @@
+/*
+  Tiny assertion helpers shared by the host tests.
+*/
+
+#ifndef aREST_test_helpers_h
+#define aREST_test_helpers_h
+
+#include <stdio.h>
+#include <string.h>
+
+static int tests_run = 0;
+static int tests_failed = 0;
+
+#define CHECK(cond) do { \
+    tests_run++; \
+    if (!(cond)) { \
+      tests_failed++; \
+      printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+  } while (0)
+
+#define CHECK_STR(actual, expected) do { \
+    tests_run++; \
+    const char *a_ = (actual); \
+    const char *e_ = (expected); \
+    if (strcmp(a_, e_) != 0) { \
+      tests_failed++; \
+      printf("%s:%d: expected\n  [%s]\ngot\n  [%s]\n", __FILE__, __LINE__, e_, a_); \
+    } \
+  } while (0)
+
+#define CHECK_CONTAINS(haystack, needle) do { \
+    tests_run++; \
+    if (strstr((haystack), (needle)) == NULL) { \
+      tests_failed++; \
+      printf("%s:%d: [%s] not found in\n  [%s]\n", __FILE__, __LINE__, (needle), (haystack)); \
+    } \
+  } while (0)
+
+static int test_summary(const char *name) {
+  printf("%s: %d checks, %d failed\n", name, tests_run, tests_failed);
+  return tests_failed ? 1 : 0;
+}
+
+#endif
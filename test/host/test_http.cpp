@@ -0,0 +1,594 @@
+/*
+  Host test for the aREST library using HTTP, mirroring test/http_test.py
+  with a loopback Ethernet client instead of a real board.
+*/
+
+#include "Ethernet.h"
+
+// Root & id answers served from the cache, with metrics, CBOR & delta answers
+#define AREST_RESPONSE_CACHE
+#define AREST_METRICS
+#define AREST_CBOR
+#define AREST_DELTA
+#include "aREST.h"
+
+#include "test_helpers.h"
+
+#define HEADERS "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nAccess-Control-Allow-Methods: POST, GET, PUT, OPTIONS\r\nContent-Type: application/json\r\n"
+#define TRAILER "\"id\": \"001\", \"name\": \"host\", \"hardware\": \"arduino\", \"connected\": true}\r\n"
+
+// aREST instance and client under test
+aREST rest = aREST();
+EthernetClient client(0);
+
+// Instance publishing events to a server, and its connection
+aREST cloud = aREST((char *)"events.local", 8080);
+EthernetClient server(6);
+
+// Variables & functions exposed to the API
+int temperature;
+String label;
+
+int ledControl(String command) {
+  int state = command.toInt();
+  digitalWrite(6, state);
+  return 1;
+}
+
+// Build a GET request with typical browser headers
+const char *request(const char *path, const char *connection = "keep-alive", const char *version = "1.1") {
+  static char request[512];
+  snprintf(request, sizeof(request),
+    "GET %s HTTP/%s\r\n"
+    "Host: 192.168.2.2\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:45.0) Gecko/20100101 Firefox/45.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Connection: %s\r\n\r\n", path, version, connection);
+  return request;
+}
+
+// Send requests over a new connection and return everything answered, the
+// previous one having gone idle
+const char *send(const char *requests) {
+  delay(AREST_HTTP_KEEP_ALIVE_TIMEOUT);
+  client.clear();
+  client.reconnect();
+  client.inject(requests);
+  rest.handle(client);
+  return client.output();
+}
+
+// One answer split from the output: body, and how it was framed
+struct Answer {
+  char body[2048];
+  long content_length;
+  bool chunked;
+  bool keep_alive;
+};
+
+// Split the next answer from the output, returns where the following one starts
+const char *next_answer(const char *output, Answer &answer) {
+  answer.body[0] = '\0';
+  answer.content_length = -1;
+  answer.chunked = false;
+  answer.keep_alive = false;
+
+  if (output == NULL || strncmp(output, HEADERS, strlen(HEADERS)) != 0) return NULL;
+  const char *end = strstr(output, "\r\n\r\n");
+  if (end == NULL) return NULL;
+
+  const char *length = strstr(output, "Content-Length: ");
+  if (length != NULL && length < end) answer.content_length = atol(length + 16);
+  const char *encoding = strstr(output, "Transfer-Encoding: chunked");
+  answer.chunked = encoding != NULL && encoding < end;
+  const char *connection = strstr(output, "Connection: ");
+  if (connection != NULL && connection < end) answer.keep_alive = strncmp(connection + 12, "keep-alive", 10) == 0;
+
+  const char *body = end + 4;
+  size_t size = 0;
+
+  // Chunks: size in hex, data, down to an empty one
+  if (answer.chunked) {
+    for (;;) {
+      char *data;
+      size_t chunk = strtoul(body, &data, 16);
+      if (strncmp(data, "\r\n", 2) != 0) return NULL;
+      data += 2;
+      if (chunk == 0) return strncmp(data, "\r\n", 2) == 0 ? data + 2 : NULL;
+      if (chunk > strlen(data) || size + chunk >= sizeof(answer.body)) return NULL;
+      memcpy(answer.body + size, data, chunk);
+      size += chunk;
+      answer.body[size] = '\0';
+      if (strncmp(data + chunk, "\r\n", 2) != 0) return NULL;
+      body = data + chunk + 2;
+    }
+  }
+
+  size = answer.content_length >= 0 ? (size_t)answer.content_length : strlen(body);
+  if (size > strlen(body) || size >= sizeof(answer.body)) return NULL;
+  memcpy(answer.body, body, size);
+  answer.body[size] = '\0';
+  return body + size;
+}
+
+// Body of a single answer, checking its framing
+const char *get(const char *path) {
+  static Answer answer;
+  const char *rest_of_output = next_answer(send(request(path)), answer);
+  CHECK(rest_of_output != NULL && *rest_of_output == '\0');
+  CHECK(answer.content_length == (long)strlen(answer.body));
+  return answer.body;
+}
+
+void test_mode() {
+  CHECK_STR(get("/mode/6/i"), "{\"message\": \"Pin D6 set to input\", " TRAILER);
+  CHECK_STR(get("/mode/6/o"), "{\"message\": \"Pin D6 set to output\", " TRAILER);
+}
+
+void test_digital() {
+  CHECK_STR(get("/digital/6/1"), "{\"message\": \"Pin D6 set to 1\", " TRAILER);
+  CHECK_STR(get("/digital/6"), "{\"return_value\": 1, " TRAILER);
+  CHECK_STR(get("/digital/6/0"), "{\"message\": \"Pin D6 set to 0\", " TRAILER);
+  CHECK_STR(get("/digital/6"), "{\"return_value\": 0, " TRAILER);
+}
+
+void test_analog() {
+  mock::analog_value[6] = 1023;
+  CHECK_STR(get("/analog/6"), "{\"return_value\": 1023, " TRAILER);
+  CHECK_STR(get("/analog/6/100"), "{\"message\": \"Pin D6 set to 100\", " TRAILER);
+}
+
+void test_variable_and_function() {
+  CHECK_STR(get("/temperature"), "{\"temperature\": 24, " TRAILER);
+  CHECK_STR(get("/led?params=1"), "{, \"return_value\": 1, " TRAILER);
+  CHECK(mock::pin_value[6] == HIGH);
+  CHECK_STR(get("/led?params=0"), "{, \"return_value\": 1, " TRAILER);
+  CHECK(mock::pin_value[6] == LOW);
+}
+
+void test_id_and_root() {
+  CHECK_STR(get("/id"), "{" TRAILER);
+  CHECK_STR(get("/"), "{\"variables\": {\"temperature\": 24, \"label\": \"ok\"}, " TRAILER);
+}
+
+void test_cache() {
+  const char *root = "{\"variables\": {\"temperature\": 24, \"label\": \"ok\"}, " TRAILER;
+  CHECK_STR(get("/"), root);
+  CHECK_STR(get("/"), root);
+
+  // Changes found from the snapshot of the variables
+  temperature = 25;
+  CHECK_STR(get("/"), "{\"variables\": {\"temperature\": 25, \"label\": \"ok\"}, " TRAILER);
+  label = "ko";
+  CHECK_STR(get("/"), "{\"variables\": {\"temperature\": 25, \"label\": \"ko\"}, " TRAILER);
+
+  // Only from touch(): the answer is kept until then
+  rest.set_cache(AREST_CACHE_TOUCH);
+  temperature = 24;
+  label = "ok";
+  CHECK_STR(get("/"), "{\"variables\": {\"temperature\": 24, \"label\": \"ok\"}, " TRAILER);
+  temperature = 26;
+  CHECK_STR(get("/"), "{\"variables\": {\"temperature\": 24, \"label\": \"ok\"}, " TRAILER);
+  rest.touch(&label);
+  CHECK_STR(get("/"), "{\"variables\": {\"temperature\": 26, \"label\": \"ok\"}, " TRAILER);
+  temperature = 24;
+  rest.touch(&temperature);
+  CHECK_STR(get("/"), root);
+
+  // Renaming the device rebuilds both answers
+  rest.set_name("board");
+  CHECK_STR(get("/id"), "{\"id\": \"001\", \"name\": \"board\", \"hardware\": \"arduino\", \"connected\": true}\r\n");
+  CHECK_CONTAINS(get("/"), "\"name\": \"board\"");
+  rest.set_name("host");
+  CHECK_STR(get("/id"), "{" TRAILER);
+
+  // A hit doesn't rebuild anything
+  mock::reset_counters();
+  get("/");
+  CHECK(mock::heap_allocations == 0);
+
+  // Answers larger than the output buffer are streamed, never cached
+  char value[1001];
+  memset(value, 'v', 1000);
+  value[1000] = '\0';
+  label = value;
+  rest.touch(&label);
+  Answer answer;
+  next_answer(send(request("/")), answer);
+  CHECK(answer.chunked);
+  CHECK(strlen(answer.body) == strlen(root) + 998);
+  next_answer(send(request("/")), answer);
+  CHECK(answer.chunked);
+  label = "ok";
+  rest.touch(&label);
+  CHECK_STR(get("/"), root);
+  rest.set_cache(AREST_CACHE_SNAPSHOT);
+}
+
+void test_batch() {
+  mock::pin_value[6] = HIGH;
+  mock::analog_value[0] = 512;
+  CHECK_STR(get("/batch?v=temperature,label&d=6&a=0"),
+    "{\"temperature\": 24, \"label\": \"ok\", \"D6\": 1, \"A0\": 512, " TRAILER);
+}
+
+// Body of a CBOR answer, and its length
+const uint8_t *get_cbor(const char *path, size_t *length) {
+  const char *output = send(request(path));
+  const char *end = strstr(output, "\r\n\r\n");
+  CHECK(end != NULL && strstr(output, "Content-Type: application/cbor\r\n") != NULL);
+  CHECK(strstr(output, "Content-Type: application/json") == NULL);
+  *length = client.output_length() - (end + 4 - output);
+  CHECK((long)*length == atol(strstr(output, "Content-Length: ") + 16));
+  return (const uint8_t *)end + 4;
+}
+
+#define CBOR_TRAILER "\x62id\x63" "001\x64name\x64host\x68hardware\x67" "arduino\x69" "connected\xF5\xFF"
+
+void test_formats() {
+
+  // Each request picks its format
+  CHECK_STR(get("/temperature?fmt=light"), "24\r\n");
+  CHECK_STR(get("/temperature?fmt=json"), "{\"temperature\": 24, " TRAILER);
+  CHECK_STR(get("/led?params=1&fmt=light"), "1\r\n");
+  CHECK_STR(get("/batch?v=temperature,label&d=6&fmt=light"), "24,ok,1\r\n");
+  CHECK_STR(get("/?fmt=light"), "001\r\n");
+  CHECK_STR(get("/"), "{\"variables\": {\"temperature\": 24, \"label\": \"ok\"}, " TRAILER);
+
+  // CBOR: maps of indefinite length
+  size_t length;
+  const uint8_t *body = get_cbor("/temperature?fmt=cbor", &length);
+  static const char temperature_map[] = "\xBF\x6Btemperature\x18\x18" CBOR_TRAILER;
+  CHECK(length == sizeof(temperature_map) - 1 && memcmp(body, temperature_map, length) == 0);
+  temperature = -300;
+  body = get_cbor("/batch?v=temperature&a=0&fmt=cbor", &length);
+  static const char batch_map[] = "\xBF\x6Btemperature\x39\x01\x2B\x62" "A0\x19\x02\x00" CBOR_TRAILER;
+  CHECK(length == sizeof(batch_map) - 1 && memcmp(body, batch_map, length) == 0);
+  temperature = 24;
+  body = get_cbor("/mode/6/o?fmt=cbor", &length);
+  static const char mode_map[] = "\xBF\x67message\x7F\x65Pin D\x61" "6\x6E set to output\xFF" CBOR_TRAILER;
+  CHECK(length == sizeof(mode_map) - 1 && memcmp(body, mode_map, length) == 0);
+  body = get_cbor("/?fmt=cbor", &length);
+  static const char root_map[] = "\xBF\x69variables\xBF\x6Btemperature\x18\x18\x65label\x62ok\xFF" CBOR_TRAILER;
+  CHECK(length == sizeof(root_map) - 1 && memcmp(body, root_map, length) == 0);
+  body = get_cbor("/id?fmt=cbor", &length);
+  static const char id_map[] = "\xBF" CBOR_TRAILER;
+  CHECK(length == sizeof(id_map) - 1 && memcmp(body, id_map, length) == 0);
+
+  // Cached answers are kept for the default format
+  CHECK_STR(get("/id"), "{" TRAILER);
+
+  // Default format
+  rest.set_format(AREST_FORMAT_LIGHT);
+  CHECK_STR(get("/temperature"), "24\r\n");
+  CHECK_STR(get("/id"), "001\r\n");
+  CHECK_STR(get("/digital/6/1"), "\r\n");
+  CHECK_STR(get("/temperature?fmt=json"), "{\"temperature\": 24, " TRAILER);
+  rest.set_format(AREST_FORMAT_JSON);
+  CHECK_STR(get("/id"), "{" TRAILER);
+}
+
+// Delta answer to /?since=, and the answer expected with the given variables
+const char *get_since(unsigned long since, const char *parameters = "") {
+  char path[64];
+  snprintf(path, sizeof(path), "/?since=%lu%s", since, parameters);
+  return get(path);
+}
+
+const char *delta_answer(const char *variables, unsigned long sequence) {
+  static char answer[256];
+  snprintf(answer, sizeof(answer), "{\"variables\": {%s}, \"sequence\": %lu, " TRAILER, variables, sequence);
+  return answer;
+}
+
+void test_delta() {
+  unsigned long sequence = rest.get_sequence();
+
+  // Only the variables changed after the client's sequence
+  CHECK_STR(get_since(sequence), delta_answer(" ", sequence));
+  temperature = 30;
+  CHECK_STR(get_since(sequence), delta_answer("\"temperature\": 30", sequence + 1));
+  CHECK_STR(get_since(sequence + 1), delta_answer(" ", sequence + 1));
+  CHECK_STR(get_since(0), delta_answer("\"temperature\": 30, \"label\": \"ok\"", sequence + 1));
+
+  // A change that went back is only seen through touch()
+  label = "ko";
+  label = "ok";
+  CHECK_STR(get_since(sequence + 1), delta_answer(" ", sequence + 1));
+  rest.touch(&label);
+  CHECK_STR(get_since(sequence + 1), delta_answer("\"label\": \"ok\"", sequence + 2));
+
+  // A sequence from before a restart asks for everything
+  CHECK_STR(get_since(sequence + 100), delta_answer("\"temperature\": 30, \"label\": \"ok\"", sequence + 2));
+
+  // Always an object, never taken from or kept in the cache
+  CHECK_STR(get_since(sequence + 2, "&fmt=light"), delta_answer(" ", sequence + 2));
+  CHECK_STR(get("/"), "{\"variables\": {\"temperature\": 30, \"label\": \"ok\"}, " TRAILER);
+  CHECK_STR(get_since(sequence + 2), delta_answer(" ", sequence + 2));
+  temperature = 24;
+  CHECK_STR(get("/"), "{\"variables\": {\"temperature\": 24, \"label\": \"ok\"}, " TRAILER);
+  CHECK(rest.get_sequence() == sequence + 3);
+}
+
+void test_connection_closed() {
+
+  // Kept open after its answer, and closed once the client asks
+  unsigned long stops = client.stopped();
+  get("/temperature");
+  CHECK(client.stopped() == stops);
+  send(request("/temperature", "close"));
+  CHECK(client.stopped() == stops + 1);
+}
+
+void test_keep_alive() {
+  Answer answer;
+
+  // HTTP/1.1 connections are kept open
+  next_answer(send(request("/temperature")), answer);
+  CHECK(answer.keep_alive);
+
+  // ... without waiting for the next request, answered on a later call
+  unsigned long stops = client.stopped();
+  unsigned long delayed = mock::delayed_ms;
+  client.clear_output();
+  rest.handle(client);
+  CHECK(client.output_length() == 0);
+  client.inject(request("/temperature"));
+  rest.handle(client);
+  next_answer(client.output(), answer);
+  CHECK_STR(answer.body, "{\"temperature\": 24, " TRAILER);
+  CHECK(answer.keep_alive);
+  CHECK(mock::delayed_ms == delayed);
+  CHECK(client.stopped() == stops);
+
+  // ... unless the client closes them
+  next_answer(send(request("/temperature", "close")), answer);
+  CHECK(!answer.keep_alive);
+  CHECK_STR(answer.body, "{\"temperature\": 24, " TRAILER);
+
+  // HTTP/1.0 connections are closed, unless the client keeps them open
+  next_answer(send(request("/temperature", "close", "1.0")), answer);
+  CHECK(!answer.keep_alive);
+  next_answer(send(request("/temperature", "Keep-Alive", "1.0")), answer);
+  CHECK(answer.keep_alive);
+
+  // Without keep-alive, every answer closes the connection
+  rest.set_keep_alive(0, 0);
+  next_answer(send(request("/temperature")), answer);
+  CHECK(!answer.keep_alive);
+  rest.set_keep_alive(AREST_HTTP_KEEP_ALIVE_TIMEOUT, AREST_HTTP_KEEP_ALIVE_MAX);
+}
+
+void test_pipelining() {
+  Answer answer;
+  char requests[2048];
+
+  // Several requests in one read are answered in order
+  snprintf(requests, sizeof(requests), "%s", request("/temperature"));
+  strcat(requests, request("/digital/6/1"));
+  strcat(requests, "POST /led?params=0 HTTP/1.1\r\nContent-Length: 9\r\n\r\n/digital/");
+  strcat(requests, request("/id"));
+
+  const char *output = send(requests);
+  output = next_answer(output, answer);
+  CHECK_STR(answer.body, "{\"temperature\": 24, " TRAILER);
+  CHECK(answer.keep_alive);
+  output = next_answer(output, answer);
+  CHECK_STR(answer.body, "{\"message\": \"Pin D6 set to 1\", " TRAILER);
+  output = next_answer(output, answer);
+  CHECK_STR(answer.body, "{, \"return_value\": 1, " TRAILER);
+  CHECK(mock::pin_value[6] == LOW);
+  output = next_answer(output, answer);
+  CHECK_STR(answer.body, "{" TRAILER);
+  CHECK(output != NULL && *output == '\0');
+
+  // The connection is closed after the max. number of requests
+  requests[0] = '\0';
+  for (int i = 0; i < AREST_HTTP_KEEP_ALIVE_MAX + 2; i++) strcat(requests, request("/id"));
+  unsigned long stops = client.stopped();
+  output = send(requests);
+  for (int i = 0; i < AREST_HTTP_KEEP_ALIVE_MAX; i++) {
+    output = next_answer(output, answer);
+    CHECK(answer.keep_alive == (i < AREST_HTTP_KEEP_ALIVE_MAX - 1));
+  }
+  CHECK(output != NULL && *output == '\0');
+  CHECK(client.stopped() == stops + 1);
+}
+
+void test_header_skipping() {
+  Answer answer;
+
+  // Headers are read a block at a time, and only Connection & Content-Length looked at
+  const char *get = request("/temperature", "close");
+  const char *output = send(get);
+  CHECK(client.reads() <= (strlen(get) + AREST_HTTP_READ_BLOCK - 1) / AREST_HTTP_READ_BLOCK + 1);
+  next_answer(output, answer);
+  CHECK_STR(answer.body, "{\"temperature\": 24, " TRAILER);
+  CHECK(!answer.keep_alive);
+
+  // Header values that look like the headers looked for
+  char requests[2048];
+  snprintf(requests, sizeof(requests),
+    "GET /temperature HTTP/1.1\r\nCookie: connection: close; content-length: 12\r\n"
+    "X-Connection: close\r\nCONNECTION: Keep-Alive\r\n\r\n%s", request("/id"));
+  output = next_answer(send(requests), answer);
+  CHECK_STR(answer.body, "{\"temperature\": 24, " TRAILER);
+  CHECK(answer.keep_alive);
+  output = next_answer(output, answer);
+  CHECK_STR(answer.body, "{" TRAILER);
+  CHECK(output != NULL && *output == '\0');
+}
+
+void test_split_request() {
+
+  // The rest of a request is read on the next call
+  Answer answer;
+  unsigned long stops = client.stopped();
+  CHECK(*send("GET /temperature HTTP/1.1\r\nHost: 192.") == '\0');
+  client.inject(".2.2\r\n\r\n");
+  rest.handle(client);
+  next_answer(client.output(), answer);
+  CHECK_STR(answer.body, "{\"temperature\": 24, " TRAILER);
+  CHECK(answer.keep_alive);
+
+  // A request cut short by a client going idle is still answered
+  CHECK(*send("GET /temperature HTTP/1.1\r\nHost: 192.") == '\0');
+  rest.handle(client);
+  CHECK(client.output_length() == 0);
+  delay(AREST_HTTP_KEEP_ALIVE_TIMEOUT);
+  rest.handle(client);
+  next_answer(client.output(), answer);
+  CHECK_STR(answer.body, "{\"temperature\": 24, " TRAILER);
+  CHECK(!answer.keep_alive);
+  CHECK(client.stopped() == stops + 1);
+}
+
+void test_streamed_answer() {
+  Answer answer;
+  char requests[1024];
+
+  // Larger than the output buffer: sent in chunks on a kept-alive connection
+  char value[1001];
+  memset(value, 'v', 1000);
+  value[1000] = '\0';
+  label = value;
+  snprintf(requests, sizeof(requests), "%s", request("/label"));
+  strcat(requests, request("/temperature"));
+  const char *output = next_answer(send(requests), answer);
+  CHECK(answer.chunked);
+  CHECK(answer.keep_alive);
+  CHECK(strlen(answer.body) == strlen("{\"label\": \"\", " TRAILER) + 1000);
+  CHECK(strncmp(answer.body, "{\"label\": \"vvvv", 15) == 0);
+  CHECK_CONTAINS(answer.body, "vvvv\", " TRAILER);
+  output = next_answer(output, answer);
+  CHECK_STR(answer.body, "{\"temperature\": 24, " TRAILER);
+  CHECK(output != NULL && *output == '\0');
+
+  // ... or up to the end of the connection
+  next_answer(send(request("/label", "close")), answer);
+  CHECK(answer.content_length == -1);
+  CHECK(!answer.chunked);
+  CHECK(!answer.keep_alive);
+  CHECK(strlen(answer.body) == strlen("{\"label\": \"\", " TRAILER) + 1000);
+  label = "ok";
+}
+
+void test_metrics() {
+  rest.reset_metrics();
+  const char *paths[] = {"/temperature", "/temperature", "/digital/6", "/nothing", "/led?params=1", "/?fmt=json"};
+  unsigned long bytes_in = 0;
+  unsigned long bytes_out = 0;
+  for (int i = 0; i < 6; i++) {
+    bytes_in += strlen(request(paths[i]));
+    send(request(paths[i]));
+    bytes_out += client.output_length();
+  }
+
+  // Totals, then count, total time & buckets of each route requested
+  char expected[128];
+  bytes_in += strlen(request("/metrics"));
+  snprintf(expected, sizeof(expected), "{\"metrics\": {\"requests\": 6, \"errors\": 1, \"bytes_in\": %lu, \"bytes_out\": %lu, ", bytes_in, bytes_out);
+  static Answer answer;
+  CHECK(next_answer(send(request("/metrics")), answer) != NULL);
+  const char *metrics = answer.body;
+  CHECK(strncmp(metrics, expected, strlen(expected)) == 0);
+  CHECK_CONTAINS(metrics, "\"buckets\": [100, 1000, 10000, 100000, 1000000], \"routes\": {\"root\": [1, ");
+  CHECK_CONTAINS(metrics, ", \"digital\": [1, ");
+  CHECK_CONTAINS(metrics, ", \"led\": [1, ");
+  CHECK_CONTAINS(metrics, ", \"temperature\": [2, ");
+  CHECK_CONTAINS(metrics, "]}}, " TRAILER);
+
+  // Prometheus text format
+  const char *text = send(request("/metrics/prometheus", "close"));
+  CHECK_CONTAINS(text, "Content-Type: text/plain; version=0.0.4\r\n");
+  CHECK_CONTAINS(text, "\r\n\r\n# TYPE arest_requests_total counter\narest_requests_total 7\n");
+  CHECK_CONTAINS(text, "\narest_request_errors_total 1\n");
+  CHECK_CONTAINS(text, "\narest_request_duration_microseconds_bucket{route=\"temperature\",le=\"+Inf\"} 2\n");
+  CHECK_CONTAINS(text, "\narest_request_duration_microseconds_count{route=\"metrics\"} 1\n");
+  CHECK(strstr(text, "\"id\"") == NULL);
+}
+
+#define EVENT_HEADERS(length) "POST /002/events HTTP/1.1\r\nHost: events.local:8080\r\nConnection: keep-alive\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: " length "\r\n\r\n"
+
+void test_events() {
+  cloud.set_id("002");
+  server.stop();
+  server.clear();
+
+  // Queued until the oldest event waited for the flush interval
+  CHECK(cloud.publish(server, "temperature", 24));
+  CHECK(server.output_length() == 0);
+  CHECK(!cloud.flush_events(server));
+  delay(AREST_EVENT_FLUSH_INTERVAL);
+  CHECK(cloud.flush_events(server));
+  CHECK_STR(server.output(), EVENT_HEADERS("24") "name=temperature&data=24");
+  CHECK(server.connects() == 1);
+  CHECK_STR(server.host(), "events.local");
+  CHECK(server.port() == 8080);
+
+  // Or until the queue is half full: several events in one request, on the
+  // same connection, after reading the answer to the last one
+  server.clear();
+  server.inject("HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n");
+  CHECK(cloud.publish(server, "ratio", 1.5));
+  CHECK(server.output_length() == 0);
+  CHECK(cloud.publish(server, "label", "a b&c"));
+  CHECK_STR(server.output(), EVENT_HEADERS("44") "name=ratio&data=1.50&name=label&data=a+b%26c");
+  CHECK(server.writes() == 2);
+  CHECK(server.available() == 0);
+  CHECK(server.connects() == 1);
+  CHECK(cloud.flush_events(server));
+
+  // Server down: events are kept, and tried again a flush interval later
+  server.stop();
+  server.refuse(true);
+  server.clear();
+  CHECK(cloud.publish(server, "temperature", -5));
+  CHECK(cloud.publish(server, "temperature", -6));
+  CHECK(server.connects() == 2);
+  CHECK(!cloud.publish(server, "temperature", -7));
+  CHECK(server.connects() == 2);
+  CHECK(server.output_length() == 0);
+
+  // Sent once it is back
+  server.refuse(false);
+  delay(AREST_EVENT_FLUSH_INTERVAL);
+  CHECK(cloud.publish(server, "temperature", -7));
+  CHECK(server.connects() == 3);
+  CHECK_STR(server.output(), EVENT_HEADERS("49") "name=temperature&data=-5&name=temperature&data=-6");
+  server.clear();
+  CHECK(cloud.flush_events(server, true));
+  CHECK_STR(server.output(), EVENT_HEADERS("24") "name=temperature&data=-7");
+}
+
+int main() {
+
+  temperature = 24;
+  label = "ok";
+  rest.variable("temperature", &temperature);
+  rest.variable("label", &label);
+  rest.function("led", ledControl);
+  rest.set_id("001");
+  rest.set_name("host");
+
+  test_mode();
+  test_digital();
+  test_analog();
+  test_variable_and_function();
+  test_id_and_root();
+  test_cache();
+  test_batch();
+  test_formats();
+  test_delta();
+  test_connection_closed();
+  test_keep_alive();
+  test_pipelining();
+  test_header_skipping();
+  test_split_request();
+  test_streamed_answer();
+  test_events();
+  test_metrics();
+
+  return test_summary("test_http");
+}
@@ -0,0 +1,258 @@
+/*
+  Host test for the aREST cloud path, with a stand-in MQTT client that
+  records what is published.
+*/
+
+#include "PubSubClient.h"
+#include "aREST.h"
+
+#include "test_helpers.h"
+
+// MQTT client & aREST instance under test
+PubSubClient mqtt;
+aREST rest = aREST(mqtt);
+
+// Variables & functions exposed to the API
+int temperature;
+float ratio;
+String label;
+
+int ledControl(String command) {
+  digitalWrite(6, command.toInt());
+  return 1;
+}
+
+void callback(char *topic, uint8_t *payload, unsigned int length) {
+  rest.handle_callback(mqtt, topic, payload, length);
+}
+
+#define TRAILER "\"id\": \"001\", \"name\": \"host\", \"connected\": true}\r\n"
+
+// Send a command as the cloud does, and return its answer
+const char *command(const char *payload) {
+  mqtt.clear_messages();
+  mqtt.deliver("001_in", payload);
+  CHECK(mqtt.published() == 1);
+  CHECK_STR(mqtt.topic(0), "001_out");
+  return mqtt.last_payload();
+}
+
+// Run the client for a while, and return the number of messages published
+int run(unsigned long ms) {
+  mqtt.clear_messages();
+  delay(ms);
+  rest.handle(mqtt);
+  return mqtt.published();
+}
+
+void test_watch() {
+  CHECK(rest.watch("temperature", 2, 1000, 10000));
+  CHECK(rest.watch("ratio", 0.1, 500));
+  CHECK(rest.watch("label"));
+
+  // Only variables can be watched
+  CHECK(!rest.watch("missing"));
+  CHECK(!rest.watch("led"));
+}
+
+void test_first_publication() {
+
+  // Every watched variable once connected, in one message
+  CHECK(run(0) == 1);
+  CHECK(mqtt.connected());
+  CHECK_STR(mqtt.topic(0), "001_publish");
+  CHECK_STR(mqtt.payload(0), "{\"client_id\": \"001\", \"variables\": {\"temperature\": 24, \"ratio\":  1.50, \"label\": \"ok\"}}");
+
+  // Then nothing while nothing changes
+  CHECK(run(0) == 0);
+  CHECK(run(2000) == 0);
+}
+
+void test_deadband() {
+
+  // Changes within the deadband are not published
+  temperature = 25;
+  ratio = 1.55;
+  CHECK(run(2000) == 0);
+
+  // Changes are measured from the value last published
+  temperature = 26;
+  CHECK(run(0) == 0);
+  temperature = 27;
+  CHECK(run(0) == 1);
+  CHECK_STR(mqtt.last_payload(), "{\"client_id\": \"001\", \"variables\": {\"temperature\": 27}}");
+
+  // Strings on any change
+  label = "ko";
+  CHECK(run(1000) == 1);
+  CHECK_STR(mqtt.last_payload(), "{\"client_id\": \"001\", \"variables\": {\"label\": \"ko\"}}");
+}
+
+void test_intervals() {
+
+  // At most one publication per min. interval
+  temperature = 30;
+  CHECK(run(0) == 1);
+  temperature = 33;
+  CHECK(run(0) == 0);
+  CHECK(run(990) == 0);
+  CHECK(run(10) == 1);
+  CHECK_STR(mqtt.last_payload(), "{\"client_id\": \"001\", \"variables\": {\"temperature\": 33}}");
+
+  // And at least one per max. interval, changed or not
+  CHECK(run(9000) == 0);
+  CHECK(run(1000) == 1);
+  CHECK_STR(mqtt.last_payload(), "{\"client_id\": \"001\", \"variables\": {\"temperature\": 33}}");
+}
+
+void test_coalescing() {
+
+  // Variables changing together are published together
+  temperature = 20;
+  ratio = 2.5;
+  label = "ok";
+  CHECK(run(1000) == 1);
+  CHECK_STR(mqtt.last_payload(), "{\"client_id\": \"001\", \"variables\": {\"temperature\": 20, \"ratio\":  2.50, \"label\": \"ok\"}}");
+
+  // NaN is a change
+  ratio = NAN;
+  CHECK(run(1000) == 1);
+  CHECK(run(1000) == 0);
+  ratio = 2.5;
+  CHECK(run(1000) == 1);
+}
+
+void test_commands() {
+  CHECK_STR(command("/digital/6/1"), "{\"message\": \"Pin D6 set to 1\", " TRAILER);
+  CHECK(mock::pin_value[6] == HIGH);
+  CHECK_STR(command("/led?params=0"), "{, \"return_value\": 1, " TRAILER);
+  CHECK(mock::pin_value[6] == LOW);
+  CHECK_STR(command("/id"), "{" TRAILER);
+  CHECK_STR(command("/temperature"), "{\"temperature\": 40, " TRAILER);
+
+  // Variables are answered without any allocation
+  mock::reset_counters();
+  command("/temperature");
+  command("/");
+  CHECK(mock::heap_allocations == 0);
+
+  // Payloads of any length
+  char payload[1001];
+  memset(payload, 'x', 1000);
+  payload[1000] = '\0';
+  payload[0] = '/';
+  CHECK_CONTAINS(command(payload), "{\"variables\": {");
+  CHECK_STR(command("/temperature"), "{\"temperature\": 40, " TRAILER);
+
+  // Answers larger than the client can publish
+  mqtt.setBufferSize(100);
+  CHECK_STR(command("/"), "{\"message\": \"Answer too long\", " TRAILER);
+  mqtt.setBufferSize(MQTT_MAX_PACKET_SIZE);
+}
+
+void test_failed_publication() {
+
+  // Variables are published again when the client fails to
+  temperature = 50;
+  ratio = 3.5;
+  label = "xx";
+  mqtt.fail_publishes(1);
+  CHECK(run(1000) == 0);
+  CHECK(run(0) == 1);
+  CHECK_STR(mqtt.last_payload(), "{\"client_id\": \"001\", \"variables\": {\"temperature\": 50, \"ratio\":  3.50, \"label\": \"xx\"}}");
+
+  // Variables that don't fit in the client's packet go in the next message
+  temperature = 60;
+  ratio = 4.5;
+  label = "yy";
+  mqtt.setBufferSize(5 + 2 + strlen("001_publish") + 75);
+  CHECK(run(1000) == 1);
+  CHECK_STR(mqtt.last_payload(), "{\"client_id\": \"001\", \"variables\": {\"temperature\": 60, \"ratio\":  4.50}}");
+  mqtt.setBufferSize(MQTT_MAX_PACKET_SIZE);
+  CHECK(run(0) == 1);
+  CHECK_STR(mqtt.last_payload(), "{\"client_id\": \"001\", \"variables\": {\"label\": \"yy\"}}");
+}
+
+void test_no_publication_while_disconnected() {
+  temperature = 40;
+  mqtt.drop();
+  mqtt.clear_messages();
+  CHECK(!rest.publish_telemetry(mqtt));
+  CHECK(mqtt.published() == 0);
+  CHECK(run(1000) == 1);
+  CHECK(mqtt.connects() == 2);
+}
+
+void test_reconnect() {
+  mqtt.drop();
+  mqtt.fail_connects(6);
+  unsigned long delayed = mock::delayed_ms;
+  uint16_t connects = rest.get_mqtt_connects();
+  uint16_t failures = rest.get_mqtt_failures();
+  uint16_t disconnects = rest.get_mqtt_disconnects();
+
+  // A lost connection is tried again at once, without waiting
+  CHECK(!rest.reconnect(mqtt));
+  CHECK(mqtt.connects() == 3);
+  CHECK(mock::delayed_ms == delayed);
+  CHECK(rest.get_mqtt_disconnects() == disconnects + 1);
+
+  // Then once per backoff delay, doubling after each failure
+  unsigned long backoff = AREST_MQTT_BACKOFF_MIN;
+  for (unsigned long attempts = 4; attempts <= 9; attempts++) {
+    unsigned long waited = 0;
+    while (mqtt.connects() < attempts && waited <= backoff) {
+      delay(10);
+      waited += 10;
+      rest.reconnect(mqtt);
+    }
+    CHECK(mqtt.connects() == attempts);
+    CHECK(waited >= backoff / 2 && waited <= backoff + 10);
+    backoff *= 2;
+  }
+  CHECK(mqtt.connected());
+  CHECK(rest.get_mqtt_failures() == failures + 6);
+  CHECK(rest.get_mqtt_connects() == connects + 1);
+  CHECK(rest.reconnect(mqtt));
+  CHECK(mqtt.connects() == 9);
+
+  // Subscribed again, to the additional topics too
+  CHECK(mqtt.subscriptions() == 2);
+  CHECK_STR(mqtt.subscription(0), "001_in");
+  CHECK_STR(mqtt.subscription(1), "lamp_toggle_in");
+
+  // The backoff starts over after a successful connection
+  mqtt.drop();
+  mqtt.fail_connects(1);
+  CHECK(!rest.reconnect(mqtt));
+  delay(AREST_MQTT_BACKOFF_MIN);
+  CHECK(rest.reconnect(mqtt));
+  CHECK(rest.get_mqtt_disconnects() == disconnects + 2);
+}
+
+int main() {
+
+  temperature = 24;
+  ratio = 1.5;
+  label = "ok";
+  rest.variable("temperature", &temperature);
+  rest.variable("ratio", &ratio);
+  rest.variable("label", &label);
+  rest.function("led", ledControl);
+  rest.set_id("001");
+  rest.set_name("host");
+  rest.subscribe("lamp", "toggle");
+  mqtt.setCallback(callback);
+
+  test_watch();
+  test_first_publication();
+  test_deadband();
+  test_intervals();
+  test_coalescing();
+  test_failed_publication();
+  test_no_publication_while_disconnected();
+  test_commands();
+  test_reconnect();
+
+  return test_summary("test_mqtt");
+}
@@ -0,0 +1,493 @@
+/*
+  Host test for the aREST library using Serial, mirroring test/serial_test.py
+  with a loopback port instead of a real board.
+*/
+
+#include "Arduino.h"
+
+// Requests & errors traced, in a small ring, and binary requests
+#define AREST_TRACE_LEVEL 2
+#define AREST_TRACE_SIZE 4
+#define AREST_BINARY
+#include "aREST.h"
+
+#include "frames.h"
+#include "test_helpers.h"
+
+#define TRAILER "\"id\": \"001\", \"name\": \"host\", \"hardware\": \"arduino\", \"connected\": true}\r\n"
+
+// aREST instance and port under test
+aREST rest = aREST();
+HardwareSerial port;
+
+// Variables & functions exposed to the API
+int temperature;
+int humidity;
+float ratio;
+String label;
+
+int ledControl(String command) {
+  int state = command.toInt();
+  digitalWrite(6, state);
+  return 1;
+}
+
+// Send a request and return the answer
+const char *request(const char *command) {
+  port.clear();
+  port.inject(command);
+  rest.handle(port);
+  return port.output();
+}
+
+void test_mode() {
+  CHECK_STR(request("/mode/6/i\r"), "{\"message\": \"Pin D6 set to input\", " TRAILER);
+  CHECK(mock::pin_mode[6] == INPUT);
+  CHECK_STR(request("/mode/6/o\r"), "{\"message\": \"Pin D6 set to output\", " TRAILER);
+  CHECK(mock::pin_mode[6] == OUTPUT);
+}
+
+void test_digital() {
+  CHECK_STR(request("/digital/6/1\r"), "{\"message\": \"Pin D6 set to 1\", " TRAILER);
+  CHECK_STR(request("/digital/6\r"), "{\"return_value\": 1, " TRAILER);
+  CHECK_STR(request("/digital/6/0\r"), "{\"message\": \"Pin D6 set to 0\", " TRAILER);
+  CHECK_STR(request("/digital/6/r\r"), "{\"return_value\": 0, " TRAILER);
+  CHECK_STR(request("/digital/13/1\r"), "{\"message\": \"Pin D13 set to 1\", " TRAILER);
+  CHECK(mock::pin_value[13] == HIGH);
+}
+
+void test_digital_all() {
+  mock::pin_value[3] = HIGH;
+  const char *answer = request("/digital/a\r");
+  CHECK(strncmp(answer, "{\"D0\": 0, \"D1\": 0, \"D2\": 0, \"D3\": 1, ", 36) == 0);
+  CHECK_CONTAINS(answer, "\"D13\": 1, " TRAILER);
+
+  // Each port register is read once, no pin is read on its own
+  mock::reset_counters();
+  request("/digital/a\r");
+  CHECK(mock::digital_reads == 0);
+  CHECK(mock::port_reads == (NUMBER_DIGITAL_PINS + 7) / 8);
+
+  // Packed: one bit per pin, pin 0 lowest
+  CHECK_STR(request("/digital/p\r"), "{\"digital\": \"0x2008\", " TRAILER);
+  mock::pin_value[3] = LOW;
+  CHECK_STR(request("/digital/p\r"), "{\"digital\": \"0x2000\", " TRAILER);
+}
+
+void test_analog() {
+  mock::analog_value[0] = 512;
+  CHECK_STR(request("/analog/0\r"), "{\"return_value\": 512, " TRAILER);
+  CHECK_STR(request("/analog/A0\r"), "{\"return_value\": 0, " TRAILER);
+  CHECK_STR(request("/analog/6/100\r"), "{\"message\": \"Pin D6 set to 100\", " TRAILER);
+
+  const char *answer = request("/analog/a\r");
+  CHECK(strncmp(answer, "{\"A0\": 512, \"A1\": 0, ", 21) == 0);
+  CHECK_CONTAINS(answer, "\"A5\": 0, " TRAILER);
+
+  // Packed: every pin in one array, each read once
+  mock::analog_value[5] = 1023;
+  mock::reset_counters();
+  CHECK_STR(request("/analog/p\r"), "{\"analog\": [512, 0, 0, 0, 0, 1023], " TRAILER);
+  CHECK(mock::analog_reads == NUMBER_ANALOG_PINS);
+  mock::analog_value[5] = 0;
+}
+
+void test_variables() {
+  CHECK_STR(request("/temperature\r"), "{\"temperature\": 24, " TRAILER);
+  CHECK_STR(request("/humidity\r"), "{\"humidity\": 40, " TRAILER);
+  CHECK_STR(request("/ratio\r"), "{\"ratio\":  1.50, " TRAILER);
+  CHECK_STR(request("/label\r"), "{\"label\": \"ok\", " TRAILER);
+}
+
+void test_number_formatting() {
+  temperature = -1234;
+  CHECK_STR(request("/temperature\r"), "{\"temperature\": -1234, " TRAILER);
+  temperature = 0;
+  CHECK_STR(request("/temperature\r"), "{\"temperature\": 0, " TRAILER);
+  temperature = 2147483647;
+  CHECK_STR(request("/temperature\r"), "{\"temperature\": 2147483647, " TRAILER);
+  temperature = 24;
+
+  ratio = -0.5;
+  CHECK_STR(request("/ratio\r"), "{\"ratio\": -0.50, " TRAILER);
+  ratio = 123456.789;
+  CHECK_STR(request("/ratio\r"), "{\"ratio\": 123456.79, " TRAILER);
+  ratio = 9.999;
+  CHECK_STR(request("/ratio\r"), "{\"ratio\": 10.00, " TRAILER);
+  ratio = 2.5e10;
+  CHECK_STR(request("/ratio\r"), "{\"ratio\": 2.50e+10, " TRAILER);
+  ratio = 1.5;
+  rest.set_float_precision(4);
+  CHECK_STR(request("/ratio\r"), "{\"ratio\": 1.5000, " TRAILER);
+  rest.set_float_precision(0);
+  CHECK_STR(request("/ratio\r"), "{\"ratio\":     2, " TRAILER);
+  rest.set_float_precision(2);
+}
+
+void test_no_allocations() {
+  request("/\r");
+  mock::reset_counters();
+  request("/\r");
+  request("/temperature\r");
+  request("/ratio\r");
+  request("/digital/a\r");
+  request("/digital/p\r");
+  request("/analog/p\r");
+  CHECK(mock::heap_allocations == 0);
+}
+
+void test_exact_names() {
+  const char *root = "{\"variables\": {";
+  CHECK(strncmp(request("/temp\r"), root, strlen(root)) == 0);
+  CHECK(strncmp(request("/temperaturex\r"), root, strlen(root)) == 0);
+  CHECK(strncmp(request("/ledx?params=1\r"), root, strlen(root)) == 0);
+}
+
+void test_function() {
+  CHECK_STR(request("/led?params=1\r"), "{, \"return_value\": 1, " TRAILER);
+  CHECK(mock::pin_value[6] == HIGH);
+  CHECK_STR(request("/led?params=0\r"), "{, \"return_value\": 1, " TRAILER);
+  CHECK(mock::pin_value[6] == LOW);
+}
+
+void test_id_and_root() {
+  CHECK_STR(request("/id\r"), "{" TRAILER);
+  CHECK_STR(request("/\r"),
+    "{\"variables\": {\"temperature\": 24, \"humidity\": 40, \"label\": \"ok\", \"ratio\":  1.50}, " TRAILER);
+
+  // The trailer follows the ID & name
+  rest.set_id("002");
+  rest.set_name(String("board"));
+  CHECK_STR(request("/temperature\r"),
+    "{\"temperature\": 24, \"id\": \"002\", \"name\": \"board\", \"hardware\": \"arduino\", \"connected\": true}\r\n");
+  rest.set_id("001");
+  rest.set_name("host");
+  CHECK_STR(request("/id\r"), "{" TRAILER);
+}
+
+void test_long_segment() {
+  char command[300];
+  memset(command, 'x', 250);
+  strcpy(command + 250, "\r");
+  CHECK_CONTAINS(request(command), "{\"variables\": {");
+  CHECK_STR(request("/led?params=1\r"), "{, \"return_value\": 1, " TRAILER);
+}
+
+void test_streamed_answer() {
+
+  // Larger than the output buffer: streamed to the port as it fills up
+  char value[1001];
+  memset(value, 'v', 1000);
+  value[1000] = '\0';
+  label = value;
+  const char *answer = request("/label\r");
+  CHECK(strlen(answer) == strlen("{\"label\": \"\", " TRAILER) + 1000);
+  CHECK(strncmp(answer, "{\"label\": \"vvvv", 15) == 0);
+  CHECK_CONTAINS(answer, "vvvv\", " TRAILER);
+
+  // Without a client to stream to, the answer is cut to the buffer size
+  char command[] = "/label /";
+  rest.handle(command);
+  CHECK(strlen(rest.getBuffer()) == OUTPUT_BUFFER_SIZE - 1);
+  rest.resetBuffer();
+
+  label = "ok";
+  CHECK_STR(request("/label\r"), "{\"label\": \"ok\", " TRAILER);
+}
+
+void test_flow_control() {
+  const char *root = "{\"variables\": {\"temperature\": 24, \"humidity\": 40, \"label\": \"ok\", \"ratio\":  1.50}, " TRAILER;
+
+  // Short writes: the rest of the answer is written from where it stopped
+  port.limit_writes(16);
+  CHECK_STR(request("/\r"), root);
+  CHECK(port.writes() >= strlen(root) / 16);
+
+  // A full transport is waited for, without fixed delays, and not written
+  // to while it reports no room, as its writes would block
+  char command[] = "/ /";
+  unsigned long stalls = rest.get_send_stalls();
+  rest.handle_proto(command);
+  port.clear();
+  port.stall(3, 1);
+  port.block_when_full(true);
+  mock::delayed_ms = 0;
+  rest.sendBuffer(port, 100, 0);
+  CHECK_STR(port.output(), root);
+  CHECK(rest.get_send_stalls() == stalls + 3);
+  CHECK(port.blocked_writes() == 0);
+  CHECK(mock::delayed_ms == 0);
+  port.block_when_full(false);
+  rest.reset_status();
+
+  // Nor is a client that can't report its room taken for a full one after
+  // a client that did
+  port.limit_writes(0, false);
+  CHECK_STR(request("/\r"), root);
+  CHECK(rest.get_send_stalls() == stalls + 3);
+
+  // Clients that can't report their room, with a learned chunk size
+  port.limit_writes(10, false);
+  rest.set_pacing(AREST_PACING_ADAPTIVE);
+  CHECK_STR(request("/\r"), root);
+  CHECK_STR(request("/temperature\r"), "{\"temperature\": 24, " TRAILER);
+
+  // A transport that never drains is given up on
+  rest.set_pacing(AREST_PACING_FLOW);
+  rest.handle_proto(command);
+  port.clear();
+  port.stall(100000);
+  rest.sendBuffer(port, 0, 10);
+  CHECK(port.output_length() == 0);
+  CHECK(strlen(rest.getBuffer()) == 0);
+  rest.reset_status();
+  port.stall(0);
+  port.limit_writes(0, false);
+
+  // Former pacing: fixed chunks with a delay after each
+  rest.set_pacing(AREST_PACING_FIXED);
+  mock::delayed_ms = 0;
+  rest.handle_proto(command);
+  port.clear();
+  rest.sendBuffer(port, 25, 1);
+  CHECK_STR(port.output(), root);
+  CHECK(mock::delayed_ms == (strlen(root) + 24) / 25);
+  rest.reset_status();
+  rest.set_pacing(AREST_PACING_FLOW);
+}
+
+void test_batch() {
+  mock::pin_value[6] = HIGH;
+  mock::pin_value[7] = LOW;
+  mock::analog_value[0] = 512;
+  mock::analog_value[3] = 7;
+  CHECK_STR(request("/batch?v=temperature,humidity&d=6,7&a=0,3\r"),
+    "{\"temperature\": 24, \"humidity\": 40, \"D6\": 1, \"D7\": 0, \"A0\": 512, \"A3\": 7, " TRAILER);
+
+  // Every kind of variable, pins in any order; unknown names & functions are left out
+  CHECK_STR(request("/batch?a=A3&v=label,missing,led,ratio&d=D6\r"),
+    "{\"A3\": 7, \"label\": \"ok\", \"ratio\":  1.50, \"D6\": 1, " TRAILER);
+
+  // Queries longer than the segment buffer
+  CHECK_STR(request("/batch?v=temperature,humidity,temperature,humidity,temperature,humidity,temperature\r"),
+    "{\"temperature\": 24, \"humidity\": 40, \"temperature\": 24, \"humidity\": 40, "
+    "\"temperature\": 24, \"humidity\": 40, \"temperature\": 24, " TRAILER);
+
+  // Up to AREST_BATCH_SIZE items
+  char command[256] = "/batch?d=";
+  for (int i = 0; i < AREST_BATCH_SIZE + 4; i++) strcat(command, "6,");
+  strcat(command, "6\r");
+  const char *answer = request(command);
+  int items = 0;
+  for (const char *p = strstr(answer, "\"D6\""); p != NULL; p = strstr(p + 1, "\"D6\"")) items++;
+  CHECK(items == AREST_BATCH_SIZE);
+
+  // Empty batch
+  CHECK_STR(request("/batch?\r"), "{" TRAILER);
+}
+
+void test_line_ends() {
+
+  // One command per call, read up to the end of its line, without delays
+  port.clear();
+  port.inject("/temperature\r\n/humidity\r/id\r");
+  mock::delayed_ms = 0;
+  rest.handle(port);
+  CHECK_STR(port.output(), "{\"temperature\": 24, " TRAILER);
+  port.clear_output();
+  rest.handle(port);
+  CHECK_STR(port.output(), "{\"humidity\": 40, " TRAILER);
+  port.clear_output();
+  rest.handle(port);
+  CHECK_STR(port.output(), "{" TRAILER);
+  CHECK(port.available() == 0);
+  CHECK(mock::delayed_ms == 0);
+
+  // A command without a line end is answered once the port stays quiet
+  unsigned long start = millis();
+  CHECK_STR(request("/humidity/"), "{\"humidity\": 40, " TRAILER);
+  CHECK(millis() - start >= AREST_SERIAL_TIMEOUT);
+}
+
+void test_char_handler() {
+  char command[] = "/temperature /";
+  rest.handle(command);
+  CHECK_STR(rest.getBuffer(), "{\"temperature\": 24, " TRAILER);
+  rest.resetBuffer();
+}
+
+void test_trace() {
+  Serial.clear();
+  rest.clear_trace();
+  request("/digital/6\r");
+  request("/nothing\r");
+
+  // The last events, oldest first: [time, event, a, b]
+  const char *answer = request("/trace\r");
+  CHECK(strncmp(answer, "{\"trace\": [[", 12) == 0);
+  CHECK_CONTAINS(answer, "]], " TRAILER);
+  unsigned long times[4];
+  int events[4], a[4], b[4];
+  const char *record = answer + 11;
+  for (int i = 0; i < 4; i++) {
+    CHECK(sscanf(record, "[%lu, %d, %d, %d]", &times[i], &events[i], &a[i], &b[i]) == 4);
+    record = strchr(record, ']') + 3;
+  }
+  CHECK(times[0] <= times[1] && times[1] <= times[2] && times[2] <= times[3]);
+  CHECK(events[0] == AREST_TRACE_SENT && a[0] == 0 && b[0] == (int)strlen("{\"return_value\": 0, " TRAILER));
+  CHECK(events[1] == AREST_TRACE_NOT_UNDERSTOOD);
+  CHECK(events[2] == AREST_TRACE_SENT);
+  CHECK(events[3] == AREST_TRACE_REQUEST && a[3] == 'T');
+
+  // Nothing is printed on the Serial port
+  CHECK(Serial.output_length() == 0);
+
+  // Details aren't traced at this level
+  rest.clear_trace();
+  request("/temperature\r");
+  answer = request("/trace\r");
+  CHECK(sscanf(answer, "{\"trace\": [[%lu, %d, %d, %d], [%lu, %d", &times[0], &events[0], &a[0], &b[0], &times[1], &events[1]) == 6);
+  CHECK(events[0] == AREST_TRACE_REQUEST && a[0] == 'v' && events[1] == AREST_TRACE_SENT);
+  CHECK(strstr(answer, "], [") != NULL && strstr(strstr(answer, "], [") + 4, "], [") != NULL);
+  CHECK(strstr(answer, ", 32, ") == NULL);
+}
+
+// Send a binary request and return the length of its decoded answer
+uint8_t binary_answer[1024];
+
+int binary_request(const uint8_t *request, size_t length) {
+  uint8_t frame[1024];
+  port.clear();
+  port.inject((const char *)frame, frame_request(request, length, frame));
+  rest.handle(port);
+  return unframe_answer((const uint8_t *)port.output(), port.output_length(), binary_answer);
+}
+
+void test_binary() {
+
+  // Routes, from the route index
+  uint8_t routes[] = {AREST_OP_ROUTES};
+  int length = binary_request(routes, 1);
+  static const uint8_t listed[] = {
+    AREST_OP_ROUTES, AREST_STATUS_OK,
+    0x01, 3, 'l', 'e', 'd',
+    0x41, 11, 't', 'e', 'm', 'p', 'e', 'r', 'a', 't', 'u', 'r', 'e',
+    0x42, 8, 'h', 'u', 'm', 'i', 'd', 'i', 't', 'y',
+    0x81, 5, 'r', 'a', 't', 'i', 'o',
+    0xC1, 5, 'l', 'a', 'b', 'e', 'l'};
+  CHECK(length == sizeof(listed) && memcmp(binary_answer, listed, sizeof(listed)) == 0);
+  CHECK(port.output()[0] == 0 && port.output()[port.output_length() - 1] == 0);
+
+  // Typed values
+  uint8_t get[] = {AREST_OP_GET, 0x41};
+  CHECK(binary_request(get, 2) == 7);
+  CHECK(binary_answer[1] == AREST_STATUS_OK && binary_answer[2] == AREST_VALUE_INT && frame_value(binary_answer + 3) == 24);
+  temperature = -3;
+  CHECK(binary_request(get, 2) == 7 && (int32_t)frame_value(binary_answer + 3) == -3);
+  temperature = 24;
+  get[1] = 0x81;
+  CHECK(binary_request(get, 2) == 7 && binary_answer[2] == AREST_VALUE_FLOAT);
+  uint32_t bits = frame_value(binary_answer + 3);
+  float value;
+  memcpy(&value, &bits, 4);
+  CHECK(value == 1.5f);
+  get[1] = 0xC1;
+  CHECK(binary_request(get, 2) == 6 && memcmp(binary_answer + 2, "s\x02ok", 4) == 0);
+
+  // Values longer than a COBS block
+  label = String();
+  for (int i = 0; i < 300; i++) label += "x";
+  CHECK(binary_request(get, 2) == 4 + 255);
+  CHECK(binary_answer[3] == 255 && binary_answer[4 + 254] == 'x');
+  label = "ok";
+
+  // Functions & pins
+  uint8_t call[] = {AREST_OP_CALL, 0x01, '1'};
+  CHECK(binary_request(call, 3) == 7 && frame_value(binary_answer + 3) == 1);
+  CHECK(mock::pin_value[6] == HIGH);
+  uint8_t write[] = {AREST_OP_DIGITAL_WRITE, 6, 0};
+  CHECK(binary_request(write, 3) == 2 && binary_answer[1] == AREST_STATUS_OK);
+  CHECK(mock::pin_value[6] == LOW);
+  uint8_t read[] = {AREST_OP_DIGITAL_READ, 6};
+  CHECK(binary_request(read, 2) == 7 && frame_value(binary_answer + 3) == 0);
+  mock::analog_value[2] = 517;
+  uint8_t analog[] = {AREST_OP_ANALOG_READ, 2};
+  CHECK(binary_request(analog, 2) == 7 && frame_value(binary_answer + 3) == 517);
+  uint8_t analog_write[] = {AREST_OP_ANALOG_WRITE, 5, 0x2C, 0x01};
+  CHECK(binary_request(analog_write, 4) == 2 && mock::pin_value[5] == HIGH);
+  uint8_t mode[] = {AREST_OP_MODE, 7, 1};
+  CHECK(binary_request(mode, 3) == 2 && mock::pin_mode[7] == OUTPUT);
+  mode[2] = 0;
+  CHECK(binary_request(mode, 3) == 2 && mock::pin_mode[7] == INPUT);
+
+  // Errors
+  get[1] = 0x01;
+  CHECK(binary_request(get, 2) == 2 && binary_answer[0] == AREST_OP_GET && binary_answer[1] == AREST_STATUS_BAD_REQUEST);
+  get[1] = 0x45;
+  CHECK(binary_request(get, 2) == 2 && binary_answer[1] == AREST_STATUS_BAD_REQUEST);
+  uint8_t unknown[] = {99};
+  CHECK(binary_request(unknown, 1) == 2 && binary_answer[1] == AREST_STATUS_BAD_REQUEST);
+  uint8_t frame[64];
+  size_t frame_length = frame_request(read, 2, frame);
+  frame[2] ^= 0x10;
+  port.clear();
+  port.inject((const char *)frame, frame_length);
+  rest.handle(port);
+  CHECK(unframe_answer((const uint8_t *)port.output(), port.output_length(), binary_answer) == 2);
+  CHECK(binary_answer[0] == 0 && binary_answer[1] == AREST_STATUS_BAD_FRAME);
+  uint8_t long_frame[REQUEST_BUFFER_SIZE + 8] = {0};
+  memset(long_frame + 1, 'x', sizeof(long_frame) - 2);
+  port.clear();
+  port.inject((const char *)long_frame, sizeof(long_frame));
+  rest.handle(port);
+  CHECK(port.available() == 0);
+  CHECK(unframe_answer((const uint8_t *)port.output(), port.output_length(), binary_answer) == 2);
+  CHECK(binary_answer[1] == AREST_STATUS_BAD_FRAME);
+
+  // Text requests are still understood, after binary ones
+  port.clear();
+  frame_length = frame_request(get, 2, frame);
+  port.inject((const char *)frame, frame_length);
+  port.inject("/temperature\r");
+  rest.handle(port);
+  port.clear_output();
+  rest.handle(port);
+  CHECK_STR(port.output(), "{\"temperature\": 24, " TRAILER);
+}
+
+int main() {
+
+  temperature = 24;
+  humidity = 40;
+  ratio = 1.5;
+  label = "ok";
+
+  rest.variable("temperature", &temperature);
+  rest.variable("humidity", &humidity);
+  rest.variable("ratio", &ratio);
+  rest.variable("label", &label);
+  rest.function("led", ledControl);
+  rest.set_id("001");
+  rest.set_name("host");
+
+  test_mode();
+  test_digital();
+  test_digital_all();
+  test_analog();
+  test_variables();
+  test_number_formatting();
+  test_no_allocations();
+  test_exact_names();
+  test_function();
+  test_id_and_root();
+  test_long_segment();
+  test_streamed_answer();
+  test_flow_control();
+  test_batch();
+  test_line_ends();
+  test_char_handler();
+  test_trace();
+  test_binary();
+
+  return test_summary("test_serial");
+}